@@ -20,6 +20,7 @@ AttributeRanker::AttributeRanker(Dataset* ds) {
 	dataset = ds;
 	classificationAccuracy = 1.0;
   k = 0;
+  neighborsMaxK = 0;
   normalizeScores = false;
 }
 
@@ -103,3 +104,34 @@ bool AttributeRanker::SetK(unsigned int newK) {
 
   return true;
 }
+
+bool AttributeRanker::SetNeighborsMaxK(unsigned int newMaxK) {
+  neighborsMaxK = newMaxK;
+
+  return true;
+}
+
+bool AttributeRanker::ComputeScoresForKs(const vector<unsigned int>& ks,
+                                         vector<AttributeScores>& kScores) {
+  kScores.clear();
+  if(ks.empty()) {
+    return true;
+  }
+  // distances and neighbor ranks do not depend on k: select the neighbors
+  // once for the largest k and reuse them for every k
+  dataset->ResetNearestNeighbors();
+  SetNeighborsMaxK(ks.back());
+  for(unsigned int kIdx = 0; kIdx < ks.size(); ++kIdx) {
+    cout << Timestamp() << "--------------------------" << endl;
+    cout << Timestamp() << "Running ReliefSeq for k=" << ks[kIdx] << endl;
+    if(!SetK(ks[kIdx])) {
+      cerr << "ERROR: k = " << ks[kIdx] << " is out of range" << endl;
+      SetNeighborsMaxK(0);
+      return false;
+    }
+    kScores.push_back(ComputeScores());
+  }
+  SetNeighborsMaxK(0);
+
+  return true;
+}
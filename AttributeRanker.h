@@ -15,6 +15,7 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
 
 #include "Dataset.h"
 #include "Insilico.h"
@@ -31,6 +32,24 @@ public:
   virtual AttributeScores ComputeScores() = 0;
   /// Set k nearest neighbors, with bounds checking
   virtual bool SetK(unsigned int newK);
+  /*************************************************************************//**
+   * Select the nearest neighbors once for the largest k of a k optimization
+   * sweep and reuse them for every smaller k, while the data set masks are
+   * unchanged.
+   * \param [in] newMaxK largest k of the sweep, or 0 to select per k
+   * \return success
+   ****************************************************************************/
+  virtual bool SetNeighborsMaxK(unsigned int newMaxK);
+  /*************************************************************************//**
+   * Compute the attribute scores for each k of a k optimization sweep,
+   * one ComputeScores per k with the neighbors selected once for the
+   * largest k. Leaves k set to the largest k.
+   * \param [in] ks values of k, ascending
+   * \param [out] kScores scores for each k
+   * \return success
+   ****************************************************************************/
+  virtual bool ComputeScoresForKs(const std::vector<unsigned int>& ks,
+                                  std::vector<AttributeScores>& kScores);
   /*************************************************************************//**
    * Get the (importance) scores as a vector of pairs: score, attribute name
    * \return vector of pairs
@@ -63,6 +82,8 @@ protected:
 	bool normalizeScores;
   /// k nearest neighbors
   unsigned int k;
+  /// nearest neighbors to select for a k sweep, 0 for k
+  unsigned int neighborsMaxK;
 };
 
 #endif
@@ -10,6 +10,9 @@
  * Created on: 4/7/04
  */
 
+#ifndef BESTN_H
+#define	BESTN_H
+
 #include <vector>
 #include <algorithm>
 #include <boost/pointee.hpp>
@@ -17,6 +20,87 @@
 namespace insilico
 {
 
+  /***************************************************************************//**
+   * Best n values added one at a time, keeping the first n values and then
+   * replacing the first largest kept value by any smaller input value.
+   * Instead of rescanning the kept values with max_element after every
+   * replacement, their positions are kept in a heap ordered like
+   * max_element: largest value first, ties by earliest position. A value
+   * that does not replace costs one comparison, one that does O(log n).
+   ******************************************************************************/
+  template <typename T, typename Comp>
+  class best_n_accumulator
+  {
+  public:
+    best_n_accumulator(size_t n = 0, Comp comp = Comp()) :
+    size(n), compare(comp) {
+    }
+    /// Add the next input value.
+    void add(const T& value) {
+      if(!size) {
+        return;
+      }
+      if(best.size() < size) {
+        best.push_back(value);
+        if(best.size() == size) {
+          heap.resize(size);
+          for(size_t i = 0; i < size; ++i) {
+            heap[i] = i;
+          }
+          std::make_heap(heap.begin(), heap.end(), position_below(*this));
+        }
+        return;
+      }
+
+      if(compare(value, best[heap.front()])) {
+        std::pop_heap(heap.begin(), heap.end(), position_below(*this));
+        best[heap.back()] = value;
+        std::push_heap(heap.begin(), heap.end(), position_below(*this));
+      }
+    }
+    /// Remove all values, keeping the memory for the next input.
+    void clear() {
+      best.clear();
+      heap.clear();
+    }
+    /// Return the best n values seen so far.
+    const std::vector<T>& values() const {
+      return best;
+    }
+    /// Are n values kept, so that only smaller inputs are added?
+    bool full() const {
+      return size && (best.size() == size);
+    }
+    /// Return the kept value the next smaller input replaces, if full().
+    const T& worst() const {
+      return best[heap.front()];
+    }
+  private:
+    /// heap order of positions: is a below b, after b in max_element order?
+    class position_below
+    {
+    public:
+      position_below(const best_n_accumulator& acc) : owner(acc) {
+      }
+      bool operator()(size_t a, size_t b) const {
+        if(owner.compare(owner.best[a], owner.best[b])) {
+          return true;
+        }
+        if(owner.compare(owner.best[b], owner.best[a])) {
+          return false;
+        }
+        return b < a;
+      }
+    private:
+      const best_n_accumulator& owner;
+    };
+    std::vector<T> best;
+    /// positions in best, a heap whose front is the next value replaced
+    std::vector<size_t> heap;
+    size_t size;
+    Comp compare;
+  };
+
   /***************************************************************************//**
    * Get the best n values with ties keeping same original order.
    * \param [in] begin iterator of the beginning of a input container
@@ -29,39 +113,14 @@ namespace insilico
   template <typename InputIt, typename OutputIt, typename Comp>
   void best_n(InputIt begin, InputIt end, OutputIt out, size_t n, Comp comp) {
     typedef typename boost::pointee<InputIt>::type T;
-    typename std::vector<T> best;
-    std::vector<size_t> indices(n);
-    int maxindex = 0;
-    int i = 0;
-
-    best.reserve(n);
-
-    for(typename std::vector<T>::const_iterator it = begin;
-        it != end; ++it, ++i) {
-      if(best.size() < n) {
-        indices[maxindex] = i;
-        best.push_back(*it);
+    best_n_accumulator<T, Comp> best(n, comp);
 
-        if(best.size() == n)
-          maxindex = std::distance(best.begin(),
-                                   std::max_element(best.begin(), best.end(), comp));
-        else
-          ++maxindex;
+    for(InputIt it = begin; it != end; ++it)
+      best.add(*it);
 
-        continue;
-      }
-
-      if(comp(*it, best[maxindex])) {
-        indices[maxindex] = i;
-        best[maxindex] = *it;
-        maxindex = std::distance(best.begin(),
-                                 std::max_element(best.begin(), best.end(), comp));
-      }
-    }
-
-    for(typename std::vector<T>::iterator i = best.begin();
-        i != best.end(); ++i)
-      *out++ = *i;
+    std::copy(best.values().begin(), best.values().end(), out);
   }
 
 }
+
+#endif	/* BESTN_H */
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <time.h>
+#include <omp.h>
 
 #include <boost/lexical_cast.hpp>
 //#include <R.h>
@@ -32,11 +33,12 @@
 //#include <RInside.h>
 
 #include "gsl/gsl_cdf.h"
-#include "GSLRandomFlat.h"
+#include "PhiloxRandom.h"
 
 #include "ChiSquared.h"
 #include "Dataset.h"
 #include "DatasetInstance.h"
+#include "DistanceMatrix.h"
 #include "StringUtils.h"
 #include "Statistics.h"
 #include "Insilico.h"
@@ -49,6 +51,15 @@ using namespace std;
 using namespace insilico;
 using namespace boost;
 
+/// instances per side of a distance matrix tile
+static const unsigned int DISTANCE_TILE_INSTANCES = 64;
+/// packed genotype words per attribute block of a distance matrix tile
+static const unsigned int DISTANCE_TILE_WORDS = 32;
+/// attributes per attribute block of a distance matrix tile
+static const unsigned int DISTANCE_TILE_ATTRIBUTES = 256;
+/// largest integer distance sum a float distance matrix can be downdated at
+static const double FLOAT_EXACT_INTEGER_SUM = 4194304.0;
+
 Dataset::Dataset() {
 	/// Set defaults.
 	snpsFilename = "";
@@ -84,13 +95,16 @@ Dataset::Dataset() {
 
 	/// metric defaults
 	snpMetric = "gm";
-	snpDiff = diffGMM;
-
 	snpMetricNN = "gm";
-	snpDiffNN = diffGMM;
-
+	snpMetricNNType = GM_SNP_METRIC;
 	numMetric = "manhattan";
-	numDiff = diffManhattan;
+	numMetricType = MANHATTAN_NUMERIC_METRIC;
+	snpInstanceMetric = false;
+	distancePrecision = DOUBLE_PRECISION;
+	distanceTileKernel = SelectMetricKernel<DistanceTileKernels>(
+			snpMetricNNType, numMetricType, false);
+	instanceDistanceKernel = SelectMetricKernel<InstanceDistanceKernels>(
+			snpMetricNNType, numMetricType, false);
 
 	cout << Timestamp() << "Default SNP diff metric: "
 			<< snpMetric << endl;
@@ -99,7 +113,10 @@ Dataset::Dataset() {
 	cout << Timestamp() << "Default continuous distance metric: " << numMetric
 			<< endl;
 
-	rng = NULL;
+	// seed the random number generator for random sampling; SetRandomSeed
+	// replaces the seed for repeatability
+	randomSeed = (uint64_t) getpid() * (uint64_t) time((time_t*) 0);
+	rng.Reset(randomSeed, 0);
 }
 
 Dataset::~Dataset() {
@@ -109,9 +126,6 @@ Dataset::~Dataset() {
 			delete *it;
 		}
 	}
-	if (rng) {
-		delete rng;
-	}
 }
 
 bool Dataset::LoadDataset(vector<vector<int> >& dataMatrix,
@@ -188,10 +202,6 @@ bool Dataset::LoadDataset(vector<vector<int> >& dataMatrix,
 	PrintStatsSimple();
 	// PrintLevelCounts();
 
-	// create and seed a random number generator for random sampling
-	// TODO: need to save the seed for repeatability? used to randomly sample
-	rng = new GSLRandomFlat(getpid() * time((time_t*) 0), 0.0, NumInstances());
-
 	return true;
 }
 
@@ -282,9 +292,6 @@ bool Dataset::LoadDataset(string snpsFilename, string numericsFilename,
 
 	hasPhenotypes = true;
 
-	// create and seed a random number generator for random sampling
-	rng = new GSLRandomFlat(getpid() * time((time_t*) 0), 0.0, NumInstances());
-
 	return true;
 }
 
@@ -332,9 +339,6 @@ bool Dataset::LoadDataset(DgeData* dgeData) {
 	hasNumerics = true;
 	hasAllelicInfo = false;
 
-	// create and seed a random number generator for random sampling
-	rng = new GSLRandomFlat(getpid() * time((time_t*) 0), 0.0, NumInstances());
-
 	return true;
 }
 
@@ -439,9 +443,6 @@ bool Dataset::LoadDataset(BirdseedData* birdseedData) {
 	UpdateAllLevelCounts();
 	// PrintLevelCounts();
 
-	// create and seed a random number generator for random sampling
-	rng = new GSLRandomFlat(getpid() * time((time_t*) 0), 0.0, NumInstances());
-
 	return true;
 }
 
@@ -1004,9 +1005,86 @@ DatasetInstance* Dataset::GetInstance(unsigned int index) {
 	exit(-1);
 }
 
-DatasetInstance* Dataset::GetRandomInstance() {
-	unsigned int index = (unsigned int) rng->nextRandVal();
-	return instances[index];
+void Dataset::SetRandomSeed(uint64_t newSeed) {
+	randomSeed = newSeed;
+	rng.Reset(randomSeed, 0);
+}
+
+uint64_t Dataset::GetRandomSeed() {
+	return randomSeed;
+}
+
+uint64_t Dataset::GetRandomPosition() {
+	return rng.Position();
+}
+
+void Dataset::SetRandomPosition(uint64_t position) {
+	rng.Seek(position);
+}
+
+PhiloxRandom Dataset::GetRandomStream(uint64_t streamNumber) {
+	return PhiloxRandom(randomSeed, streamNumber);
+}
+
+bool Dataset::SampleInstanceIndices(unsigned int numSamples,
+		vector<unsigned int>& instanceIndices) {
+	instanceIndices = MaskGetInstanceIndices();
+	if (numSamples > instanceIndices.size()) {
+		cerr << "ERROR: Cannot sample " << numSamples << " instances from "
+				<< instanceIndices.size() << " without replacement" << endl;
+		return false;
+	}
+	rng.PartialShuffle(numSamples, instanceIndices);
+	instanceIndices.resize(numSamples);
+	return true;
+}
+
+bool Dataset::SampleInstanceIndicesStratified(unsigned int numSamples,
+		vector<unsigned int>& instanceIndices) {
+	if (hasContinuousPhenotypes) {
+		cerr << "ERROR: Class-stratified sampling needs discrete class "
+				<< "phenotypes" << endl;
+		return false;
+	}
+	vector<unsigned int> maskIndices = MaskGetInstanceIndices();
+	unsigned int numMasked = maskIndices.size();
+	if (numSamples > numMasked) {
+		cerr << "ERROR: Cannot sample " << numSamples << " instances from "
+				<< numMasked << " without replacement" << endl;
+		return false;
+	}
+	map<ClassLevel, vector<unsigned int> > strata;
+	for (unsigned int i = 0; i < numMasked; ++i) {
+		strata[instances[maskIndices[i]]->GetClass()].push_back(maskIndices[i]);
+	}
+
+	// proportional allocation; the samples left by rounding down go to the
+	// largest remainders, ties to the lower class level
+	vector<unsigned int> strataSamples;
+	vector<pair<uint64_t, unsigned int> > remainders;
+	unsigned int numAllocated = 0;
+	map<ClassLevel, vector<unsigned int> >::const_iterator it;
+	for (it = strata.begin(); it != strata.end(); ++it) {
+		uint64_t share = (uint64_t) numSamples * it->second.size();
+		strataSamples.push_back((unsigned int) (share / numMasked));
+		numAllocated += strataSamples.back();
+		remainders.push_back(make_pair(numMasked - share % numMasked,
+				(unsigned int) remainders.size()));
+	}
+	sort(remainders.begin(), remainders.end());
+	for (unsigned int i = 0; numAllocated < numSamples; ++i, ++numAllocated) {
+		++strataSamples[remainders[i].second];
+	}
+
+	instanceIndices.clear();
+	unsigned int stratumIndex = 0;
+	for (it = strata.begin(); it != strata.end(); ++it, ++stratumIndex) {
+		vector<unsigned int> stratum(it->second);
+		rng.PartialShuffle(strataSamples[stratumIndex], stratum);
+		instanceIndices.insert(instanceIndices.end(), stratum.begin(),
+				stratum.begin() + strataSamples[stratumIndex]);
+	}
+	return true;
 }
 
 vector<string> Dataset::GetInstanceIds() {
@@ -2796,141 +2874,362 @@ double Dataset::ComputeInstanceToInstanceDistance(DatasetInstance* dsi1,
 		DatasetInstance* dsi2) {
 	double distance = 0;
 
-	if (HasGenotypes()) {
+	if (HasGenotypes() && snpInstanceMetric) {
 		if (snpMetric == "KM") {
 			distance = GetKimuraDistance(dsi1, dsi2);
 		} else {
-			if (snpMetric == "JC") {
-				distance = GetJukesCantorDistance(dsi1, dsi2);
-			} else {
-				vector<unsigned int> attributeIndices = MaskGetAttributeIndices(
-						DISCRETE_TYPE);
-				for (unsigned int i = 0; i < attributeIndices.size(); ++i) {
-					// DEBUG
-			  	pair<char, char> alleles =
-		  			dsi1->GetDatasetPtr()->GetAttributeAlleles(attributeIndices[i]);
-			  	string a1 = " ";
-			  	a1[0] = alleles.first;
-			  	string a2 = " ";
-			  	a2[0] = alleles.second;
-			  	map<AttributeLevel, string> genotypeMap;
-			  	genotypeMap[0] = a1 + a1;
-			  	genotypeMap[1] = a1 + a2;
-			  	genotypeMap[2] = a2 + a2;
-			  	AttributeLevel attrLevel1 = dsi1->attributes[attributeIndices[i]];
-			  	AttributeLevel attrLevel2 = dsi2->attributes[attributeIndices[i]];
-			  	string genotype1 = genotypeMap[attrLevel1];
-			  	string genotype2 = genotypeMap[attrLevel2];
-			  	double tempDistance = snpDiffNN(attributeIndices[i], dsi1, dsi2);
-					distance += tempDistance;
-					// cout 
-					// 	<< a1 << "\t" << a2 << "\t" 
-					// 	<< attrLevel1 << "\t" << attrLevel2 << "\t"
-					// 	<< genotype1 << "\t" << genotype2 << "\t" 
-					// 	<< tempDistance << "\t" << distance << endl;
-				}
-			}
+			distance = GetJukesCantorDistance(dsi1, dsi2);
 		}
-		// cout << "SNP distance = " << distance << endl;
+		// added 6/16/11
+		// compute numeric distances
+		return distance + (this->*instanceDistanceKernel)(dsi1, dsi2, false, true);
 	}
 
-	// added 6/16/11
-	// compute numeric distances
-	if (HasNumerics()) {
-		//cout << "Computing numeric instance-to-instance distance..." << endl;
+	return (this->*instanceDistanceKernel)(dsi1, dsi2, HasGenotypes(), true);
+}
+
+template<class SnpMetric, class NumericMetric>
+double Dataset::ComputeInstanceDistance(DatasetInstance* dsi1,
+		DatasetInstance* dsi2, bool sumSnpDiffs, bool sumNumericDiffs) {
+	MetricContext context = GetMetricContext(snpMetricNN);
+	double distance = 0.0;
+	if (sumSnpDiffs) {
+		SnpMetric snpDiff(context);
+		vector<unsigned int> attributeIndices = MaskGetAttributeIndices(
+				DISCRETE_TYPE);
+		for (unsigned int i = 0; i < attributeIndices.size(); ++i) {
+			distance += snpDiff.Diff(attributeIndices[i], dsi1, dsi2);
+		}
+	}
+	double numericsDistance = 0.0;
+	if (sumNumericDiffs && HasNumerics()) {
+		NumericMetric numDiff(context);
 		vector<unsigned int> numericIndices = MaskGetAttributeIndices(NUMERIC_TYPE);
-		//cout << "\tNumber of numerics: " << numericIndices.size() << endl;
 		for (unsigned int i = 0; i < numericIndices.size(); ++i) {
-			//cout << "\t\tNumeric index: " << numericIndices[i] << endl;
-			double numDistance = numDiff(numericIndices[i], dsi1, dsi2);
-			//cout << "Numeric distance " << i << " => " << numDistance << endl;
-			distance += numDistance;
+			numericsDistance += numDiff.Diff(numericIndices[i], dsi1, dsi2);
 		}
 	}
 
-	return distance;
+	return distance + numericsDistance;
 }
 
-bool Dataset::SetDistanceMetrics(string newSnpWeightMetric, string newSnpNNMetric, 
-	string newNumMetric) {
-	/// set the SNP metric function pointer
-	bool snpMetricFunctionUnset = true;
-	if (snpMetricFunctionUnset && to_upper(newSnpWeightMetric) == "GM") {
-		snpDiff = diffGMM;
-		snpMetricFunctionUnset = false;
+bool Dataset::PrepareInstanceDistances() {
+	distanceInstanceIndices = MaskGetInstanceIndices();
+	distanceAttributeIndices = MaskGetAttributeIndices(DISCRETE_TYPE);
+	distanceNumericIndices = MaskGetAttributeIndices(NUMERIC_TYPE);
+	packedGenotypes.Clear();
+	packedNumerics.Clear();
+	if (HasNumerics() && distanceNumericIndices.size()) {
+		packedNumerics.Pack(this, distanceInstanceIndices, distanceNumericIndices,
+				numMetricType, distancePrecision);
+	}
+	if (!HasGenotypes() || snpInstanceMetric) {
+		return true;
 	}
-	if (snpMetricFunctionUnset && to_upper(newSnpWeightMetric) == "AM") {
-		snpDiff = diffAMM;
-		snpMetricFunctionUnset = false;
+	PackedGenotypeMetric packedMetric = PackedGenotypes::MetricFromName(
+			snpMetricNN);
+	if (packedMetric == PACKED_NO_METRIC) {
+		return true;
 	}
-	if (snpMetricFunctionUnset && to_upper(newSnpWeightMetric) == "NCA") {
-		snpDiff = diffNCA;
-		snpMetricFunctionUnset = false;
+	if (!packedGenotypes.Pack(this, distanceInstanceIndices,
+			distanceAttributeIndices, packedMetric)) {
+		cout << Timestamp() << "WARNING: genotypes could not be packed, "
+				<< "using unpacked " << snpMetricNN << " distances" << endl;
 	}
-	if (snpMetricFunctionUnset && to_upper(newSnpWeightMetric) == "NCA6") {
-		snpDiff = diffNCA6;
-		snpMetricFunctionUnset = false;
+
+	return true;
+}
+
+double Dataset::ComputeMaskedInstanceDistance(unsigned int maskIndex1,
+		unsigned int maskIndex2) {
+	DatasetInstance* dsi1 = instances[distanceInstanceIndices[maskIndex1]];
+	DatasetInstance* dsi2 = instances[distanceInstanceIndices[maskIndex2]];
+	if (!packedGenotypes.IsPacked() && !packedNumerics.IsPacked()) {
+		return ComputeInstanceToInstanceDistance(dsi1, dsi2);
 	}
-	if (snpMetricFunctionUnset && to_upper(newSnpWeightMetric) == "KM") {
-		snpDiff = diffKM;
-		snpMetricFunctionUnset = false;
+
+	double distance = 0.0;
+	if (packedGenotypes.IsPacked()) {
+		distance = packedGenotypes.Distance(maskIndex1, maskIndex2);
+	} else if (HasGenotypes() && snpInstanceMetric) {
+		if (snpMetric == "KM") {
+			distance = GetKimuraDistance(dsi1, dsi2);
+		} else {
+			distance = GetJukesCantorDistance(dsi1, dsi2);
+		}
+	} else if (HasGenotypes()) {
+		distance = (this->*instanceDistanceKernel)(dsi1, dsi2, true, false);
 	}
-	if (snpMetricFunctionUnset) {
-		cerr << "ERROR: Cannot set SNP diff metric to ["
-				<< newSnpWeightMetric << "]" << endl;
-		return false;
+	if (!packedNumerics.IsPacked()) {
+		return distance + (this->*instanceDistanceKernel)(dsi1, dsi2, false, true);
 	}
-	snpMetric = newSnpWeightMetric;
 
-	/// set the nearest neighbors metric
-	bool snpNNMetricFunctionUnset = true;
-	if (snpNNMetricFunctionUnset && to_upper(newSnpNNMetric) == "GM") {
-		snpDiffNN = diffGMM;
-		snpNNMetricFunctionUnset = false;
+	return distance + packedNumerics.Distance(maskIndex1, maskIndex2);
+}
+
+template<class SnpMetric, class NumericMetric>
+void Dataset::ComputeDistanceTile(const DistanceTile& tile,
+		PackedGenotypes& tileGenotypes, PackedNumerics& tileNumerics,
+		const vector<unsigned int>& attributeIndices,
+		const vector<unsigned int>& numericIndices, double* snpSums,
+		double* numericSums) {
+	unsigned int numRows = tile.rowEnd - tile.rowBegin;
+	unsigned int numCols = tile.colEnd - tile.colBegin;
+	bool diagonalTile = (tile.colBegin == tile.rowBegin);
+	for (unsigned int r = 0; r < numRows * numCols; ++r) {
+		snpSums[r] = 0.0;
+		numericSums[r] = 0.0;
+	}
+
+	// pairs i < j of the tile are visited once per attribute block, so the
+	// rows' attribute block stays in cache while all column partners use it;
+	// each pair still sums its attributes in order
+	if (tileGenotypes.IsPacked()) {
+		unsigned int numWords = tileGenotypes.NumWords();
+		for (unsigned int wordBegin = 0; wordBegin < numWords;
+				wordBegin += DISTANCE_TILE_WORDS) {
+			unsigned int wordEnd = min(wordBegin + DISTANCE_TILE_WORDS, numWords);
+			for (unsigned int r = 0; r < numRows; ++r) {
+				unsigned int i = tile.rowBegin + r;
+				for (unsigned int c = diagonalTile ? r + 1 : 0; c < numCols; ++c) {
+					snpSums[r * numCols + c] += (double) tileGenotypes.IntegerDistance(
+							i, tile.colBegin + c, wordBegin, wordEnd);
+				}
+			}
+		}
+	} else {
+		if (HasGenotypes()) {
+			if (snpInstanceMetric) {
+				bool kimura = (snpMetric == "KM");
+				for (unsigned int r = 0; r < numRows; ++r) {
+					DatasetInstance* dsi1 =
+							instances[distanceInstanceIndices[tile.rowBegin + r]];
+					for (unsigned int c = diagonalTile ? r + 1 : 0; c < numCols; ++c) {
+						DatasetInstance* dsi2 =
+								instances[distanceInstanceIndices[tile.colBegin + c]];
+						if (kimura) {
+							snpSums[r * numCols + c] = GetKimuraDistance(dsi1, dsi2);
+						} else {
+							snpSums[r * numCols + c] = GetJukesCantorDistance(dsi1, dsi2);
+						}
+					}
+				}
+			} else {
+				AccumulateDistanceTile(tile, attributeIndices,
+						SnpMetric(GetMetricContext(snpMetricNN)), snpSums);
+			}
+		}
 	}
-	if (snpNNMetricFunctionUnset && to_upper(newSnpNNMetric) == "AM") {
-		snpDiffNN = diffAMM;
-		snpNNMetricFunctionUnset = false;
+	if (tileNumerics.IsPacked()) {
+		// same blocks, in the same order, as PackedNumerics::Distance
+		unsigned int rowStride = tileNumerics.RowStride();
+		for (unsigned int numBegin = 0; numBegin < rowStride;
+				numBegin += PACKED_NUMERICS_BLOCK) {
+			unsigned int numEnd = min(numBegin + PACKED_NUMERICS_BLOCK, rowStride);
+			for (unsigned int r = 0; r < numRows; ++r) {
+				unsigned int i = tile.rowBegin + r;
+				for (unsigned int c = diagonalTile ? r + 1 : 0; c < numCols; ++c) {
+					numericSums[r * numCols + c] += tileNumerics.Distance(i,
+							tile.colBegin + c, numBegin, numEnd);
+				}
+			}
+		}
+	} else {
+		if (HasNumerics()) {
+			AccumulateDistanceTile(tile, numericIndices,
+					NumericMetric(GetMetricContext(snpMetricNN)), numericSums);
+		}
 	}
-	if (snpNNMetricFunctionUnset && to_upper(newSnpNNMetric) == "NCA") {
-		snpDiffNN = diffNCA;
-		snpNNMetricFunctionUnset = false;
+}
+
+template<class Metric>
+void Dataset::AccumulateDistanceTile(const DistanceTile& tile,
+		const vector<unsigned int>& attributeIndices, const Metric& metric,
+		double* sums) {
+	unsigned int numRows = tile.rowEnd - tile.rowBegin;
+	unsigned int numCols = tile.colEnd - tile.colBegin;
+	bool diagonalTile = (tile.colBegin == tile.rowBegin);
+	unsigned int numAttributes = attributeIndices.size();
+	for (unsigned int attrBegin = 0; attrBegin < numAttributes;
+			attrBegin += DISTANCE_TILE_ATTRIBUTES) {
+		unsigned int attrEnd = min(attrBegin + DISTANCE_TILE_ATTRIBUTES,
+				numAttributes);
+		for (unsigned int r = 0; r < numRows; ++r) {
+			DatasetInstance* dsi1 =
+					instances[distanceInstanceIndices[tile.rowBegin + r]];
+			for (unsigned int c = diagonalTile ? r + 1 : 0; c < numCols; ++c) {
+				DatasetInstance* dsi2 =
+						instances[distanceInstanceIndices[tile.colBegin + c]];
+				double sum = sums[r * numCols + c];
+				for (unsigned int a = attrBegin; a < attrEnd; ++a) {
+					sum += metric.Diff(attributeIndices[a], dsi1, dsi2);
+				}
+				sums[r * numCols + c] = sum;
+			}
+		}
 	}
-	if (snpNNMetricFunctionUnset && to_upper(newSnpNNMetric) == "NCA6") {
-		snpDiffNN = diffNCA6;
-		snpNNMetricFunctionUnset = false;
+}
+
+bool Dataset::GetRemovedIndices(const vector<unsigned int>& oldIndices,
+		const vector<unsigned int>& newIndices,
+		vector<unsigned int>& removedIndices) {
+	removedIndices.clear();
+	vector<unsigned int> sortedOld(oldIndices);
+	vector<unsigned int> sortedNew(newIndices);
+	sort(sortedOld.begin(), sortedOld.end());
+	sort(sortedNew.begin(), sortedNew.end());
+	if (!includes(sortedOld.begin(), sortedOld.end(), sortedNew.begin(),
+			sortedNew.end())) {
+		return false;
 	}
-	if (snpNNMetricFunctionUnset && to_upper(newSnpNNMetric) == "KM") {
-		snpDiffNN = diffKM;
-		snpNNMetricFunctionUnset = false;
+	set_difference(sortedOld.begin(), sortedOld.end(), sortedNew.begin(),
+			sortedNew.end(), back_inserter(removedIndices));
+
+	return true;
+}
+
+bool Dataset::SetDistanceMetrics(string newSnpWeightMetric, string newSnpNNMetric, 
+	string newNumMetric) {
+	/// check the SNP weight metric
+	if (SnpMetricTypeFromName(newSnpWeightMetric) == NO_SNP_METRIC) {
+		cerr << "ERROR: Cannot set SNP diff metric to ["
+				<< newSnpWeightMetric << "]" << endl;
+		return false;
 	}
-	if (snpNNMetricFunctionUnset) {
+	snpMetric = newSnpWeightMetric;
+	snpInstanceMetric = (snpMetric == "KM") || (snpMetric == "JC");
+
+	/// set the nearest neighbors metric
+	SnpMetricType newSnpNNMetricType = SnpMetricTypeFromName(newSnpNNMetric);
+	if (newSnpNNMetricType == NO_SNP_METRIC) {
 		cerr << "ERROR: Cannot set SNP nearest neighbors metric to ["
 				<< newSnpNNMetric << "]" << endl;
 		return false;
 	}
 	snpMetricNN = newSnpNNMetric;
+	snpMetricNNType = newSnpNNMetricType;
 
-	if (to_upper(newNumMetric) == "MANHATTAN") {
-		numDiff = diffManhattan;
-	} else {
-		if (to_upper(newNumMetric) == "EUCLIDEAN") {
-			numDiff = diffEuclidean;
-		}
-		else {
-			cerr << "ERROR: [" << newNumMetric
-					<< "] is not a valid numeric metric type" << endl;
-			return false;
-		}
+	NumericMetricType newNumMetricType = NumericMetricTypeFromName(newNumMetric);
+	if (newNumMetricType == NO_NUMERIC_METRIC) {
+		cerr << "ERROR: [" << newNumMetric
+				<< "] is not a valid numeric metric type" << endl;
+		return false;
 	}
 	numMetric = newNumMetric;
+	numMetricType = newNumMetricType;
+
+	/// one specialized kernel per metric combination, selected here once
+	bool hasSnpDiffTables = CompileSnpDiffTables();
+	distanceTileKernel = SelectMetricKernel<DistanceTileKernels>(
+			snpMetricNNType, numMetricType, hasSnpDiffTables);
+	instanceDistanceKernel = SelectMetricKernel<InstanceDistanceKernels>(
+			snpMetricNNType, numMetricType, hasSnpDiffTables);
 
 	cout << Timestamp() << "New SNP distance diff metric: "
-			<< snpMetric << " " << (void*) snpDiff << endl;
+			<< snpMetric << endl;
 	cout << Timestamp() << "New SNP distance nearest neighbor metric: "
-			<< snpMetricNN << " " << (void *)snpDiffNN << endl;
+			<< snpMetricNN << endl;
 	cout << Timestamp() << "New continuous distance metric: " << numMetric
-			<< " " << (void *) numDiff << endl;
+			<< endl;
+	cout << Timestamp() << "Numeric distance kernel: "
+			<< PackedNumerics::KernelName() << endl;
+
+	return true;
+}
+
+MetricContext Dataset::GetMetricContext(string snpMetricName) {
+	MetricContext context;
+	context.snpDiffTables = 0;
+	context.snpDiffTableOffsets = 0;
+	if (!snpDiffTables.empty()) {
+		if (to_upper(snpMetricName) == to_upper(snpMetricNN)) {
+			context.snpDiffTables = &snpDiffTables[0];
+			context.snpDiffTableOffsets = &snpDiffNNTableOffsets[0];
+		} else {
+			if (to_upper(snpMetricName) == to_upper(snpMetric)) {
+				context.snpDiffTables = &snpDiffTables[0];
+				context.snpDiffTableOffsets = &snpDiffTableOffsets[0];
+			}
+		}
+	}
+	context.numericsMinMax = 0;
+	if (!numericsMinMax.empty()) {
+		context.numericsMinMax = &numericsMinMax[0];
+	}
+
+	return context;
+}
+
+bool Dataset::CompileSnpDiffTables() {
+	snpDiffTables.clear();
+	snpDiffTableOffsets.clear();
+	snpDiffNNTableOffsets.clear();
+	if (!HasGenotypes()) {
+		return false;
+	}
+	bool needAlleles = (to_upper(snpMetric) == "NCA")
+			|| (to_upper(snpMetricNN) == "NCA");
+	if (needAlleles && !hasAllelicInfo) {
+		return false;
+	}
+
+	// every genotype must have a row and column in the tables
+	bool allValid = true;
+#pragma omp parallel for reduction(&&:allValid)
+	for (int i = 0; i < (int) instances.size(); ++i) {
+		const vector<AttributeLevel>& levels = instances[i]->attributes;
+		for (unsigned int a = 0; a < levels.size(); ++a) {
+			if ((levels[a] != MISSING_ATTRIBUTE_VALUE)
+					&& ((levels[a] < 0) || (levels[a] > 2))) {
+				allValid = false;
+			}
+		}
+	}
+	if (!allValid) {
+		cout << Timestamp() << "WARNING: genotypes other than 0, 1, 2 and "
+				<< "missing, not using SNP diff tables" << endl;
+		return false;
+	}
+
+	// attributes with the same alleles and mutation type share a table
+	unsigned int numAttributes = attributeNames.size();
+	snpDiffTableOffsets.resize(numAttributes);
+	snpDiffNNTableOffsets.resize(numAttributes);
+	map<vector<double>, unsigned int> tableOffsets;
+	vector<double> table(DIFF_TABLE_SIZE);
+	for (unsigned int a = 0; a < numAttributes; ++a) {
+		pair<char, char> alleles = make_pair(' ', ' ');
+		if (needAlleles) {
+			alleles = GetAttributeAlleles(a);
+		}
+		AttributeMutationType mutationType = GetAttributeMutationType(a);
+		for (unsigned int metricIdx = 0; metricIdx < 2; ++metricIdx) {
+			string metric = metricIdx ? snpMetricNN : snpMetric;
+			if (!FillDiffTable(metric, alleles, mutationType, &table[0])) {
+				snpDiffTables.clear();
+				snpDiffTableOffsets.clear();
+				snpDiffNNTableOffsets.clear();
+				return false;
+			}
+			map<vector<double>, unsigned int>::const_iterator tableIt =
+					tableOffsets.find(table);
+			unsigned int offset = 0;
+			if (tableIt == tableOffsets.end()) {
+				offset = snpDiffTables.size();
+				tableOffsets[table] = offset;
+				snpDiffTables.insert(snpDiffTables.end(), table.begin(), table.end());
+			} else {
+				offset = tableIt->second;
+			}
+			if (metricIdx) {
+				snpDiffNNTableOffsets[a] = offset;
+			} else {
+				snpDiffTableOffsets[a] = offset;
+			}
+		}
+	}
+	cout << Timestamp() << "Compiled " << (snpDiffTables.size() / DIFF_TABLE_SIZE)
+			<< " SNP diff tables for " << numAttributes << " attributes" << endl;
 
 	return true;
 }
@@ -2944,6 +3243,81 @@ vector<string> Dataset::GetDistanceMetrics() {
 	return metrics;
 }
 
+void Dataset::SetDistancePrecision(DistancePrecision newPrecision) {
+	distancePrecision = newPrecision;
+	if (distancePrecision == FLOAT_PRECISION) {
+		cout << Timestamp() << "Distance precision: float" << endl;
+	} else {
+		cout << Timestamp() << "Distance precision: double" << endl;
+	}
+}
+
+DistancePrecision Dataset::GetDistancePrecision() {
+	return distancePrecision;
+}
+
+/// FNV-1a 64-bit offset basis and prime
+static const uint64_t FINGERPRINT_OFFSET = 14695981039346656037ULL;
+static const uint64_t FINGERPRINT_PRIME = 1099511628211ULL;
+
+/// hash bytes into an FNV-1a fingerprint
+static void FingerprintBytes(uint64_t& fingerprint, const void* bytes,
+		size_t numBytes) {
+	const unsigned char* byte = (const unsigned char*) bytes;
+	for (size_t i = 0; i < numBytes; ++i) {
+		fingerprint = (fingerprint ^ byte[i]) * FINGERPRINT_PRIME;
+	}
+}
+
+/// hash a string and its length into an FNV-1a fingerprint
+static void FingerprintString(uint64_t& fingerprint, const string& value) {
+	uint32_t length = value.size();
+	FingerprintBytes(fingerprint, &length, sizeof(length));
+	FingerprintBytes(fingerprint, value.data(), value.size());
+}
+
+uint64_t Dataset::MaskNeighborFingerprint() {
+	uint64_t fingerprint = FINGERPRINT_OFFSET;
+	FingerprintString(fingerprint, snpMetricNN);
+	FingerprintString(fingerprint, numMetric);
+	uint32_t precision = distancePrecision;
+	FingerprintBytes(fingerprint, &precision, sizeof(precision));
+	uint32_t numInstances = instances.size();
+	FingerprintBytes(fingerprint, &numInstances, sizeof(numInstances));
+
+	vector<unsigned int> attributeIndices;
+	map<string, unsigned int>::const_iterator it = attributesMask.begin();
+	for (; it != attributesMask.end(); ++it) {
+		FingerprintString(fingerprint, it->first);
+		attributeIndices.push_back(it->second);
+	}
+	vector<unsigned int> numericIndices;
+	for (it = numericsMask.begin(); it != numericsMask.end(); ++it) {
+		FingerprintString(fingerprint, it->first);
+		numericIndices.push_back(it->second);
+	}
+
+	bool hasClasses = !HasContinuousPhenotypes();
+	for (it = instancesMask.begin(); it != instancesMask.end(); ++it) {
+		FingerprintString(fingerprint, it->first);
+		DatasetInstance* dsi = instances[it->second];
+		if (hasClasses) {
+			ClassLevel classLevel = dsi->GetClass();
+			FingerprintBytes(fingerprint, &classLevel, sizeof(classLevel));
+		}
+		for (unsigned int a = 0; a < attributeIndices.size(); ++a) {
+			AttributeLevel level = dsi->attributes[attributeIndices[a]];
+			FingerprintBytes(fingerprint, &level, sizeof(level));
+		}
+		for (unsigned int n = 0; n < numericIndices.size(); ++n) {
+			NumericLevel level = dsi->numerics[numericIndices[n]];
+			FingerprintBytes(fingerprint, &level, sizeof(level));
+		}
+	}
+
+	return fingerprint;
+}
+
 pair<unsigned int, unsigned int> Dataset::GetAttributeTiTvCounts() {
 	vector<unsigned int> attrIndices = MaskGetAttributeIndices(DISCRETE_TYPE);
 	unsigned int tiCount = 0, tvCount = 0;
@@ -3035,16 +3409,41 @@ bool Dataset::ResetNearestNeighbors() {
 //	cout << Timestamp() 
 //					<< "INFO: Dataset is clearing instance nearest neighbor
 //         	<< "information" << endl;
-	map<string, unsigned int>::const_iterator it = instancesMask.begin();
-	for (; it != instancesMask.end(); ++it) {
-		instances[it->second]->ResetNearestNeighbors();
-	}	
-	
+	neighborTable.Clear();
+
 	return true;
 }
 
+void Dataset::AllocateNeighborTable(unsigned int k) {
+	vector<ClassLevel> classLevels;
+	GetNeighborTableClasses(classLevels);
+	neighborTable.Allocate(instances.size(), classLevels, k);
+}
+
+void Dataset::AllocateNeighborTable(const vector<unsigned int>& capacities) {
+	vector<ClassLevel> classLevels;
+	GetNeighborTableClasses(classLevels);
+	neighborTable.Allocate(instances.size(), classLevels, capacities);
+}
+
+void Dataset::GetNeighborTableClasses(vector<ClassLevel>& classLevels) {
+	classLevels.clear();
+	if (!HasContinuousPhenotypes()) {
+		set<ClassLevel> maskClasses;
+		map<string, unsigned int>::const_iterator it = instancesMask.begin();
+		for (; it != instancesMask.end(); ++it) {
+			maskClasses.insert(instances[it->second]->GetClass());
+		}
+		classLevels.assign(maskClasses.begin(), maskClasses.end());
+	}
+}
+
+NeighborTable& Dataset::GetNeighborTable() {
+	return neighborTable;
+}
+
 
-bool Dataset::CalculateDistanceMatrix(double** distanceMatrix,
+bool Dataset::CalculateDistanceMatrix(DistanceMatrix& distanceMatrix,
 		string matrixFilename) {
 	cout << Timestamp() << "Calculating distance matrix" << endl;
 	map<string, unsigned int> instanceMask = MaskGetInstanceMask();
@@ -3055,26 +3454,8 @@ bool Dataset::CalculateDistanceMatrix(double** distanceMatrix,
 	// NOTE: make complete symmetric matrix for neighbor-to-neighbor sums
 	cout << Timestamp() << "Computing instance-to-instance distances with " 
 		<< snpMetricNN << "... " << endl;
-	//  omp_set_nested(1);
-#pragma omp parallel for schedule(dynamic, 1)
-	for (int i = 0; i < numInstances; ++i) {
-		// cout << "Computing instance to instance distances. Row: " << i << endl;
-		// #pragma omp parallel for
-		for (int j = i + 1; j < numInstances; ++j) {
-			unsigned int dsi1Index = 0;
-			GetInstanceIndexForID(instanceIds[i], dsi1Index);
-			unsigned int dsi2Index = 0;
-			GetInstanceIndexForID(instanceIds[j], dsi2Index);
-			distanceMatrix[i][j] = distanceMatrix[j][i] =
-					ComputeInstanceToInstanceDistance(GetInstance(dsi1Index),
-							GetInstance(dsi2Index));
-			// cout << i << ", " << j << " => " << distanceMatrix[i][j] << endl;
-		}
-		distanceMatrix[i][i] = 0.0;
-
-		if (i && (i % 100 == 0)) {
-			cout << Timestamp() << i << "/" << numInstances << endl;
-		}
+	if (!ComputeDistanceMatrix(distanceMatrix)) {
+		return false;
 	}
 	cout << Timestamp() << numInstances << "/" << numInstances << " done"
 			<< endl;
@@ -3094,12 +3475,14 @@ bool Dataset::CalculateDistanceMatrix(double** distanceMatrix,
 		}
 		outFile << endl;
 		/// write all n-by-n matrix entries
+		vector<double> row;
 		for (int i = 0; i < numInstances; ++i) {
+			distanceMatrix.GetRow(i, row);
 			for (int j = 0; j < numInstances; ++j) {
 				if (j)
-					outFile << "\t" << distanceMatrix[i][j];
+					outFile << "\t" << row[j];
 				else
-					outFile << distanceMatrix[i][j];
+					outFile << row[j];
 			}
 			outFile << endl;
 		}
@@ -3126,28 +3509,420 @@ bool Dataset::CalculateDistanceMatrix(double** distanceMatrix,
 	return true;
 }
 
-bool Dataset::CalculateDistanceMatrix(vector<vector<double> >& distanceMatrix) {
-	map<string, unsigned int> instanceMask = MaskGetInstanceMask();
-	vector<string> instanceIds = MaskGetInstanceIds();
-	int numInstances = instanceIds.size();
+/**
+ * \struct TileRowSums.
+ * Per instance: the sums of its distances to each block of tile instances.
+ * Only the tile of the instance's block and the other block adds to a sum,
+ * so the row sums add up in the same order with any number of threads.
+ */
+struct TileRowSums
+{
+	/// number of instances
+	unsigned int numInstances;
+	/// [block][instance] sum of the distances
+	vector<double> sums;
+	/// [block][instance] sum of the squared distances
+	vector<double> squareSums;
+};
+
+/// allocate zero sums for the instances of a distance matrix
+static void AllocateTileRowSums(TileRowSums& tileRowSums,
+		unsigned int numInstances) {
+	unsigned int numBlocks = (numInstances + DISTANCE_TILE_INSTANCES - 1)
+			/ DISTANCE_TILE_INSTANCES;
+	tileRowSums.numInstances = numInstances;
+	tileRowSums.sums.assign((size_t) numBlocks * numInstances, 0.0);
+	tileRowSums.squareSums.assign((size_t) numBlocks * numInstances, 0.0);
+}
 
-#pragma omp parallel for schedule(dynamic, 1)
-	for (int i = 0; i < numInstances; ++i) {
-		for (int j = i + 1; j < numInstances; ++j) {
-			unsigned int dsi1Index = 0;
-			GetInstanceIndexForID(instanceIds[i], dsi1Index);
-			unsigned int dsi2Index = 0;
-			GetInstanceIndexForID(instanceIds[j], dsi2Index);
-			distanceMatrix[i][j] = distanceMatrix[j][i] =
-					ComputeInstanceToInstanceDistance(GetInstance(dsi1Index),
-							GetInstance(dsi2Index));
+/// add the distance of tile pair i, j to the sums of rows i and j
+static void AddTileRowSums(TileRowSums& tileRowSums, const DistanceTile& tile,
+		unsigned int i, unsigned int j, double distance) {
+	size_t rowSum = (size_t) (tile.colBegin / DISTANCE_TILE_INSTANCES)
+			* tileRowSums.numInstances + i;
+	size_t colSum = (size_t) (tile.rowBegin / DISTANCE_TILE_INSTANCES)
+			* tileRowSums.numInstances + j;
+	tileRowSums.sums[rowSum] += distance;
+	tileRowSums.squareSums[rowSum] += distance * distance;
+	tileRowSums.sums[colSum] += distance;
+	tileRowSums.squareSums[colSum] += distance * distance;
+}
+
+/// add up the block sums of each row
+static void AddUpTileRowSums(const TileRowSums& tileRowSums,
+		vector<double>& sums, vector<double>& squareSums) {
+	unsigned int numInstances = tileRowSums.numInstances;
+	sums.assign(numInstances, 0.0);
+	squareSums.assign(numInstances, 0.0);
+	for (size_t block = 0; block * numInstances < tileRowSums.sums.size();
+			++block) {
+		for (unsigned int i = 0; i < numInstances; ++i) {
+			sums[i] += tileRowSums.sums[block * numInstances + i];
+			squareSums[i] += tileRowSums.squareSums[block * numInstances + i];
+		}
+	}
+}
+
+/// add up the block sums of each row and record them with the matrix
+static void SetTileRowSums(const TileRowSums& tileRowSums,
+		DistanceMatrix& distanceMatrix) {
+	vector<double> sums;
+	vector<double> squareSums;
+	AddUpTileRowSums(tileRowSums, sums, squareSums);
+	distanceMatrix.SetRowSums(sums, squareSums);
+}
+
+bool Dataset::ComputeDistanceMatrix(DistanceMatrix& distanceMatrix,
+		bool rowSums) {
+	PrepareInstanceDistances();
+	if (!distanceMatrix.Allocate(distanceInstanceIndices.size(),
+			distancePrecision)) {
+		return false;
+	}
+	double snpScale = 1.0;
+	if (packedGenotypes.IsPacked()) {
+		snpScale = packedGenotypes.IntegerDistanceScale();
+	}
+
+	// balanced, contiguous ranges of tiles of the upper triangle per thread
+	int numParts = omp_get_max_threads();
+	vector<DistanceTile> tiles;
+	vector<unsigned int> partStarts;
+	distanceMatrix.PartitionTiles(DISTANCE_TILE_INSTANCES, numParts, tiles,
+			partStarts);
+	TileRowSums tileRowSums;
+	if (rowSums) {
+		AllocateTileRowSums(tileRowSums, distanceMatrix.NumInstances());
+	}
+#pragma omp parallel
+	{
+		vector<double> snpSums(DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+		vector<double> numericSums(
+				DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+		for (int part = omp_get_thread_num(); part < numParts;
+				part += omp_get_num_threads()) {
+			for (unsigned int tileIdx = partStarts[part];
+					tileIdx < partStarts[part + 1]; ++tileIdx) {
+				const DistanceTile& tile = tiles[tileIdx];
+				(this->*distanceTileKernel)(tile, packedGenotypes, packedNumerics,
+						distanceAttributeIndices, distanceNumericIndices, &snpSums[0],
+						&numericSums[0]);
+				unsigned int numCols = tile.colEnd - tile.colBegin;
+				for (unsigned int i = tile.rowBegin; i < tile.rowEnd; ++i) {
+					unsigned int r = i - tile.rowBegin;
+					for (unsigned int j = max(i + 1, tile.colBegin); j < tile.colEnd;
+							++j) {
+						unsigned int c = j - tile.colBegin;
+						double distance = snpSums[r * numCols + c] / snpScale
+								+ numericSums[r * numCols + c];
+						distanceMatrix.Set(i, j, distance);
+						if (rowSums) {
+							AddTileRowSums(tileRowSums, tile, i, j,
+									distanceMatrix.Get(i, j));
+						}
+					}
+				}
+			}
 		}
-		distanceMatrix[i][i] = 0.0;
 	}
+	if (rowSums) {
+		SetTileRowSums(tileRowSums, distanceMatrix);
+	}
+
+	DistanceMatrixSource source;
+	source.instanceIndices = distanceInstanceIndices;
+	source.attributeIndices = distanceAttributeIndices;
+	source.numericIndices = distanceNumericIndices;
+	source.metrics = GetDistanceMetrics();
+	source.integerScale = 0.0;
+	// floats hold the integer sums exactly enough to recover them below 2^22
+	bool exactSums = (distancePrecision == DOUBLE_PRECISION)
+			|| (distanceAttributeIndices.size() * snpScale < FLOAT_EXACT_INTEGER_SUM);
+	if (packedGenotypes.IsPacked() && distanceNumericIndices.empty()
+			&& exactSums) {
+		source.integerScale = snpScale;
+	}
+	distanceMatrix.SetSource(source);
 
 	return true;
 }
 
+bool Dataset::UpdateDistanceMatrix(DistanceMatrix& distanceMatrix,
+		vector<double>& rowChanges, bool rowSums) {
+	rowChanges.clear();
+	DistanceMatrixSource source = distanceMatrix.GetSource();
+	PrepareInstanceDistances();
+
+	// the distances must be sums of attribute diffs over the same instances
+	bool canDowndate = distanceMatrix.NumInstances()
+			&& (source.instanceIndices == distanceInstanceIndices)
+			&& (source.metrics == GetDistanceMetrics()) && !snpInstanceMetric
+			&& (distanceMatrix.Precision() == distancePrecision);
+	// attributes removed since the distances were computed
+	vector<unsigned int> removedAttributes;
+	vector<unsigned int> removedNumerics;
+	if (canDowndate) {
+		canDowndate = GetRemovedIndices(source.attributeIndices,
+				distanceAttributeIndices, removedAttributes)
+				&& GetRemovedIndices(source.numericIndices, distanceNumericIndices,
+						removedNumerics);
+	}
+	unsigned int numRemoved = removedAttributes.size() + removedNumerics.size();
+	unsigned int numRemaining = distanceAttributeIndices.size()
+			+ distanceNumericIndices.size();
+	if (!canDowndate || (numRemoved >= numRemaining)
+			|| (rowSums && !numRemoved && !distanceMatrix.HasRowSums())) {
+		return ComputeDistanceMatrix(distanceMatrix, rowSums);
+	}
+
+	unsigned int numInstances = distanceMatrix.NumInstances();
+	rowChanges.resize(numInstances, 0.0);
+	if (!numRemoved) {
+		return true;
+	}
+	cout << Timestamp() << "Removing the distances of " << numRemoved
+			<< " attributes from the distance matrix" << endl;
+
+	PackedGenotypes removedGenotypes;
+	double snpScale = 1.0;
+	if (packedGenotypes.IsPacked()) {
+		if (!removedGenotypes.Pack(this, distanceInstanceIndices,
+				removedAttributes, PackedGenotypes::MetricFromName(snpMetricNN))) {
+			return ComputeDistanceMatrix(distanceMatrix, rowSums);
+		}
+		snpScale = removedGenotypes.IntegerDistanceScale();
+	}
+	PackedNumerics removedNumericValues;
+	if (packedNumerics.IsPacked() && removedNumerics.size()) {
+		removedNumericValues.Pack(this, distanceInstanceIndices, removedNumerics,
+				numMetricType, distancePrecision);
+	}
+	bool integerDistances = (source.integerScale == snpScale)
+			&& removedGenotypes.IsPacked();
+
+	int numParts = omp_get_max_threads();
+	vector<DistanceTile> tiles;
+	vector<unsigned int> partStarts;
+	distanceMatrix.PartitionTiles(DISTANCE_TILE_INSTANCES, numParts, tiles,
+			partStarts);
+	vector<vector<double> > partRowChanges(numParts);
+	TileRowSums tileRowSums;
+	if (rowSums) {
+		AllocateTileRowSums(tileRowSums, numInstances);
+	}
+#pragma omp parallel
+	{
+		vector<double> snpSums(DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+		vector<double> numericSums(
+				DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+		for (int part = omp_get_thread_num(); part < numParts;
+				part += omp_get_num_threads()) {
+			vector<double>& changes = partRowChanges[part];
+			changes.resize(numInstances, 0.0);
+			for (unsigned int tileIdx = partStarts[part];
+					tileIdx < partStarts[part + 1]; ++tileIdx) {
+				const DistanceTile& tile = tiles[tileIdx];
+				(this->*distanceTileKernel)(tile, removedGenotypes,
+						removedNumericValues, removedAttributes, removedNumerics, &snpSums[0], &numericSums[0]);
+				unsigned int numCols = tile.colEnd - tile.colBegin;
+				for (unsigned int i = tile.rowBegin; i < tile.rowEnd; ++i) {
+					unsigned int r = i - tile.rowBegin;
+					for (unsigned int j = max(i + 1, tile.colBegin); j < tile.colEnd;
+							++j) {
+						unsigned int c = j - tile.colBegin;
+						double oldDistance = distanceMatrix.Get(i, j);
+						double newDistance = 0.0;
+						if (integerDistances) {
+							// exact: recover the integer sum and subtract the removed part
+							newDistance = (floor(oldDistance * snpScale + 0.5)
+									- snpSums[r * numCols + c]) / snpScale;
+						} else {
+							newDistance = oldDistance - snpSums[r * numCols + c] / snpScale
+									- numericSums[r * numCols + c];
+							if (newDistance < 0.0) {
+								newDistance = 0.0;
+							}
+						}
+						distanceMatrix.Set(i, j, newDistance);
+						if (rowSums) {
+							AddTileRowSums(tileRowSums, tile, i, j,
+									distanceMatrix.Get(i, j));
+						}
+						double change = fabs(oldDistance - newDistance);
+						changes[i] = max(changes[i], change);
+						changes[j] = max(changes[j], change);
+					}
+				}
+			}
+		}
+	}
+	for (int part = 0; part < numParts; ++part) {
+		for (unsigned int i = 0; i < partRowChanges[part].size(); ++i) {
+			rowChanges[i] = max(rowChanges[i], partRowChanges[part][i]);
+		}
+	}
+	if (rowSums) {
+		SetTileRowSums(tileRowSums, distanceMatrix);
+	} else {
+		distanceMatrix.SetRowSums(vector<double>(), vector<double>());
+	}
+
+	source.attributeIndices = distanceAttributeIndices;
+	source.numericIndices = distanceNumericIndices;
+	if (!integerDistances) {
+		source.integerScale = 0.0;
+	}
+	distanceMatrix.SetSource(source);
+
+	return true;
+}
+
+bool Dataset::ComputeDistanceRowBlock(unsigned int rowBegin,
+		unsigned int rowEnd, vector<double>& distances) {
+	unsigned int numInstances = distanceInstanceIndices.size();
+	if ((rowBegin > rowEnd) || (rowEnd > numInstances)) {
+		cerr << "ERROR: ComputeDistanceRowBlock: rows [" << rowBegin << ", "
+				<< rowEnd << ") out of range" << endl;
+		return false;
+	}
+	unsigned int numCols = numInstances - rowBegin;
+	distances.assign((size_t) (rowEnd - rowBegin) * numCols, 0.0);
+	double snpScale = 1.0;
+	if (packedGenotypes.IsPacked()) {
+		snpScale = packedGenotypes.IntegerDistanceScale();
+	}
+
+	// the upper triangle tiles of the row block
+	vector<DistanceTile> tiles;
+	for (unsigned int tileRow = rowBegin; tileRow < rowEnd;
+			tileRow += DISTANCE_TILE_INSTANCES) {
+		for (unsigned int tileCol = tileRow; tileCol < numInstances;
+				tileCol += DISTANCE_TILE_INSTANCES) {
+			DistanceTile tile;
+			tile.rowBegin = tileRow;
+			tile.rowEnd = min(tileRow + DISTANCE_TILE_INSTANCES, rowEnd);
+			tile.colBegin = tileCol;
+			tile.colEnd = min(tileCol + DISTANCE_TILE_INSTANCES, numInstances);
+			tiles.push_back(tile);
+		}
+	}
+#pragma omp parallel
+	{
+		vector<double> snpSums(DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+		vector<double> numericSums(
+				DISTANCE_TILE_INSTANCES * DISTANCE_TILE_INSTANCES);
+#pragma omp for schedule(dynamic)
+		for (int tileIdx = 0; tileIdx < (int) tiles.size(); ++tileIdx) {
+			const DistanceTile& tile = tiles[tileIdx];
+			(this->*distanceTileKernel)(tile, packedGenotypes, packedNumerics,
+					distanceAttributeIndices, distanceNumericIndices, &snpSums[0],
+					&numericSums[0]);
+			unsigned int tileCols = tile.colEnd - tile.colBegin;
+			for (unsigned int i = tile.rowBegin; i < tile.rowEnd; ++i) {
+				unsigned int r = i - tile.rowBegin;
+				for (unsigned int j = max(i + 1, tile.colBegin); j < tile.colEnd;
+						++j) {
+					unsigned int c = j - tile.colBegin;
+					double distance = snpSums[r * tileCols + c] / snpScale
+							+ numericSums[r * tileCols + c];
+					if (distancePrecision == FLOAT_PRECISION) {
+						// as stored in a float distance matrix
+						distance = (float) distance;
+					}
+					distances[(size_t) (i - rowBegin) * numCols + (j - rowBegin)] =
+							distance;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+bool Dataset::ComputeDistanceRowSums(vector<double>& sums,
+		vector<double>& squareSums) {
+	unsigned int numInstances = distanceInstanceIndices.size();
+	TileRowSums tileRowSums;
+	AllocateTileRowSums(tileRowSums, numInstances);
+	// row blocks of whole tiles: every sum adds up in ComputeDistanceMatrix's
+	// order, so the sums are the same as the distance matrix's
+	vector<double> distances;
+	for (unsigned int rowBegin = 0; rowBegin < numInstances;
+			rowBegin += DISTANCE_TILE_INSTANCES) {
+		unsigned int rowEnd = min(rowBegin + DISTANCE_TILE_INSTANCES,
+				numInstances);
+		if (!ComputeDistanceRowBlock(rowBegin, rowEnd, distances)) {
+			return false;
+		}
+		unsigned int numCols = numInstances - rowBegin;
+		DistanceTile tile;
+		tile.rowBegin = rowBegin;
+		tile.rowEnd = rowEnd;
+		for (unsigned int i = rowBegin; i < rowEnd; ++i) {
+			for (unsigned int j = i + 1; j < numInstances; ++j) {
+				tile.colBegin = j - j % DISTANCE_TILE_INSTANCES;
+				AddTileRowSums(tileRowSums, tile, i, j,
+						distances[(size_t) (i - rowBegin) * numCols + (j - rowBegin)]);
+			}
+		}
+	}
+	AddUpTileRowSums(tileRowSums, sums, squareSums);
+
+	return true;
+}
+
+/// positions of the k nearest neighbors of row i, ties broken by position
+static vector<unsigned int> NearestNeighborSet(
+		const DistanceMatrix& distanceMatrix, unsigned int i, unsigned int k) {
+	vector<double> row;
+	distanceMatrix.GetRow(i, row);
+	vector<pair<double, unsigned int> > neighbors;
+	for (unsigned int j = 0; j < row.size(); ++j) {
+		if (j != i) {
+			neighbors.push_back(make_pair(row[j], j));
+		}
+	}
+	unsigned int numNeighbors = min((size_t) k, neighbors.size());
+	partial_sort(neighbors.begin(), neighbors.begin() + numNeighbors,
+			neighbors.end());
+	vector<unsigned int> neighborSet;
+	for (unsigned int n = 0; n < numNeighbors; ++n) {
+		neighborSet.push_back(neighbors[n].second);
+	}
+	sort(neighborSet.begin(), neighborSet.end());
+
+	return neighborSet;
+}
+
+unsigned int Dataset::CountPrecisionNeighborDifferences(unsigned int k) {
+	DistancePrecision savedPrecision = distancePrecision;
+	DistanceMatrix doubleMatrix;
+	DistanceMatrix floatMatrix;
+	distancePrecision = DOUBLE_PRECISION;
+	bool computed = ComputeDistanceMatrix(doubleMatrix);
+	distancePrecision = FLOAT_PRECISION;
+	computed = computed && ComputeDistanceMatrix(floatMatrix);
+	distancePrecision = savedPrecision;
+	PrepareInstanceDistances();
+	if (!computed) {
+		cerr << "ERROR: Could not compute the distance matrices to compare"
+				<< endl;
+		return 0;
+	}
+
+	int numInstances = doubleMatrix.NumInstances();
+	unsigned int numDiffering = 0;
+#pragma omp parallel for reduction(+:numDiffering)
+	for (int i = 0; i < numInstances; ++i) {
+		if (NearestNeighborSet(doubleMatrix, i, k)
+				!= NearestNeighborSet(floatMatrix, i, k)) {
+			++numDiffering;
+		}
+	}
+
+	return numDiffering;
+}
+
 /// ------------ Beginning of private methods ------------------
 
 bool Dataset::LoadSnps(std::string filename) {
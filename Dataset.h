@@ -24,12 +24,18 @@
 #include <set>
 #include <algorithm>
 #include <climits>
+#include <stdint.h>
 
 #include "DatasetInstance.h"
 #include "Insilico.h"
+#include "PackedGenotypes.h"
+#include "PackedNumerics.h"
+#include "DistanceMatrix.h"
+#include "MetricKernels.h"
+#include "NeighborTable.h"
 
-// GSL random number generator base class
-#include "GSLRandomFlat.h"
+// counter-based random number generator for reproducible sampling
+#include "PhiloxRandom.h"
 
 class DgeData;
 class BirdseedData;
@@ -156,12 +162,56 @@ public:
    ****************************************************************************/
   virtual DatasetInstance* GetInstance(unsigned int index);
   /*************************************************************************//**
-   * Returns a pointer to a randomly chosen data set instance.
-   * The random number generator is set to give values in range
-   * of instance indexes.
-   * \return pointer to a data set instance
+   * Seed the random number generator; the same seed reproduces all random
+   * sampling, whatever the number of threads.
+   * \param [in] newSeed random number generator seed
    ****************************************************************************/
-  virtual DatasetInstance* GetRandomInstance();
+  void SetRandomSeed(uint64_t newSeed);
+  /*************************************************************************//**
+   * Get the random number generator seed.
+   * \return seed
+   ****************************************************************************/
+  uint64_t GetRandomSeed();
+  /*************************************************************************//**
+   * Get the position of the data set's random number stream, to restore
+   * with SetRandomPosition so draws in between do not change later ones.
+   * \return number of 32-bit values drawn so far
+   ****************************************************************************/
+  uint64_t GetRandomPosition();
+  /*************************************************************************//**
+   * Move the data set's random number stream to a position.
+   * \param [in] position number of 32-bit values drawn before the next one
+   ****************************************************************************/
+  void SetRandomPosition(uint64_t position);
+  /*************************************************************************//**
+   * Get an independent random number stream of the data set seed, for a
+   * thread, permutation or bootstrap replicate. Stream 0 is the one the
+   * data set's own sampling methods draw from.
+   * \param [in] streamNumber stream number
+   * \return random number generator at the start of the stream
+   ****************************************************************************/
+  PhiloxRandom GetRandomStream(uint64_t streamNumber);
+  /*************************************************************************//**
+   * Randomly sample instances without replacement from the current instance
+   * mask. Asking for all masked instances returns a random permutation.
+   * \param [in] numSamples number of instances, at most NumInstances()
+   * \param [out] instanceIndices sampled instance indices, in draw order
+   * \return true on success
+   ****************************************************************************/
+  bool SampleInstanceIndices(unsigned int numSamples,
+                             std::vector<unsigned int>& instanceIndices);
+  /*************************************************************************//**
+   * Randomly sample instances without replacement from the current instance
+   * mask, stratified by class so each class keeps its share of the sample.
+   * Class sample sizes are proportional to the class sizes, the remaining
+   * samples going to the classes with the largest fractional shares.
+   * \param [in] numSamples number of instances, at most NumInstances()
+   * \param [out] instanceIndices sampled instance indices, class by class
+   * \return true on success
+   ****************************************************************************/
+  bool SampleInstanceIndicesStratified(unsigned int numSamples,
+                                       std::vector<unsigned int>&
+                                       instanceIndices);
   /*************************************************************************//**
    * Get all instance IDs.
    * \return vector of instance IDs
@@ -549,21 +599,70 @@ public:
   /*************************************************************************//**
    * Calculate the instance-to-instance distance matrix for this data set.
    * Uses OpenMP to calculate matrix entries in parallel threads.
-   * \param [out] distanceMatrix pointer to an allocated m x m matrix,
-   *                         m = number of instances
+   * \param [out] distanceMatrix m x m matrix, m = number of instances
    * \param [in] distanceMatrixFilename filename to write matrix
    * \return success
    ****************************************************************************/
-  bool CalculateDistanceMatrix(double** distanceMatrix,
+  bool CalculateDistanceMatrix(DistanceMatrix& distanceMatrix,
   		std::string matrixFilename="");
   /*************************************************************************//**
-   * Calculate the instance-to-instance distance matrix for this data set.
-   * Uses OpenMP to calculate matrix entries in parallel threads.
-   * \param [out] distanceMatrix vector of vectors of double: m x m matrix,
-   *                         m = number of instances
+   * Compute the distances between all instances of the current instance
+   * mask, in mask order. Threads fill balanced ranges of tiles of the upper
+   * triangle, a block of attributes at a time.
+   * \param [out] distanceMatrix allocated and filled m x m matrix
+   * \param [in] rowSums also record the row sums of the distances, in the
+   *                    same pass
+   * \return success
+   ****************************************************************************/
+  bool ComputeDistanceMatrix(DistanceMatrix& distanceMatrix,
+  		bool rowSums = false);
+  /*************************************************************************//**
+   * Bring a distance matrix computed by ComputeDistanceMatrix up to date with
+   * the current masks. When only attributes have been removed and every
+   * distance is a sum of attribute diffs, ie, any metric but KM and JC, the
+   * removed attributes' diffs are subtracted from each pair, so the cost
+   * scales with the attributes removed. Otherwise, or if more attributes
+   * were removed than remain, the matrix is recomputed.
+   * \param [in,out] distanceMatrix distance matrix
+   * \param [out] rowChanges largest absolute distance change in each row,
+   *                         empty if the matrix was recomputed
+   * \param [in] rowSums also record the row sums of the updated distances
+   * \return success
+   ****************************************************************************/
+  bool UpdateDistanceMatrix(DistanceMatrix& distanceMatrix,
+  		std::vector<double>& rowChanges, bool rowSums = false);
+  /*************************************************************************//**
+   * Compute the distances from a block of rows of the current instance mask
+   * to all later rows, tile by tile in parallel, without a distance matrix.
+   * The distances are the same as ComputeDistanceMatrix's. Call
+   * PrepareInstanceDistances first.
+   * \param [in] rowBegin first row
+   * \param [in] rowEnd one past the last row
+   * \param [out] distances (rowEnd - rowBegin) x (m - rowBegin), row-major:
+   *                       entry (r, c) is the distance between rows
+   *                       rowBegin + r and rowBegin + c, set for c > r
    * \return success
    ****************************************************************************/
-  bool CalculateDistanceMatrix(std::vector<std::vector<double> >& distanceMatrix);
+  bool ComputeDistanceRowBlock(unsigned int rowBegin, unsigned int rowEnd,
+  		std::vector<double>& distances);
+  /*************************************************************************//**
+   * Compute the sums and squared sums of each row's distances, streaming
+   * the distances a block of rows at a time without a distance matrix. The
+   * sums are the same as those recorded with ComputeDistanceMatrix's.
+   * Call PrepareInstanceDistances first.
+   * \param [out] sums sum of the distances of each row
+   * \param [out] squareSums sum of the squared distances of each row
+   * \return success
+   ****************************************************************************/
+  bool ComputeDistanceRowSums(std::vector<double>& sums,
+  		std::vector<double>& squareSums);
+  /*************************************************************************//**
+   * Compute the distance matrix in double and in float precision and count
+   * the instances whose k nearest neighbors differ, ties broken by position.
+   * \param [in] k number of nearest neighbors
+   * \return number of instances with different nearest neighbor sets
+   ****************************************************************************/
+  unsigned int CountPrecisionNeighborDifferences(unsigned int k);
   /*************************************************************************//**
    * Compute the distance between two DatasetInstances.
    * \param [in] dsi1 pointer to DatasetInstance 1
@@ -572,6 +671,23 @@ public:
    ****************************************************************************/
   double ComputeInstanceToInstanceDistance(DatasetInstance* dsi1,
                                            DatasetInstance* dsi2);
+  /*************************************************************************//**
+   * Prepare the current instance and attribute masks for distance
+   * calculations with ComputeMaskedInstanceDistance. Packs the genotypes into
+   * bitplanes when the nearest neighbor SNP metric is gm or am, and the
+   * numerics into rows for the SIMD numeric distance kernels.
+   * Must be called again after any mask changes.
+   * \return success
+   ****************************************************************************/
+  bool PrepareInstanceDistances();
+  /*************************************************************************//**
+   * Compute the distance between two instances of the current instance mask.
+   * \param [in] maskIndex1 position of instance 1 in the instance mask
+   * \param [in] maskIndex2 position of instance 2 in the instance mask
+   * \return distance
+   ****************************************************************************/
+  double ComputeMaskedInstanceDistance(unsigned int maskIndex1,
+                                       unsigned int maskIndex2);
   /*************************************************************************//**
    * Set the the distance metrics used to compute instance-to-instance distances.
    * \param [in] newSnpWeightMetric name of SNP metric for diff
@@ -586,6 +702,30 @@ public:
    * \return pair<snp distance metric name, numeric distance metric name>
    ****************************************************************************/
   std::vector<std::string> GetDistanceMetrics();
+  /*************************************************************************//**
+   * Set the storage precision of distance matrices and packed numerics.
+   * Float precision halves their memory; diffs are still summed as doubles.
+   * \param [in] newPrecision DOUBLE_PRECISION or FLOAT_PRECISION
+   ****************************************************************************/
+  void SetDistancePrecision(DistancePrecision newPrecision);
+  /// Get the storage precision of distance matrices and packed numerics.
+  DistancePrecision GetDistancePrecision();
+  /*************************************************************************//**
+   * Fingerprint the data that nearest neighbor distances depend on: the
+   * number of instances, masked instance IDs and classes, masked attribute
+   * names and values, the nearest neighbor SNP and numeric metrics and the
+   * distance precision.
+   * \return 64-bit FNV-1a hash
+   ****************************************************************************/
+  uint64_t MaskNeighborFingerprint();
+  /*************************************************************************//**
+   * Get the data set state read by the metric policies of MetricKernels.h.
+   * The SNP diff tables compiled by SetDistanceMetrics are included if they
+   * are for the SNP metric passed.
+   * \param [in] snpMetricName name of the SNP metric of the analysis
+   * \return metric context
+   ****************************************************************************/
+  MetricContext GetMetricContext(std::string snpMetricName);
   /*************************************************************************//**
    * Get the the mutation transition and transversion counts..
    * \return pair<number of transitions, number of transversions>
@@ -597,6 +737,22 @@ public:
   bool WriteSnpTiTvInfo(std::string titvFilename);
 	/// Reset instances nearest neighbor information.
 	bool ResetNearestNeighbors();
+  /*************************************************************************//**
+   * Allocate an empty nearest neighbor table with a row per instance and a
+   * slot per class of the masked instances, or a single slot for continuous
+   * phenotypes.
+   * \param [in] k neighbors per slot
+   ****************************************************************************/
+  void AllocateNeighborTable(unsigned int k);
+  /*************************************************************************//**
+   * Allocate an empty nearest neighbor table of variable size slots, with a
+   * row per instance and a slot per class of the masked instances, or a
+   * single slot for continuous phenotypes.
+   * \param [in] capacities [instance][slot] most neighbors of each slot
+   ****************************************************************************/
+  void AllocateNeighborTable(const std::vector<unsigned int>& capacities);
+  /// Return the nearest neighbor table filled by neighbor selection.
+  NeighborTable& GetNeighborTable();
 protected:
   /*************************************************************************//**
    * Load SNPs from file using the data set filename.
@@ -611,6 +767,9 @@ protected:
   void ExcludeMonomorphs();
   /// Create dummy alleles from genotypes for data sets that have no allele info
   void CreateDummyAlleles();
+  /// Get the classes of the masked instances, sorted, or none for
+  /// continuous phenotypes: the nearest neighbor table slots
+  void GetNeighborTableClasses(std::vector<ClassLevel>& classLevels);
   /*************************************************************************//**
    * Update all attribute level counts from one data set instance.
    * Updates levelCountsByClass.
@@ -662,36 +821,86 @@ protected:
    ****************************************************************************/
   bool WriteNewPlinkCovarDataset(std::string baseDatasetFilename);
   /*************************************************************************//**
-   * Compute the discrete difference in an attribute between two instances
-   * for determining nearest neighbors.
-   * \param [in] attributeIndex index into vector of all attributes
-   * \param [in] dsi1 pointer to DatasetInstance 1
-   * \param [in] dsi2 pointer to DatasetInstance 2
-   * \return diff(erence)
-   ****************************************************************************/
-  double (*snpDiff)(unsigned int attributeIndex,
-                    DatasetInstance* dsi1,
-                    DatasetInstance* dsi2);
-  /*************************************************************************//**
-   * Compute the discrete difference in an attribute between two instances.
-   * \param [in] attributeIndex index into vector of all attributes
-   * \param [in] dsi1 pointer to DatasetInstance 1
-   * \param [in] dsi2 pointer to DatasetInstance 2
-   * \return diff(erence)
-   ****************************************************************************/
-  double (*snpDiffNN)(unsigned int attributeIndex,
-                      DatasetInstance* dsi1,
-                      DatasetInstance* dsi2);
-  /*************************************************************************//**
-   * Compute the continuous difference in an attribute between two instances.
-   * \param [in] attributeIndex index into vector of all attributes
+   * Compute the distance between two DatasetInstances over the masked
+   * attributes with the metric policies selected by SetDistanceMetrics.
    * \param [in] dsi1 pointer to DatasetInstance 1
    * \param [in] dsi2 pointer to DatasetInstance 2
-   * \return diff(erence)
+   * \param [in] sumSnpDiffs add the SNP diffs
+   * \param [in] sumNumericDiffs add the numeric diffs
+   * \return distance
    ****************************************************************************/
-  double (*numDiff)(unsigned int attributeIndex,
-                    DatasetInstance* dsi1,
-                    DatasetInstance* dsi2);
+  template<class SnpMetric, class NumericMetric>
+  double ComputeInstanceDistance(DatasetInstance* dsi1, DatasetInstance* dsi2,
+  		bool sumSnpDiffs, bool sumNumericDiffs);
+  /// ComputeInstanceDistance instantiations for SelectMetricKernel
+  struct InstanceDistanceKernels
+  {
+    typedef double (Dataset::*Kernel)(DatasetInstance*, DatasetInstance*,
+    		bool, bool);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &Dataset::ComputeInstanceDistance<SnpMetric, NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Compile the SNP weight and nearest neighbor metric diff tables of all
+   * attributes. Each table holds the diffs between all pairs of genotype
+   * levels 0, 1, 2 and missing; attributes with identical tables share one.
+   * \return false if the tables cannot be used: no genotypes, genotypes
+   *         other than 0, 1, 2 or missing, or no alleles for nca
+   ****************************************************************************/
+  bool CompileSnpDiffTables();
+  /*************************************************************************//**
+   * Get the indices removed from a list of indices.
+   * \param [in] oldIndices original indices
+   * \param [in] newIndices current indices
+   * \param [out] removedIndices indices in oldIndices but not newIndices
+   * \return false if newIndices is not a subset of oldIndices
+   ****************************************************************************/
+  bool GetRemovedIndices(const std::vector<unsigned int>& oldIndices,
+  		const std::vector<unsigned int>& newIndices,
+  		std::vector<unsigned int>& removedIndices);
+  /*************************************************************************//**
+   * Compute the SNP and numeric distance sums of the instance pairs i < j of
+   * one distance matrix tile over lists of attributes.
+   * \param [in] tile rows and columns of the tile
+   * \param [in] tileGenotypes genotypes of attributeIndices, if packed
+   * \param [in] tileNumerics numerics of numericIndices, if packed
+   * \param [in] attributeIndices discrete attribute indices
+   * \param [in] numericIndices numeric attribute indices
+   * \param [out] snpSums tile size squared SNP sums, in integer distance
+   *                     units if tileGenotypes are packed
+   * \param [out] numericSums tile size squared numeric sums
+   ****************************************************************************/
+  template<class SnpMetric, class NumericMetric>
+  void ComputeDistanceTile(const DistanceTile& tile,
+  		PackedGenotypes& tileGenotypes, PackedNumerics& tileNumerics,
+  		const std::vector<unsigned int>& attributeIndices,
+  		const std::vector<unsigned int>& numericIndices, double* snpSums,
+  		double* numericSums);
+  /// ComputeDistanceTile instantiations for SelectMetricKernel
+  struct DistanceTileKernels
+  {
+    typedef void (Dataset::*Kernel)(const DistanceTile&, PackedGenotypes&,
+    		PackedNumerics&, const std::vector<unsigned int>&, const std::vector<unsigned int>&,
+    		double*, double*);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &Dataset::ComputeDistanceTile<SnpMetric, NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Add the diffs of a list of attributes to the sums of the instance pairs
+   * of a distance matrix tile, one attribute block at a time.
+   * \param [in] tile rows and columns of the tile
+   * \param [in] attributeIndices attribute indices
+   * \param [in] metric diff metric policy for the attributes
+   * \param [in,out] sums pair sums, row-major by tile row and column
+   ****************************************************************************/
+  template<class Metric>
+  void AccumulateDistanceTile(const DistanceTile& tile,
+  		const std::vector<unsigned int>& attributeIndices, const Metric& metric,
+  		double* sums);
 
   /// the name of discrete diff(erence) function
   std::string snpMetric;
@@ -699,6 +908,36 @@ protected:
   std::string snpMetricNN;
   /// the name of continuous diff(erence) function
   std::string numMetric;
+  /// nearest neighbor SNP metric type
+  SnpMetricType snpMetricNNType;
+  /// numeric metric type
+  NumericMetricType numMetricType;
+  /// is the SNP distance computed over whole instances, KM or JC?
+  bool snpInstanceMetric;
+  /// storage precision of distance matrices and packed numerics
+  DistancePrecision distancePrecision;
+  /// distance matrix tile kernel for the nearest neighbor metrics
+  DistanceTileKernels::Kernel distanceTileKernel;
+  /// instance-to-instance distance kernel for the nearest neighbor metrics
+  InstanceDistanceKernels::Kernel instanceDistanceKernel;
+  /// distinct SNP diff tables of DIFF_TABLE_SIZE doubles each
+  std::vector<double> snpDiffTables;
+  /// per attribute: offset of its weight metric table in snpDiffTables
+  std::vector<unsigned int> snpDiffTableOffsets;
+  /// per attribute: offset of its nearest neighbor metric table
+  std::vector<unsigned int> snpDiffNNTableOffsets;
+  /// genotypes packed for gm/am nearest neighbor distances
+  PackedGenotypes packedGenotypes;
+  /// numerics packed for the SIMD numeric distance kernels
+  PackedNumerics packedNumerics;
+  /// nearest neighbors of the instances, by instance index
+  NeighborTable neighborTable;
+  /// instance indices of the instance mask when distances were prepared
+  std::vector<unsigned int> distanceInstanceIndices;
+  /// discrete attribute indices of the attribute mask when distances were prepared
+  std::vector<unsigned int> distanceAttributeIndices;
+  /// numeric attribute indices of the attribute mask when distances were prepared
+  std::vector<unsigned int> distanceNumericIndices;
 
   /// file from which the discrete attributes (SNPSs) were read
   std::string snpsFilename;
@@ -783,8 +1022,10 @@ protected:
   std::map<std::string, unsigned int> instancesMaskPushed;
   bool maskIsPushed;
 
-  /// random number generator classes use GNU Scientific Library (GSL)
-  GSLRandomFlat* rng;
+  /// random number generator seed
+  uint64_t randomSeed;
+  /// counter-based random number generator, stream 0 of randomSeed
+  PhiloxRandom rng;
 };
 
 #endif // DATASET_H
@@ -13,22 +13,8 @@
 #include "Dataset.h"
 #include "DatasetInstance.h"
 #include "StringUtils.h"
-#include "BestN.h"
 
 using namespace std;
-using namespace insilico;
-
-/// functor for T comparison
-typedef DistancePair T;
-
-class deref_less_bcw : public std::binary_function<T, T, bool>
-{
-public:
-
-  bool operator()(const T a, const T b) const {
-    return(a.first < b.first);
-  }
-};
 
 DatasetInstance::DatasetInstance(Dataset* ds) {
   dataset = ds;
@@ -169,179 +155,3 @@ bool DatasetInstance::SwapAttributes(unsigned int a1, unsigned int a2) {
 
   return true;
 }
-
-void DatasetInstance::SetDistanceSums(unsigned int kNearestNeighbors,
-                                      DistancePairs& sameClassSums,
-                                      map<ClassLevel, DistancePairs>& diffClassSums) {
-  // added 9/22/11 for iterative Relief-F
-  bestNeighborIdsSameClass.clear();
-  bestNeighborIdsDiffClass.clear();
-
-  // use Nate's best_n.h algorithm
-  // cout << "Same class sums:" << endl;
-  // PrintDistancePairs(sameClassSum);
-  DistancePairs bestInstancesHits;
-  best_n(sameClassSums.begin(), sameClassSums.end(),
-         back_insert_iterator<DistancePairs > (bestInstancesHits),
-         kNearestNeighbors, deref_less_bcw());
-  // cout << "Hits:" << endl;
-  DistancePairsIt hit;
-  for(hit = bestInstancesHits.begin(); hit != bestInstancesHits.end(); ++hit) {
-    DistancePair thisHit = *hit;
-    // cout << thisHit.first << " => " << thisHit.second << endl;
-    bestNeighborIdsSameClass.push_back(thisHit.second);
-  }
-
-  map<ClassLevel, DistancePairs>::const_iterator it = diffClassSums.begin();
-  for(; it != diffClassSums.end(); ++it) {
-    ClassLevel thisClass = it->first;
-    DistancePairs thisDiffSums = it->second;
-    DistancePairs bestInstancesMisses;
-    best_n(thisDiffSums.begin(), thisDiffSums.end(),
-           back_insert_iterator<DistancePairs > (bestInstancesMisses),
-           kNearestNeighbors, deref_less_bcw());
-    DistancePairsIt mit;
-    // cout << "Class " << thisClass << ", Different class sums:" << endl;
-    // PrintDistancePairs(bestInstanceMisses);
-    for(mit = bestInstancesMisses.begin(); mit != bestInstancesMisses.end(); ++mit) {
-      DistancePair thisMiss = *mit;
-      // cout << thisMiss.first << " => " << thisMiss.second << endl;
-      bestNeighborIdsDiffClass[thisClass].push_back(thisMiss.second);
-    }
-  }
-  // cout << "----------------------------------------------------------" << endl;
-}
-
-void DatasetInstance::SetDistanceSums(unsigned int kNearestNeighbors,
-                                      DistancePairs instanceSums) {
-  bestNeighborIds.clear();
-
-  // cout << "Instance sums:" << endl;
-  // PrintDistancePairs(instanceSums);
-
-  // use Nate's best_n.h algorithm to select the nearest neighbors
-  DistancePairs bestInstances;
-  best_n(instanceSums.begin(), instanceSums.end(),
-         back_insert_iterator<DistancePairs > (bestInstances),
-         kNearestNeighbors, deref_less_bcw());
-  sort(bestInstances.begin(), bestInstances.end());
-  // cout << "Best instances:" << endl;
-  // PrintDistancePairs(bestInstances);
-
-  DistancePairsIt it = bestInstances.begin();
-  for(; it != bestInstances.end(); ++it) {
-    //    cout << it->first << " => " << it->second << endl;
-    bestNeighborIds.push_back(it->second);
-  }
-  //  PrintVector(bestNeighborIds, "Best neighbor IDs");
-  //  cout << "----------------------------------------------------------" << endl;
-}
-
-void DatasetInstance::PrintDistancePairs(const DistancePairs& distPairs) {
-  for(DistancePairsIt dpit = distPairs.begin(); dpit != distPairs.end(); ++dpit) {
-    cout << (*dpit).first << "\t" << (*dpit).second << endl;
-  }
-}
-
-bool DatasetInstance::GetNNearestInstances(unsigned int n,
-                                           vector<unsigned int>& sameClassInstances,
-                                           vector<unsigned int>& diffClassInstances) {
-  if((bestNeighborIdsSameClass.size() < n) || (bestNeighborIdsDiffClass.size() < n)) {
-    cerr << endl << "ERROR: GetNNearestInstances: N: [" << n
-            << "] is larger than the number of neighbors: "
-            << "Same: " << bestNeighborIdsSameClass.size()
-            << ", Different: " << bestNeighborIdsDiffClass.size() << endl;
-    return false;
-  }
-
-  sameClassInstances.clear();
-  diffClassInstances.clear();
-  for(unsigned int i = 0; i < n; ++i) {
-    unsigned int sameIdx;
-    dataset->GetInstanceIndexForID(bestNeighborIdsSameClass[i], sameIdx);
-    sameClassInstances.push_back(sameIdx);
-    unsigned int diffIdx;
-    dataset->GetInstanceIndexForID(bestNeighborIdsSameClass[i], diffIdx);
-    sameClassInstances.push_back(diffIdx);
-  }
-
-  return true;
-}
-
-bool
-DatasetInstance::GetNNearestInstances
-(
- unsigned int n,
- vector<unsigned int>& sameClassInstances,
- map<ClassLevel, vector<unsigned int> >& diffClassInstances
- ) {
-
-  if(bestNeighborIdsSameClass.size() < n) {
-    cerr << endl << "ERROR: GetNNearestInstances: N: [" << n
-            << "] is larger than the number of neighbors "
-            << "in same class: [" << bestNeighborIdsSameClass.size()
-            << "]" << endl;
-    return false;
-  }
-
-  sameClassInstances.clear();
-  for(unsigned int i = 0; i < n; ++i) {
-    unsigned int sameIdx;
-    dataset->GetInstanceIndexForID(bestNeighborIdsSameClass[i], sameIdx);
-    //    cout << bestNeighborIdsSameClass[i] << ", " << sameIdx << endl;
-    sameClassInstances.push_back(sameIdx);
-  }
-  //  cout << "------" << endl;
-  // diffClassInstances.clear();
-  map<ClassLevel, std::vector<std::string> >::const_iterator it;
-  for(it = bestNeighborIdsDiffClass.begin();
-      it != bestNeighborIdsDiffClass.end(); ++it) {
-    ClassLevel thisClass = it->first;
-    vector<string> ids = it->second;
-    if(ids.size() < n) {
-      cerr << endl << "ERROR: GetNNearestInstances: N: [" << n
-              << "] is larger than the number of neighbors for class "
-              << thisClass << ": [" << bestNeighborIdsDiffClass.size()
-              << "]" << endl;
-      return false;
-    }
-    for(unsigned int i = 0; i < n; ++i) {
-      unsigned int diffIdx;
-      dataset->GetInstanceIndexForID(ids[i], diffIdx);
-      //      cout << ids[i] << ", " << diffIdx << endl;
-      diffClassInstances[thisClass].push_back(diffIdx);
-    }
-  }
-  return true;
-}
-
-bool DatasetInstance::GetNNearestInstances(unsigned int n,
-                                           vector<unsigned int>& closestInstances) {
-
-  if(bestNeighborIds.size() < n) {
-    cerr << "ERROR: GetNNearestInstances: k: [" << n
-            << "] is larger than the number of neighbors" << endl;
-    return false;
-  }
-
-  //  cout << "Same sums (" << sameSums.size() << ")" << endl;
-  //  copy(neighborSums.begin(), neighborSums.end(), ostream_iterator<double>(cout, "\n"));
-
-  closestInstances.clear();
-  for(unsigned int i = 0; i < n; ++i) {
-    unsigned int instanceIndex;
-    dataset->GetInstanceIndexForID(bestNeighborIds[i], instanceIndex);
-    closestInstances.push_back(instanceIndex);
-  }
-
-  return true;
-}
-
-bool DatasetInstance::ResetNearestNeighbors() {
-	bestNeighborIdsSameClass.clear();
-	bestNeighborIdsDiffClass.clear();
-	bestNeighborIds.clear();
-	
-	return true;
-}
-
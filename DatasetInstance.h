@@ -88,78 +88,15 @@ public:
    * \return bool success
    ****************************************************************************/
   bool SwapAttributes(unsigned int a1, unsigned int a2);
-  /*************************************************************************//**
-   * Set the best kNearestNeighbors from the same and different classes
-   * SIDE_EFFECT: Sorts and loads class the vairables: sameSums snd diffSums
-   *              from the neighbors
-   * \param [in] kNearestNeighbors k nearest nerighbors,
-   * \param [in] sameCLassSums vectors of pairs <instance, sum> of same class
-   * \param [in] diffClassSums vectors of pairs <instance, sum> of other classes
-   * \return nothing
-   ****************************************************************************/
-  void SetDistanceSums(unsigned int kNearestNeighbors,
-                       DistancePairs& sameClassSums,
-                       std::map<ClassLevel,
-                       DistancePairs>& diffClassSums);
-  /*************************************************************************//**
-   * Set the best kNearestNeighbors from all other instances/neighbors.
-   * SIDE_EFFECT: Sorts and loads neighborSums from the instanceSums
-   * \param [in] kNearestNeighbors k nearest neighbors
-   * \param [in] instanceSums vectors of k pairs <instance, sum> for neighbors
-   * \return nothing
-   ****************************************************************************/
-  void SetDistanceSums(unsigned int kNearestNeighbors,
-                       DistancePairs instancesSums);
-  /*************************************************************************//**
-   * Prints passed distance pairs.
-   * \param [in] distPairs distance pairs
-   ****************************************************************************/
-  void PrintDistancePairs(const DistancePairs& distPairs);
-  /*************************************************************************//**
-   * Returns N closest instances using the sameSums and diffSums class variables
-   * \param [in] n n nearest nerighbors
-   * \param [in] sameCLassInstances vector of same class instances indices
-   * \param [in] diffClassInstances vector of different class instance indices
-   * \return success
-   ****************************************************************************/
-  bool GetNNearestInstances(unsigned int n,
-                            std::vector<unsigned int>& sameClassInstances,
-                            std::vector<unsigned int>& diffClassInstances);
-  /*************************************************************************//**
-   * Returns N closest instances using the sameSums and diffSums class variables
-   * \param [in] n n nearest nerighbors
-   * \param [in] sameCLassInstances vector of same class instances indices
-   * \param [in] diffClassInstances vector of different classes instance indices
-   * \return success
-   ****************************************************************************/
-  bool GetNNearestInstances(unsigned int n,
-                            std::vector<unsigned int>& sameClassInstances,
-                            std::map<ClassLevel, std::vector<unsigned int> >& diffClassInstances);
-  /*************************************************************************//**
-   * Returns N closest instances to this instance.
-   * \param [in] n n nearest neighbors
-   * \param [in] closestInstances reference to a vector of instance indices
-   * \return success
-   ****************************************************************************/
-  bool GetNNearestInstances(unsigned int n,
-                            std::vector<unsigned int>& closestInstances);
   /// discrete attributes
   std::vector<AttributeLevel> attributes;
   /// continuous attributes
   std::vector<NumericLevel> numerics;
-	/// Reset neighest neighbor information.
-	bool ResetNearestNeighbors();
 private:
   /// pointer to a Dataset object
   Dataset* dataset;
   /// the class value for this instance
   ClassLevel classLabel;
-  /// vector of instance IDs for the best neighbors in this instance's class
-  std::vector<std::string> bestNeighborIdsSameClass;
-  /// vector of instance IDs for the best neighbors of different class(es)
-  std::map<ClassLevel, std::vector<std::string> > bestNeighborIdsDiffClass;
-  /// best neighbor IDs for continuous class
-  std::vector<std::string> bestNeighborIds;
   /// nearest neighbor weighting factors
   std::vector<double> neighborInfluenceFactorDs;
   /// continuous value for this class
@@ -0,0 +1,215 @@
+/*
+ * DistanceMatrix.cpp
+ *
+ * Packed triangular instance-to-instance distance matrix.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "DistanceMatrix.h"
+
+using namespace std;
+
+/// bytes per cache line; the packed values are aligned to this size
+static const size_t DISTANCE_MATRIX_ALIGNMENT = 64;
+
+DistanceMatrix::DistanceMatrix() {
+  values = 0;
+  floatValues = 0;
+  precision = DOUBLE_PRECISION;
+  numInstances = 0;
+  source.integerScale = 0.0;
+}
+
+DistanceMatrix::~DistanceMatrix() {
+  Clear();
+}
+
+bool DistanceMatrix::Allocate(unsigned int newNumInstances,
+                              DistancePrecision newPrecision) {
+  Clear();
+  precision = newPrecision;
+  if(!newNumInstances) {
+    return true;
+  }
+  size_t valueSize = sizeof(double);
+  if(precision == FLOAT_PRECISION) {
+    valueSize = sizeof(float);
+  }
+  size_t numValues = (size_t) newNumInstances * (newNumInstances - 1) / 2;
+  // at least one value, so a 1 x 1 matrix still has an allocation
+  size_t numBytes = (numValues ? numValues : 1) * valueSize;
+  void* newValues = 0;
+  if(posix_memalign(&newValues, DISTANCE_MATRIX_ALIGNMENT, numBytes)) {
+    cerr << "ERROR: DistanceMatrix::Allocate: could not allocate "
+            << newNumInstances << " x " << newNumInstances
+            << " distance matrix" << endl;
+    return false;
+  }
+  memset(newValues, 0, numBytes);
+  if(precision == FLOAT_PRECISION) {
+    floatValues = (float*) newValues;
+  } else {
+    values = (double*) newValues;
+  }
+  numInstances = newNumInstances;
+  rowStarts.resize(numInstances);
+  size_t rowStart = 0;
+  for(unsigned int i = 0; i < numInstances; ++i) {
+    rowStarts[i] = rowStart;
+    rowStart += numInstances - i - 1;
+  }
+
+  return true;
+}
+
+void DistanceMatrix::Clear() {
+  if(values) {
+    free(values);
+  }
+  if(floatValues) {
+    free(floatValues);
+  }
+  values = 0;
+  floatValues = 0;
+  precision = DOUBLE_PRECISION;
+  numInstances = 0;
+  rowStarts.clear();
+  rowSums.clear();
+  rowSquareSums.clear();
+  source = DistanceMatrixSource();
+  source.integerScale = 0.0;
+}
+
+void DistanceMatrix::SetRowSums(const vector<double>& sums,
+                                const vector<double>& squareSums) {
+  rowSums = sums;
+  rowSquareSums = squareSums;
+}
+
+bool DistanceMatrix::HasRowSums() const {
+  return numInstances && (rowSums.size() == numInstances);
+}
+
+double DistanceMatrix::Mean() const {
+  if((numInstances < 2) || !HasRowSums()) {
+    return 0.0;
+  }
+  // every distance is in two rows
+  double sum = 0.0;
+  for(unsigned int i = 0; i < numInstances; ++i) {
+    sum += rowSums[i];
+  }
+  return sum / ((double) numInstances * (numInstances - 1));
+}
+
+double DistanceMatrix::RowMean(unsigned int i) const {
+  if((numInstances < 2) || !HasRowSums()) {
+    return 0.0;
+  }
+  return rowSums[i] / (numInstances - 1);
+}
+
+double DistanceMatrix::RowStandardDeviation(unsigned int i) const {
+  if((numInstances < 2) || !HasRowSums()) {
+    return 0.0;
+  }
+  double mean = RowMean(i);
+  double variance = rowSquareSums[i] / (numInstances - 1) - mean * mean;
+  return (variance > 0.0) ? sqrt(variance) : 0.0;
+}
+
+void DistanceMatrix::GetRow(unsigned int i, vector<double>& row) const {
+  row.resize(numInstances);
+  if(floatValues) {
+    CopyRow(floatValues, i, &row[0]);
+  } else {
+    CopyRow(values, i, &row[0]);
+  }
+}
+
+template<class Value>
+void DistanceMatrix::CopyRow(const Value* packedValues, unsigned int i,
+                             double* row) const {
+  // column i of the rows before i, then row i itself
+  for(unsigned int j = 0; j < i; ++j) {
+    row[j] = packedValues[rowStarts[j] + (i - j - 1)];
+  }
+  row[i] = 0.0;
+  const Value* rowValues = packedValues + rowStarts[i];
+  for(unsigned int j = i + 1; j < numInstances; ++j) {
+    row[j] = rowValues[j - i - 1];
+  }
+}
+
+void DistanceMatrix::PartitionTiles(unsigned int tileSize,
+                                    unsigned int numParts,
+                                    vector<DistanceTile>& tiles,
+                                    vector<unsigned int>& partStarts) const {
+  tiles.clear();
+  partStarts.clear();
+  if(!tileSize) {
+    tileSize = 1;
+  }
+  if(!numParts) {
+    numParts = 1;
+  }
+
+  // tiles and the number of i < j pairs each one computes
+  vector<double> tileCosts;
+  double totalCost = 0.0;
+  for(unsigned int rowBegin = 0; rowBegin < numInstances;
+      rowBegin += tileSize) {
+    unsigned int rowEnd = rowBegin + tileSize;
+    if(rowEnd > numInstances) {
+      rowEnd = numInstances;
+    }
+    for(unsigned int colBegin = rowBegin; colBegin < numInstances;
+        colBegin += tileSize) {
+      DistanceTile tile;
+      tile.rowBegin = rowBegin;
+      tile.rowEnd = rowEnd;
+      tile.colBegin = colBegin;
+      tile.colEnd = colBegin + tileSize;
+      if(tile.colEnd > numInstances) {
+        tile.colEnd = numInstances;
+      }
+      double numRows = tile.rowEnd - tile.rowBegin;
+      double numCols = tile.colEnd - tile.colBegin;
+      double cost = numRows * numCols;
+      if(tile.colBegin == tile.rowBegin) {
+        // diagonal tile: strictly upper triangle of a square block
+        cost = numRows * (numRows - 1.0) / 2.0;
+      }
+      tiles.push_back(tile);
+      tileCosts.push_back(cost);
+      totalCost += cost;
+    }
+  }
+
+  // assign each tile to the part containing the middle of its work, which
+  // keeps the parts contiguous and within one tile of equal work
+  partStarts.resize(numParts + 1, (unsigned int) tiles.size());
+  partStarts[0] = 0;
+  unsigned int nextPart = 1;
+  double costBefore = 0.0;
+  for(unsigned int tileIdx = 0; tileIdx < tiles.size(); ++tileIdx) {
+    double middle = costBefore + tileCosts[tileIdx] / 2.0;
+    unsigned int part = 0;
+    if(totalCost > 0.0) {
+      part = (unsigned int) (middle * numParts / totalCost);
+    }
+    if(part >= numParts) {
+      part = numParts - 1;
+    }
+    while(nextPart <= part) {
+      partStarts[nextPart] = tileIdx;
+      ++nextPart;
+    }
+    costBefore += tileCosts[tileIdx];
+  }
+}
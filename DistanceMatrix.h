@@ -0,0 +1,170 @@
+/**
+ * \class DistanceMatrix
+ *
+ * \brief Packed triangular instance-to-instance distance matrix.
+ *
+ * Stores the symmetric m x m distances of the masked instances as the
+ * strict upper triangle, m (m - 1) / 2 values in one 64-byte aligned block,
+ * row by row: the distances of row i to rows i + 1 ... m - 1 are contiguous.
+ * GetRow assembles a whole symmetric row. Distances are stored as doubles,
+ * or as floats in FLOAT_PRECISION mode, which halves the memory again. The
+ * upper triangle is split into square tiles of instances which are
+ * partitioned into contiguous, equal-work ranges for the threads that fill
+ * the matrix. The sums and sums of squares of each row's distances can be
+ * kept with the matrix for distance threshold neighborhoods.
+ *
+ * \sa Dataset::ComputeDistanceMatrix
+ */
+
+#ifndef DISTANCEMATRIX_H
+#define	DISTANCEMATRIX_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "Insilico.h"
+
+/**
+ * \struct DistanceTile.
+ * Block of rows by block of columns of the upper triangle of a
+ * distance matrix: [rowBegin, rowEnd) x [colBegin, colEnd), colBegin >= rowBegin.
+ */
+struct DistanceTile
+{
+  unsigned int rowBegin;
+  unsigned int rowEnd;
+  unsigned int colBegin;
+  unsigned int colEnd;
+};
+
+/**
+ * \struct DistanceMatrixSource.
+ * Instances, attributes and metrics a distance matrix was computed over,
+ * used to decide whether it can be updated instead of recomputed.
+ */
+struct DistanceMatrixSource
+{
+  /// instance index of each row, in row order
+  std::vector<unsigned int> instanceIndices;
+  /// discrete attribute indices summed into the distances
+  std::vector<unsigned int> attributeIndices;
+  /// numeric attribute indices summed into the distances
+  std::vector<unsigned int> numericIndices;
+  /// SNP weight, SNP nearest neighbor and numeric metric names
+  std::vector<std::string> metrics;
+  /// distances are exact multiples of 1 / integerScale, or 0 if not
+  double integerScale;
+};
+
+class DistanceMatrix
+{
+public:
+  DistanceMatrix();
+  ~DistanceMatrix();
+  /*************************************************************************//**
+   * Allocate a zero-filled m x m matrix, releasing any previous matrix.
+   * Only the m (m - 1) / 2 distances i < j are stored.
+   * \param [in] newNumInstances m, number of instances
+   * \param [in] newPrecision store the distances as doubles or floats
+   * \return success
+   ****************************************************************************/
+  bool Allocate(unsigned int newNumInstances,
+                DistancePrecision newPrecision = DOUBLE_PRECISION);
+  /// Release the matrix memory.
+  void Clear();
+  /// Return the number of instances (rows and columns).
+  unsigned int NumInstances() const { return numInstances; }
+  /// Return the storage precision of the distances.
+  DistancePrecision Precision() const { return precision; }
+  /// Return the distance between instances i and j, 0 if i = j.
+  double Get(unsigned int i, unsigned int j) const {
+    if(i == j) {
+      return 0.0;
+    }
+    std::size_t index = (i < j) ? Index(i, j) : Index(j, i);
+    if(floatValues) {
+      return floatValues[index];
+    }
+    return values[index];
+  }
+  /// Set the distance between instances i and j, and j and i; i != j.
+  void Set(unsigned int i, unsigned int j, double distance) {
+    std::size_t index = (i < j) ? Index(i, j) : Index(j, i);
+    if(floatValues) {
+      floatValues[index] = (float) distance;
+      return;
+    }
+    values[index] = distance;
+  }
+  /*************************************************************************//**
+   * Get all m distances of instance i, in instance order: a strided walk
+   * down column i of the rows before i, then a contiguous copy of row i.
+   * \param [in] i instance
+   * \param [out] row distances to instances 0 ... m - 1, 0 for i itself
+   ****************************************************************************/
+  void GetRow(unsigned int i, std::vector<double>& row) const;
+  /*************************************************************************//**
+   * Record the sum and sum of squares of each row's distances to the other
+   * rows.
+   * \param [in] sums per row: sum of the distances
+   * \param [in] squareSums per row: sum of the squared distances
+   ****************************************************************************/
+  void SetRowSums(const std::vector<double>& sums,
+                  const std::vector<double>& squareSums);
+  /// Return true if the row sums of the current distances are recorded.
+  bool HasRowSums() const;
+  /// Return the mean of all m (m - 1) / 2 distances.
+  double Mean() const;
+  /// Return the mean distance of row i to the other rows.
+  double RowMean(unsigned int i) const;
+  /// Return the standard deviation of the distances of row i to the others.
+  double RowStandardDeviation(unsigned int i) const;
+  /// Record the instances, attributes and metrics of the distances.
+  void SetSource(const DistanceMatrixSource& newSource) { source = newSource; }
+  /// Return the instances, attributes and metrics of the distances.
+  const DistanceMatrixSource& GetSource() const { return source; }
+  /*************************************************************************//**
+   * Split the upper triangle, including the diagonal, into tiles of
+   * tileSize x tileSize instances, ordered by row block, then column block,
+   * and partition the tiles into contiguous ranges of equal pair counts.
+   * \param [in] tileSize instances per tile side
+   * \param [in] numParts number of ranges, eg, number of threads
+   * \param [out] tiles all tiles of the upper triangle
+   * \param [out] partStarts numParts + 1 offsets into tiles; part p owns
+   *              tiles [partStarts[p], partStarts[p + 1])
+   ****************************************************************************/
+  void PartitionTiles(unsigned int tileSize, unsigned int numParts,
+                      std::vector<DistanceTile>& tiles,
+                      std::vector<unsigned int>& partStarts) const;
+private:
+  /// not copyable
+  DistanceMatrix(const DistanceMatrix&);
+  DistanceMatrix& operator=(const DistanceMatrix&);
+  /// position of the distance i < j in the packed upper triangle
+  std::size_t Index(unsigned int i, unsigned int j) const {
+    return rowStarts[i] + (j - i - 1);
+  }
+  /// copy the distances of instance i from the packed values
+  template<class Value>
+  void CopyRow(const Value* packedValues, unsigned int i,
+               double* row) const;
+  /// aligned packed upper triangle of doubles
+  double* values;
+  /// aligned packed upper triangle of floats, if FLOAT_PRECISION
+  float* floatValues;
+  /// storage precision of the distances
+  DistancePrecision precision;
+  /// number of instances
+  unsigned int numInstances;
+  /// per row i: position of the distance i, i + 1 in the packed values
+  std::vector<std::size_t> rowStarts;
+  /// what the distances were computed over
+  DistanceMatrixSource source;
+  /// per row: sum of the distances to the other rows, if recorded
+  std::vector<double> rowSums;
+  /// per row: sum of the squared distances to the other rows, if recorded
+  std::vector<double> rowSquareSums;
+};
+
+#endif	/* DISTANCEMATRIX_H */
@@ -8,16 +8,48 @@
 #include <cmath>
 #include <iostream>
 #include <map>
+#include <string>
 #include <utility>
-#include <cmath>
 
 #include "Dataset.h"
 #include "DistanceMetrics.h"
 #include "DatasetInstance.h"
 #include "Statistics.h"
+#include "StringUtils.h"
 
 using namespace std;
 
+SnpMetricType SnpMetricTypeFromName(string metricName) {
+  string metric = insilico::to_upper(metricName);
+  if(metric == "GM") {
+    return GM_SNP_METRIC;
+  }
+  if(metric == "AM") {
+    return AM_SNP_METRIC;
+  }
+  if(metric == "NCA") {
+    return NCA_SNP_METRIC;
+  }
+  if(metric == "NCA6") {
+    return NCA6_SNP_METRIC;
+  }
+  if(metric == "KM") {
+    return KM_SNP_METRIC;
+  }
+  return NO_SNP_METRIC;
+}
+
+NumericMetricType NumericMetricTypeFromName(string metricName) {
+  string metric = insilico::to_upper(metricName);
+  if(metric == "MANHATTAN") {
+    return MANHATTAN_NUMERIC_METRIC;
+  }
+  if(metric == "EUCLIDEAN") {
+    return EUCLIDEAN_NUMERIC_METRIC;
+  }
+  return NO_NUMERIC_METRIC;
+}
+
 pair<bool, double> CheckMissing(unsigned int attributeIndex,
                                 DatasetInstance* dsi1,
                                 DatasetInstance* dsi2) {
@@ -135,116 +167,156 @@ double norm(double x, double minX, double maxX) {
 double diffAMM(unsigned int attributeIndex,
                DatasetInstance* dsi1,
                DatasetInstance* dsi2) {
-  double distance = 0.0;
-  pair<bool, double> checkMissing = CheckMissing(attributeIndex, dsi1, dsi2);
-  if(checkMissing.first) {
-    distance = checkMissing.second;
-  } else {
-    distance = (double)
-            abs((int) dsi1->attributes[attributeIndex] -
-                (int) dsi2->attributes[attributeIndex]) * 0.5;
-  }
-  return distance;
+  return diffAMMLevels(dsi1->attributes[attributeIndex],
+                       dsi2->attributes[attributeIndex]);
 }
 
 double diffGMM(unsigned int attributeIndex,
                DatasetInstance* dsi1,
                DatasetInstance* dsi2) {
-  double distance = 0.0;
-  pair<bool, double> checkMissing = CheckMissing(attributeIndex, dsi1, dsi2);
-  if(checkMissing.first) {
-    distance = checkMissing.second;
-  } else {
-    distance = (dsi1->attributes[attributeIndex] !=
-                dsi2->attributes[attributeIndex]) ? 1.0 : 0.0;
-  }
-  return distance;
+  return diffGMMLevels(dsi1->attributes[attributeIndex],
+                       dsi2->attributes[attributeIndex]);
 }
 
 double diffNCA(unsigned int attributeIndex,
                DatasetInstance* dsi1,
                DatasetInstance* dsi2) {
-  double distance = 0.0;
   // TODO: need special missing value checks for NCA metrics
   pair<bool, double> checkMissing = CheckMissing(attributeIndex, dsi1, dsi2);
   if(checkMissing.first) {
-    distance = checkMissing.second;
-  } else {
-  	pair<char, char> alleles =
-  			dsi1->GetDatasetPtr()->GetAttributeAlleles(attributeIndex);
-  	string a1 = " ";
-  	a1[0] = alleles.first;
-  	string a2 = " ";
-  	a2[0] = alleles.second;
-  	map<AttributeLevel, string> genotypeMap;
-  	genotypeMap[0] = a1 + a1;
-  	genotypeMap[1] = a1 + a2;
-  	genotypeMap[2] = a2 + a2;
-  	AttributeLevel attrLevel1 = dsi1->attributes[attributeIndex];
-  	AttributeLevel attrLevel2 = dsi2->attributes[attributeIndex];
-  	string genotype1 = genotypeMap[attrLevel1];
-  	string genotype2 = genotypeMap[attrLevel2];
-  	map<char, unsigned int> nca1;
-  	nca1['A'] = 0; nca1['T'] = 0; nca1['C'] = 0; nca1['G'] = 0;
-  	++nca1[genotype1[0]];
-  	++nca1[genotype1[1]];
-  	map<char, unsigned int> nca2;
-  	nca2['A'] = 0; nca2['T'] = 0; nca2['C'] = 0; nca2['G'] = 0;
-  	++nca2[genotype2[0]];
-  	++nca2[genotype2[1]];
-  	map<char, unsigned int>::const_iterator nca1It = nca1.begin();
-  	map<char, unsigned int>::const_iterator nca2It = nca2.begin();
-  	for(; nca1It != nca1.end(); ++nca1It, ++nca2It) {
-  		double nucleotideCount1 = (double) nca1It->second;
-  		double nucleotideCount2 = (double) nca2It->second;
-  		distance += abs(nucleotideCount1 - nucleotideCount2);
-  	}
+    return checkMissing.second;
   }
-  return distance;
+  return diffNCALevels(
+          dsi1->GetDatasetPtr()->GetAttributeAlleles(attributeIndex),
+          dsi1->attributes[attributeIndex], dsi2->attributes[attributeIndex]);
 }
 
 double diffNCA6(unsigned int attributeIndex,
                 DatasetInstance* dsi1,
                 DatasetInstance* dsi2) {
+  return diffNCA6Levels(
+          dsi1->GetDatasetPtr()->GetAttributeMutationType(attributeIndex),
+          dsi1->attributes[attributeIndex], dsi2->attributes[attributeIndex]);
+}
+
+double diffKM(unsigned int attributeIndex,
+               DatasetInstance* dsi1,
+               DatasetInstance* dsi2) {
+  return diffKMLevels(
+          dsi1->GetDatasetPtr()->GetAttributeMutationType(attributeIndex),
+          dsi1->GetAttribute(attributeIndex), dsi2->GetAttribute(attributeIndex));
+}
+
+double diffAMMLevels(AttributeLevel level1, AttributeLevel level2) {
   double distance = 0.0;
-  pair<bool, double> checkMissing = CheckMissing(attributeIndex, dsi1, dsi2);
-  if(checkMissing.first) {
-    distance = checkMissing.second;
+  if((level1 == MISSING_ATTRIBUTE_VALUE) ||
+     (level2 == MISSING_ATTRIBUTE_VALUE)) {
+    // RELIEF-D, see CheckMissing
+    distance = 2.0 / 3.0;
   } else {
-    distance = (double)
-            abs((int) dsi1->attributes[attributeIndex] -
-                (int) dsi2->attributes[attributeIndex]) * 0.5;
+    distance = (double) abs((int) level1 - (int) level2) * 0.5;
+  }
+  return distance;
+}
+
+double diffGMMLevels(AttributeLevel level1, AttributeLevel level2) {
+  double distance = 0.0;
+  if((level1 == MISSING_ATTRIBUTE_VALUE) ||
+     (level2 == MISSING_ATTRIBUTE_VALUE)) {
+    // RELIEF-D, see CheckMissing
+    distance = 2.0 / 3.0;
+  } else {
+    distance = (level1 != level2) ? 1.0 : 0.0;
+  }
+  return distance;
+}
+
+double diffNCALevels(pair<char, char> alleles, AttributeLevel level1,
+                     AttributeLevel level2) {
+  double distance = 0.0;
+  if((level1 == MISSING_ATTRIBUTE_VALUE) ||
+     (level2 == MISSING_ATTRIBUTE_VALUE)) {
+    // RELIEF-D, see CheckMissing
+    return 2.0 / 3.0;
   }
+  string a1 = " ";
+  a1[0] = alleles.first;
+  string a2 = " ";
+  a2[0] = alleles.second;
+  map<AttributeLevel, string> genotypeMap;
+  genotypeMap[0] = a1 + a1;
+  genotypeMap[1] = a1 + a2;
+  genotypeMap[2] = a2 + a2;
+  string genotype1 = genotypeMap[level1];
+  string genotype2 = genotypeMap[level2];
+  map<char, unsigned int> nca1;
+  nca1['A'] = 0; nca1['T'] = 0; nca1['C'] = 0; nca1['G'] = 0;
+  ++nca1[genotype1[0]];
+  ++nca1[genotype1[1]];
+  map<char, unsigned int> nca2;
+  nca2['A'] = 0; nca2['T'] = 0; nca2['C'] = 0; nca2['G'] = 0;
+  ++nca2[genotype2[0]];
+  ++nca2[genotype2[1]];
+  map<char, unsigned int>::const_iterator nca1It = nca1.begin();
+  map<char, unsigned int>::const_iterator nca2It = nca2.begin();
+  for(; nca1It != nca1.end(); ++nca1It, ++nca2It) {
+    double nucleotideCount1 = (double) nca1It->second;
+    double nucleotideCount2 = (double) nca2It->second;
+    distance += abs(nucleotideCount1 - nucleotideCount2);
+  }
+  return distance;
+}
+
+double diffNCA6Levels(AttributeMutationType mutationType,
+                      AttributeLevel level1, AttributeLevel level2) {
+  double distance = diffAMMLevels(level1, level2);
   // transition/transversion adjustment
-  if(dsi1->GetDatasetPtr()->GetAttributeMutationType(attributeIndex) ==
-      TRANSITION_MUTATION) {
+  if(mutationType == TRANSITION_MUTATION) {
     distance *= 0.5;
   }
   return distance;
 }
 
-double diffKM(unsigned int attributeIndex,
-               DatasetInstance* dsi1,
-               DatasetInstance* dsi2) {
+double diffKMLevels(AttributeMutationType mutationType,
+                    AttributeLevel level1, AttributeLevel level2) {
   double distance = 0.0;
-
-	AttributeLevel dsi1Al =  dsi1->GetAttribute(attributeIndex);
-	AttributeLevel dsi2Al =  dsi2->GetAttribute(attributeIndex);
-	if(dsi1Al != dsi2Al) {
-		if(dsi1->GetDatasetPtr()->GetAttributeMutationType(attributeIndex) ==
-				TRANSITION_MUTATION) {
-			distance = 1.0;
-		} else {
-      if(dsi1->GetDatasetPtr()->GetAttributeMutationType(attributeIndex) ==
-          TRANSVERSION_MUTATION) {
+  if(level1 != level2) {
+    if(mutationType == TRANSITION_MUTATION) {
+      distance = 1.0;
+    } else {
+      if(mutationType == TRANSVERSION_MUTATION) {
         distance = 2.0;
       }
     }
-	}
-
+  }
   return distance;
 }
 
+bool FillDiffTable(string metricName, pair<char, char> alleles,
+                   AttributeMutationType mutationType, double* table) {
+  string metric = insilico::to_upper(metricName);
+  AttributeLevel levels[DIFF_TABLE_LEVELS] = {0, 1, 2, MISSING_ATTRIBUTE_VALUE};
+  for(unsigned int i = 0; i < DIFF_TABLE_LEVELS; ++i) {
+    for(unsigned int j = 0; j < DIFF_TABLE_LEVELS; ++j) {
+      double* diff = &table[DiffTableIndex(levels[i], levels[j])];
+      if(metric == "GM") {
+        *diff = diffGMMLevels(levels[i], levels[j]);
+      } else if(metric == "AM") {
+        *diff = diffAMMLevels(levels[i], levels[j]);
+      } else if(metric == "NCA") {
+        *diff = diffNCALevels(alleles, levels[i], levels[j]);
+      } else if(metric == "NCA6") {
+        *diff = diffNCA6Levels(mutationType, levels[i], levels[j]);
+      } else if(metric == "KM") {
+        *diff = diffKMLevels(mutationType, levels[i], levels[j]);
+      } else {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 double diffManhattan(unsigned int attributeIndex,
                      DatasetInstance* dsi1,
                      DatasetInstance* dsi2) {
@@ -13,9 +13,72 @@
 #ifndef DISTANCEMETRICS_H
 #define	DISTANCEMETRICS_H
 
+#include <climits>
+#include <string>
+#include <utility>
+
+#include "Insilico.h"
+
 /// Forward reference to a DatasetInstance class.
 class DatasetInstance;
 
+/// genotype levels on each side of a diff table: 0, 1, 2 and missing
+const unsigned int DIFF_TABLE_LEVELS = 4;
+/// doubles in one attribute's diff table
+const unsigned int DIFF_TABLE_SIZE = DIFF_TABLE_LEVELS * DIFF_TABLE_LEVELS;
+
+/**
+ * \enum SnpMetricType.
+ * SNP (discrete attribute) diff metrics.
+ */
+enum SnpMetricType
+{
+  GM_SNP_METRIC, /**< genotype mismatch */
+  AM_SNP_METRIC, /**< allele mismatch */
+  NCA_SNP_METRIC, /**< nucleotide count array */
+  NCA6_SNP_METRIC, /**< nucleotide count array + transition/transversion */
+  KM_SNP_METRIC, /**< Kimura transition/transversion */
+  NO_SNP_METRIC /**< unknown metric name */
+};
+
+/**
+ * \enum NumericMetricType.
+ * Numeric (continuous attribute) diff metrics.
+ */
+enum NumericMetricType
+{
+  MANHATTAN_NUMERIC_METRIC, /**< range-normalized absolute difference */
+  EUCLIDEAN_NUMERIC_METRIC, /**< Euclidean */
+  NO_NUMERIC_METRIC /**< unknown metric name */
+};
+
+/***************************************************************************//**
+ * Position of a pair of genotype levels in a diff table.
+ * \param [in] level1 genotype 0, 1, 2 or MISSING_ATTRIBUTE_VALUE
+ * \param [in] level2 genotype 0, 1, 2 or MISSING_ATTRIBUTE_VALUE
+ * \return index into a DIFF_TABLE_SIZE diff table
+ ******************************************************************************/
+inline unsigned int DiffTableIndex(AttributeLevel level1,
+                                   AttributeLevel level2) {
+  unsigned int row = (level1 == MISSING_ATTRIBUTE_VALUE) ?
+    DIFF_TABLE_LEVELS - 1 : (unsigned int) level1;
+  unsigned int col = (level2 == MISSING_ATTRIBUTE_VALUE) ?
+    DIFF_TABLE_LEVELS - 1 : (unsigned int) level2;
+  return row * DIFF_TABLE_LEVELS + col;
+}
+
+/***************************************************************************//**
+ * Return the SNP metric type for a metric name.
+ * \param [in] metricName gm, am, nca, nca6 or km, in any case
+ * \return metric type or NO_SNP_METRIC
+ ******************************************************************************/
+SnpMetricType SnpMetricTypeFromName(std::string metricName);
+/***************************************************************************//**
+ * Return the numeric metric type for a metric name.
+ * \param [in] metricName manhattan or euclidean, in any case
+ * \return metric type or NO_NUMERIC_METRIC
+ ******************************************************************************/
+NumericMetricType NumericMetricTypeFromName(std::string metricName);
 /***************************************************************************//**
  * Check for a missing discrete value and return value.
  * \param [in] attributeIndex index into the vector of attributes
@@ -95,6 +158,58 @@ double diffNCA6(unsigned int attributeIndex,
 double diffKM(unsigned int attributeIndex,
               DatasetInstance* dsi1,
               DatasetInstance* dsi2);
+/***************************************************************************//**
+ * Allele mismatch metric for two genotype levels.
+ * \param [in] level1 genotype of instance 1
+ * \param [in] level2 genotype of instance 2
+ * \return diff(erence), same as diffAMM
+ ****************************************************************************/
+double diffAMMLevels(AttributeLevel level1, AttributeLevel level2);
+/***************************************************************************//**
+ * Genotype mismatch metric for two genotype levels.
+ * \param [in] level1 genotype of instance 1
+ * \param [in] level2 genotype of instance 2
+ * \return diff(erence), same as diffGMM
+ ****************************************************************************/
+double diffGMMLevels(AttributeLevel level1, AttributeLevel level2);
+/***************************************************************************//**
+ * Nucleotide count array (NCA) metric for two genotype levels.
+ * \param [in] alleles the attribute's alleles
+ * \param [in] level1 genotype of instance 1
+ * \param [in] level2 genotype of instance 2
+ * \return diff(erence), same as diffNCA
+ ****************************************************************************/
+double diffNCALevels(std::pair<char, char> alleles, AttributeLevel level1,
+                     AttributeLevel level2);
+/***************************************************************************//**
+ * NCA6 metric for two genotype levels.
+ * \param [in] mutationType the attribute's mutation type
+ * \param [in] level1 genotype of instance 1
+ * \param [in] level2 genotype of instance 2
+ * \return diff(erence), same as diffNCA6
+ ****************************************************************************/
+double diffNCA6Levels(AttributeMutationType mutationType,
+                      AttributeLevel level1, AttributeLevel level2);
+/***************************************************************************//**
+ * Kimura metric for two genotype levels.
+ * \param [in] mutationType the attribute's mutation type
+ * \param [in] level1 genotype of instance 1
+ * \param [in] level2 genotype of instance 2
+ * \return diff(erence), same as diffKM
+ ****************************************************************************/
+double diffKMLevels(AttributeMutationType mutationType,
+                    AttributeLevel level1, AttributeLevel level2);
+/***************************************************************************//**
+ * Fill one attribute's table of SNP metric diffs between all pairs of
+ * genotype levels, indexed by DiffTableIndex.
+ * \param [in] metricName SNP metric: gm, am, nca, nca6 or km
+ * \param [in] alleles the attribute's alleles, used by nca
+ * \param [in] mutationType the attribute's mutation type, used by nca6 and km
+ * \param [out] table DIFF_TABLE_SIZE diffs
+ * \return false if the metric is unknown
+ ****************************************************************************/
+bool FillDiffTable(std::string metricName, std::pair<char, char> alleles,
+                   AttributeMutationType mutationType, double* table);
 /***************************************************************************//**
  * "Manhattan" distance between continuous attributes.
  * \param [in] attributeIndex index into the vector of attributes
@@ -0,0 +1,139 @@
+/*
+ * GenotypeLsh.cpp
+ *
+ * Bit-sampling locality-sensitive hash tables for approximate gm and am
+ * nearest neighbor candidates.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "GenotypeLsh.h"
+#include "PhiloxRandom.h"
+#include "Dataset.h"
+#include "DatasetInstance.h"
+#include "Insilico.h"
+
+using namespace std;
+
+GenotypeLsh::GenotypeLsh() {
+  numInstances = 0;
+  numTables = 0;
+}
+
+GenotypeLsh::~GenotypeLsh() {
+}
+
+bool GenotypeLsh::Build(Dataset* ds,
+                        const vector<unsigned int>& instanceIndices,
+                        const vector<unsigned int>& attributeIndices,
+                        unsigned int newNumTables, unsigned int keySize,
+                        PhiloxRandom& rng) {
+  Clear();
+  if(!newNumTables || !keySize || attributeIndices.empty()) {
+    cerr << "ERROR: GenotypeLsh::Build: no hash tables, key attributes or "
+            << "attributes to hash" << endl;
+    return false;
+  }
+  if(keySize > GENOTYPE_LSH_MAX_KEY_ATTRIBUTES) {
+    cerr << "ERROR: GenotypeLsh::Build: at most "
+            << GENOTYPE_LSH_MAX_KEY_ATTRIBUTES << " attributes per key" << endl;
+    return false;
+  }
+  if(keySize > attributeIndices.size()) {
+    keySize = attributeIndices.size();
+  }
+
+  // sample the key attributes of each table without replacement
+  vector<unsigned int> positions(attributeIndices.size());
+  for(unsigned int i = 0; i < positions.size(); ++i) {
+    positions[i] = i;
+  }
+  vector<vector<unsigned int> > keyAttributes(newNumTables);
+  for(unsigned int table = 0; table < newNumTables; ++table) {
+    rng.PartialShuffle(keySize, positions);
+    for(unsigned int i = 0; i < keySize; ++i) {
+      keyAttributes[table].push_back(attributeIndices[positions[i]]);
+    }
+  }
+
+  numInstances = instanceIndices.size();
+  numTables = newNumTables;
+  keys.resize((size_t) numTables * numInstances);
+#pragma omp parallel for
+  for(int row = 0; row < (int) numInstances; ++row) {
+    DatasetInstance* dsi = ds->GetInstance(instanceIndices[row]);
+    for(unsigned int table = 0; table < numTables; ++table) {
+      uint64_t key = 0;
+      const vector<unsigned int>& tableAttributes = keyAttributes[table];
+      for(unsigned int i = 0; i < tableAttributes.size(); ++i) {
+        AttributeLevel level = dsi->attributes[tableAttributes[i]];
+        // missing and any unexpected genotype hash as the fourth code
+        uint64_t code = 3;
+        if((level >= 0) && (level <= 2)) {
+          code = level;
+        }
+        key = (key << 2) | code;
+      }
+      keys[(size_t) table * numInstances + row] = key;
+    }
+  }
+
+  // each table's rows sorted by key, so a bucket is an equal range
+  sortedKeys.resize(keys.size());
+  sortedRows.resize(keys.size());
+#pragma omp parallel for
+  for(int table = 0; table < (int) numTables; ++table) {
+    size_t tableStart = (size_t) table * numInstances;
+    vector<pair<uint64_t, unsigned int> > bucketRows(numInstances);
+    for(unsigned int row = 0; row < numInstances; ++row) {
+      bucketRows[row] = make_pair(keys[tableStart + row], row);
+    }
+    sort(bucketRows.begin(), bucketRows.end());
+    for(unsigned int i = 0; i < numInstances; ++i) {
+      sortedKeys[tableStart + i] = bucketRows[i].first;
+      sortedRows[tableStart + i] = bucketRows[i].second;
+    }
+  }
+
+  return true;
+}
+
+void GenotypeLsh::Clear() {
+  numInstances = 0;
+  numTables = 0;
+  keys.clear();
+  sortedKeys.clear();
+  sortedRows.clear();
+}
+
+unsigned int GenotypeLsh::NumTables() {
+  return numTables;
+}
+
+unsigned int GenotypeLsh::NumInstances() {
+  return numInstances;
+}
+
+void GenotypeLsh::Candidates(unsigned int row,
+                             vector<unsigned int>& candidates) {
+  candidates.clear();
+  for(unsigned int table = 0; table < numTables; ++table) {
+    size_t tableStart = (size_t) table * numInstances;
+    const uint64_t* tableKeys = &sortedKeys[tableStart];
+    pair<const uint64_t*, const uint64_t*> bucket =
+            equal_range(tableKeys, tableKeys + numInstances,
+                        keys[tableStart + row]);
+    const unsigned int* tableRows = &sortedRows[tableStart];
+    candidates.insert(candidates.end(),
+                      tableRows + (bucket.first - tableKeys),
+                      tableRows + (bucket.second - tableKeys));
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+  candidates.erase(remove(candidates.begin(), candidates.end(), row),
+                   candidates.end());
+}
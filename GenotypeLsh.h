@@ -0,0 +1,75 @@
+/**
+ * \class GenotypeLsh
+ *
+ * \brief Bit-sampling locality-sensitive hash tables over genotypes.
+ *
+ * Each hash table keys the instances by their genotypes at a random sample
+ * of the attributes, two bits per genotype (0, 1, 2 or missing), so two
+ * instances share a bucket only if they agree at every sampled attribute.
+ * Instances at small gm or am distance agree at most attributes and share a
+ * bucket in some table with high probability; the instances sharing any
+ * bucket with an instance are its candidate neighbors, to be re-ranked by
+ * exact distance. More tables find more of the true nearest neighbors at
+ * the cost of more candidates; longer keys give fewer, closer candidates.
+ *
+ * \sa ReliefF::PreComputeNeighborsLsh
+ */
+
+#ifndef GENOTYPELSH_H
+#define	GENOTYPELSH_H
+
+#include <vector>
+#include <stdint.h>
+
+class Dataset;
+class PhiloxRandom;
+
+/// most attributes in one hash key, two bits per genotype
+const unsigned int GENOTYPE_LSH_MAX_KEY_ATTRIBUTES = 32;
+
+class GenotypeLsh
+{
+public:
+  GenotypeLsh();
+  ~GenotypeLsh();
+  /*************************************************************************//**
+   * Hash the genotypes of the instances passed into new tables.
+   * \param [in] ds pointer to a Dataset object
+   * \param [in] instanceIndices instance indices, one row each
+   * \param [in] attributeIndices attribute indices to sample keys from
+   * \param [in] newNumTables number of hash tables
+   * \param [in] keySize attributes sampled per key, at most
+   *                     GENOTYPE_LSH_MAX_KEY_ATTRIBUTES
+   * \param [in, out] rng random number stream of the attribute samples
+   * \return success
+   ****************************************************************************/
+  bool Build(Dataset* ds, const std::vector<unsigned int>& instanceIndices,
+             const std::vector<unsigned int>& attributeIndices,
+             unsigned int newNumTables, unsigned int keySize,
+             PhiloxRandom& rng);
+  /// Release the hash tables.
+  void Clear();
+  /// Return the number of hash tables.
+  unsigned int NumTables();
+  /// Return the number of hashed instances (rows).
+  unsigned int NumInstances();
+  /*************************************************************************//**
+   * Get the rows that share a bucket with a row in any hash table.
+   * \param [in] row row to get candidate neighbors of
+   * \param [out] candidates candidate rows, ascending, not including row
+   ****************************************************************************/
+  void Candidates(unsigned int row, std::vector<unsigned int>& candidates);
+private:
+  /// number of rows
+  unsigned int numInstances;
+  /// number of hash tables
+  unsigned int numTables;
+  /// [table][row] hash key of each row
+  std::vector<uint64_t> keys;
+  /// [table][n] hash keys, ascending
+  std::vector<uint64_t> sortedKeys;
+  /// [table][n] rows in sortedKeys order
+  std::vector<unsigned int> sortedRows;
+};
+
+#endif	/* GENOTYPELSH_H */
@@ -13,6 +13,7 @@
 #ifndef INSILICO_H
 #define	INSILICO_H
 
+#include <climits>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
@@ -115,6 +116,16 @@ enum AnalysisType
   NO_ANALYSIS /**< no analysis specified */
 };
 
+/**
+ * \enum DistancePrecision.
+ * Storage precision of instance-to-instance distances and packed numerics.
+ */
+enum DistancePrecision
+{
+  DOUBLE_PRECISION, /**< 64-bit doubles */
+  FLOAT_PRECISION /**< 32-bit floats, summed as doubles */
+};
+
 /**
  * \enum ValueType.
  * Return types for determing a value's type.
@@ -0,0 +1,206 @@
+/**
+ * \file MetricKernels.h
+ *
+ * \brief Compile-time diff metric policies for distance and weight loops.
+ *
+ * Each policy computes one attribute's diff between two instances with the
+ * same arithmetic as its DistanceMetrics.h function, as an inline member, so
+ * a loop templated on the SNP and numeric policies makes no indirect call
+ * per attribute and can be inlined and vectorized. SelectMetricKernel maps
+ * the metric types chosen at run time to the fully specialized instantiation
+ * of a kernel for that (SNP metric, numeric metric) pair, once per analysis.
+ *
+ * \sa DistanceMetrics.h
+ */
+
+#ifndef METRICKERNELS_H
+#define	METRICKERNELS_H
+
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+#include "DatasetInstance.h"
+#include "DistanceMetrics.h"
+#include "Insilico.h"
+
+/**
+ * \struct MetricContext.
+ * Data set state the metric policies of one analysis read.
+ */
+struct MetricContext
+{
+  /// compiled diff tables of the SNP metric, or NULL to compute the diffs
+  const double* snpDiffTables;
+  /// per attribute: offset of its table in snpDiffTables
+  const unsigned int* snpDiffTableOffsets;
+  /// per numeric: minimum and maximum values
+  const std::pair<NumericLevel, NumericLevel>* numericsMinMax;
+};
+
+/// Genotype mismatch policy, same as diffGMM.
+class GMMetric
+{
+public:
+  explicit GMMetric(const MetricContext&) {}
+  double Diff(unsigned int attributeIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    AttributeLevel level1 = dsi1->attributes[attributeIndex];
+    AttributeLevel level2 = dsi2->attributes[attributeIndex];
+    if((level1 == MISSING_ATTRIBUTE_VALUE) ||
+       (level2 == MISSING_ATTRIBUTE_VALUE)) {
+      // RELIEF-D, see CheckMissing
+      return 2.0 / 3.0;
+    }
+    return (level1 != level2) ? 1.0 : 0.0;
+  }
+};
+
+/// Allele mismatch policy, same as diffAMM.
+class AMMetric
+{
+public:
+  explicit AMMetric(const MetricContext&) {}
+  double Diff(unsigned int attributeIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    AttributeLevel level1 = dsi1->attributes[attributeIndex];
+    AttributeLevel level2 = dsi2->attributes[attributeIndex];
+    if((level1 == MISSING_ATTRIBUTE_VALUE) ||
+       (level2 == MISSING_ATTRIBUTE_VALUE)) {
+      // RELIEF-D, see CheckMissing
+      return 2.0 / 3.0;
+    }
+    return (double) abs((int) level1 - (int) level2) * 0.5;
+  }
+};
+
+/// Policy calling a metric function directly, for metrics that depend on
+/// per-attribute allele information, used without compiled diff tables.
+template<double (*attributeDiff)(unsigned int, DatasetInstance*,
+                                 DatasetInstance*)>
+class FunctionMetric
+{
+public:
+  explicit FunctionMetric(const MetricContext&) {}
+  double Diff(unsigned int attributeIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    return attributeDiff(attributeIndex, dsi1, dsi2);
+  }
+};
+
+/// Nucleotide count array policy, same as diffNCA.
+typedef FunctionMetric<diffNCA> NCAMetric;
+/// NCA6 policy, same as diffNCA6.
+typedef FunctionMetric<diffNCA6> NCA6Metric;
+/// Kimura policy, same as diffKM.
+typedef FunctionMetric<diffKM> KMMetric;
+
+/// Policy looking up any SNP metric's diffs in the compiled diff tables.
+class DiffTableMetric
+{
+public:
+  explicit DiffTableMetric(const MetricContext& context) :
+  tables(context.snpDiffTables), tableOffsets(context.snpDiffTableOffsets) {
+  }
+  double Diff(unsigned int attributeIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    return tables[tableOffsets[attributeIndex] +
+            DiffTableIndex(dsi1->attributes[attributeIndex],
+                           dsi2->attributes[attributeIndex])];
+  }
+private:
+  const double* tables;
+  const unsigned int* tableOffsets;
+};
+
+/// Range-normalized absolute difference policy, same as diffManhattan.
+class ManhattanMetric
+{
+public:
+  explicit ManhattanMetric(const MetricContext& context) :
+  minMax(context.numericsMinMax) {
+  }
+  double Diff(unsigned int numericIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    NumericLevel value1 = dsi1->numerics[numericIndex];
+    NumericLevel value2 = dsi2->numerics[numericIndex];
+    if((value1 == MISSING_NUMERIC_VALUE) || (value2 == MISSING_NUMERIC_VALUE)) {
+      return CheckMissingNumeric(numericIndex, dsi1, dsi2).second;
+    }
+    return fabs(value1 - value2) /
+            (minMax[numericIndex].second - minMax[numericIndex].first);
+  }
+private:
+  const std::pair<NumericLevel, NumericLevel>* minMax;
+};
+
+/// Euclidean policy, same as diffEuclidean.
+class EuclideanMetric
+{
+public:
+  explicit EuclideanMetric(const MetricContext&) {}
+  double Diff(unsigned int numericIndex, DatasetInstance* dsi1,
+              DatasetInstance* dsi2) const {
+    NumericLevel value1 = dsi1->numerics[numericIndex];
+    NumericLevel value2 = dsi2->numerics[numericIndex];
+    if((value1 == MISSING_NUMERIC_VALUE) || (value2 == MISSING_NUMERIC_VALUE)) {
+      return CheckMissingNumeric(numericIndex, dsi1, dsi2).second;
+    }
+    return hypot(value1, value2);
+  }
+};
+
+/***************************************************************************//**
+ * Select the instantiation of a kernel for a SNP policy and numeric metric.
+ * \param [in] numericMetric numeric metric type
+ * \return Kernels::Get<SnpMetric, numeric policy>(), or NULL if unknown
+ ******************************************************************************/
+template<class Kernels, class SnpMetric>
+typename Kernels::Kernel SelectNumericMetricKernel(
+        NumericMetricType numericMetric) {
+  switch(numericMetric) {
+    case MANHATTAN_NUMERIC_METRIC:
+      return Kernels::template Get<SnpMetric, ManhattanMetric>();
+    case EUCLIDEAN_NUMERIC_METRIC:
+      return Kernels::template Get<SnpMetric, EuclideanMetric>();
+    default:
+      return 0;
+  }
+}
+
+/***************************************************************************//**
+ * Select the instantiation of a kernel for a SNP and a numeric metric.
+ * Kernels is a class with a Kernel (member) function pointer typedef and a
+ * static member template Get<SnpMetric, NumericMetric>() returning the
+ * kernel instantiated for those policies. Compiled diff tables are
+ * preferred for every SNP metric: a table lookup has no data dependent
+ * branches, unlike the gm and am comparisons.
+ * \param [in] snpMetric SNP metric type
+ * \param [in] numericMetric numeric metric type
+ * \param [in] hasSnpDiffTables are the SNP metric's diff tables compiled?
+ * \return specialized kernel, or NULL if a metric is unknown
+ ******************************************************************************/
+template<class Kernels>
+typename Kernels::Kernel SelectMetricKernel(SnpMetricType snpMetric,
+                                            NumericMetricType numericMetric,
+                                            bool hasSnpDiffTables) {
+  if(hasSnpDiffTables && (snpMetric != NO_SNP_METRIC)) {
+    return SelectNumericMetricKernel<Kernels, DiffTableMetric>(numericMetric);
+  }
+  switch(snpMetric) {
+    case GM_SNP_METRIC:
+      return SelectNumericMetricKernel<Kernels, GMMetric>(numericMetric);
+    case AM_SNP_METRIC:
+      return SelectNumericMetricKernel<Kernels, AMMetric>(numericMetric);
+    case NCA_SNP_METRIC:
+      return SelectNumericMetricKernel<Kernels, NCAMetric>(numericMetric);
+    case NCA6_SNP_METRIC:
+      return SelectNumericMetricKernel<Kernels, NCA6Metric>(numericMetric);
+    case KM_SNP_METRIC:
+      return SelectNumericMetricKernel<Kernels, KMMetric>(numericMetric);
+    default:
+      return 0;
+  }
+}
+
+#endif	/* METRICKERNELS_H */
@@ -0,0 +1,356 @@
+/*
+ * NeighborTable.cpp
+ *
+ * Nearest neighbors of every instance, stored as instance indices.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "NeighborTable.h"
+#include "Insilico.h"
+
+using namespace std;
+
+/// neighbors file magic number and format version
+static const char NEIGHBORS_FILE_MAGIC[8] = {'R', 'S', 'N', 'B', 'R', 'T',
+  'B', 'L'};
+static const uint32_t NEIGHBORS_FILE_VERSION = 1;
+/// written as is, so a file of the other byte order reads as a mismatch
+static const uint32_t NEIGHBORS_FILE_BYTE_ORDER = 0x01020304;
+
+/// write a block of values, padded to an 8-byte boundary
+template<class T>
+static void WriteBlock(ofstream& outFile, const T* values, size_t count) {
+  static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  size_t numBytes = count * sizeof(T);
+  if(numBytes) {
+    outFile.write((const char*) values, numBytes);
+  }
+  outFile.write(padding, (8 - numBytes % 8) % 8);
+}
+
+/// read a block of values written by WriteBlock
+template<class T>
+static bool ReadBlock(ifstream& inFile, T* values, size_t count) {
+  char padding[8];
+  size_t numBytes = count * sizeof(T);
+  if(numBytes) {
+    inFile.read((char*) values, numBytes);
+  }
+  inFile.read(padding, (8 - numBytes % 8) % 8);
+  return inFile.good();
+}
+
+/// write a string as its length and characters
+static void WriteString(ofstream& outFile, const string& value) {
+  uint64_t length = value.size();
+  WriteBlock(outFile, &length, 1);
+  WriteBlock(outFile, value.data(), value.size());
+}
+
+/// read a string written by WriteString
+static bool ReadString(ifstream& inFile, string& value) {
+  uint64_t length = 0;
+  if(!ReadBlock(inFile, &length, 1) || (length > 4096)) {
+    return false;
+  }
+  vector<char> chars(length);
+  if(!ReadBlock(inFile, chars.empty() ? (char*) 0 : &chars[0], length)) {
+    return false;
+  }
+  value.assign(chars.begin(), chars.end());
+  return true;
+}
+
+NeighborTable::NeighborTable() {
+  numRows = 0;
+  numSlots = 0;
+  k = 0;
+}
+
+NeighborTable::~NeighborTable() {
+}
+
+void NeighborTable::Allocate(unsigned int newNumRows,
+                             const vector<ClassLevel>& newClassLevels,
+                             unsigned int newK) {
+  Clear();
+  numRows = newNumRows;
+  classLevels = newClassLevels;
+  numSlots = classLevels.size() ? classLevels.size() : 1;
+  k = newK;
+  size_t numCounts = (size_t) numRows * numSlots;
+  counts.assign(numCounts, 0);
+  starts.resize(numCounts + 1);
+  for(size_t i = 0; i <= numCounts; ++i) {
+    starts[i] = i * k;
+  }
+  indices.assign(numCounts * k, 0);
+  distances.assign(numCounts * k, 0.0);
+}
+
+void NeighborTable::Allocate(unsigned int newNumRows,
+                             const vector<ClassLevel>& newClassLevels,
+                             const vector<unsigned int>& capacities) {
+  Clear();
+  numRows = newNumRows;
+  classLevels = newClassLevels;
+  numSlots = classLevels.size() ? classLevels.size() : 1;
+  size_t numCounts = (size_t) numRows * numSlots;
+  counts.assign(numCounts, 0);
+  starts.resize(numCounts + 1);
+  starts[0] = 0;
+  for(size_t i = 0; i < numCounts; ++i) {
+    starts[i + 1] = starts[i] + ((i < capacities.size()) ? capacities[i] : 0);
+  }
+  indices.assign(starts[numCounts], 0);
+  distances.assign(starts[numCounts], 0.0);
+}
+
+void NeighborTable::Clear() {
+  numRows = 0;
+  numSlots = 0;
+  k = 0;
+  classLevels.clear();
+  counts.clear();
+  starts.clear();
+  indices.clear();
+  distances.clear();
+}
+
+unsigned int NeighborTable::K() const {
+  return k;
+}
+
+unsigned int NeighborTable::NumSlots() const {
+  return numSlots;
+}
+
+ClassLevel NeighborTable::SlotClass(unsigned int slot) const {
+  if(slot < classLevels.size()) {
+    return classLevels[slot];
+  }
+  return MISSING_DISCRETE_CLASS_VALUE;
+}
+
+unsigned int NeighborTable::ClassSlot(ClassLevel classLevel) const {
+  if(classLevels.empty()) {
+    return 0;
+  }
+  for(unsigned int slot = 0; slot < classLevels.size(); ++slot) {
+    if(classLevels[slot] == classLevel) {
+      return slot;
+    }
+  }
+  return numSlots;
+}
+
+void NeighborTable::SetNeighbors(unsigned int row, unsigned int slot,
+                                 const vector<NeighborCandidate>& neighbors,
+                                 const vector<unsigned int>& instanceIndices) {
+  size_t rowSlot = (size_t) row * numSlots + slot;
+  size_t start = starts[rowSlot];
+  unsigned int numNeighbors = min((size_t) neighbors.size(),
+                                  starts[rowSlot + 1] - start);
+  for(unsigned int n = 0; n < numNeighbors; ++n) {
+    distances[start + n] = neighbors[n].first;
+    indices[start + n] = instanceIndices[neighbors[n].second];
+  }
+  counts[rowSlot] = numNeighbors;
+}
+
+bool NeighborTable::Save(string filename, uint64_t fingerprint,
+                         const vector<unsigned int>& maskIndices,
+                         const vector<string>& metrics) const {
+  ofstream outFile(filename.c_str(), ios::out | ios::binary);
+  if(!outFile.is_open()) {
+    cerr << "ERROR: Could not open " << filename << " for writing" << endl;
+    return false;
+  }
+  WriteBlock(outFile, NEIGHBORS_FILE_MAGIC, sizeof(NEIGHBORS_FILE_MAGIC));
+  uint32_t header[6] = {NEIGHBORS_FILE_VERSION, NEIGHBORS_FILE_BYTE_ORDER,
+    numRows, numSlots, k, (uint32_t) maskIndices.size()};
+  WriteBlock(outFile, header, 6);
+  WriteBlock(outFile, &fingerprint, 1);
+  uint64_t numMetrics = metrics.size();
+  WriteBlock(outFile, &numMetrics, 1);
+  for(unsigned int i = 0; i < metrics.size(); ++i) {
+    WriteString(outFile, metrics[i]);
+  }
+  uint64_t numClassLevels = classLevels.size();
+  WriteBlock(outFile, &numClassLevels, 1);
+  WriteBlock(outFile, classLevels.empty() ? (ClassLevel*) 0 : &classLevels[0],
+             classLevels.size());
+  WriteBlock(outFile, maskIndices.empty() ? (unsigned int*) 0 : &maskIndices[0],
+             maskIndices.size());
+  WriteBlock(outFile, counts.empty() ? (unsigned int*) 0 : &counts[0],
+             counts.size());
+  // variable size slots are written back to back, trimmed to their counts
+  vector<unsigned int> slotIndices;
+  vector<double> slotDistances;
+  const vector<unsigned int>* writeIndices = &indices;
+  const vector<double>* writeDistances = &distances;
+  if(!k) {
+    for(size_t i = 0; i < counts.size(); ++i) {
+      slotIndices.insert(slotIndices.end(), indices.begin() + starts[i],
+                         indices.begin() + starts[i] + counts[i]);
+      slotDistances.insert(slotDistances.end(), distances.begin() + starts[i],
+                           distances.begin() + starts[i] + counts[i]);
+    }
+    writeIndices = &slotIndices;
+    writeDistances = &slotDistances;
+  }
+  WriteBlock(outFile, writeIndices->empty() ? (unsigned int*) 0 :
+             &(*writeIndices)[0], writeIndices->size());
+  WriteBlock(outFile, writeDistances->empty() ? (double*) 0 :
+             &(*writeDistances)[0], writeDistances->size());
+  outFile.close();
+  if(outFile.fail()) {
+    cerr << "ERROR: Could not write the nearest neighbors to " << filename
+            << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool NeighborTable::Load(string filename, uint64_t fingerprint,
+                         const vector<unsigned int>& maskIndices,
+                         const vector<string>& metrics, unsigned int minK) {
+  ifstream inFile(filename.c_str(), ios::in | ios::binary);
+  if(!inFile.is_open()) {
+    cout << Timestamp() << "WARNING: Could not open " << filename
+            << " for reading" << endl;
+    return false;
+  }
+  char magic[8];
+  uint32_t header[6];
+  if(!ReadBlock(inFile, magic, sizeof(magic)) ||
+     memcmp(magic, NEIGHBORS_FILE_MAGIC, sizeof(magic)) ||
+     !ReadBlock(inFile, header, 6) ||
+     (header[0] != NEIGHBORS_FILE_VERSION) ||
+     (header[1] != NEIGHBORS_FILE_BYTE_ORDER)) {
+    cout << Timestamp() << "WARNING: " << filename << " is not a nearest "
+            << "neighbors file of this version and byte order" << endl;
+    return false;
+  }
+  unsigned int fileNumRows = header[2];
+  unsigned int fileNumSlots = header[3];
+  unsigned int fileK = header[4];
+  unsigned int fileNumMask = header[5];
+  uint64_t fileFingerprint = 0;
+  uint64_t numMetrics = 0;
+  if(!ReadBlock(inFile, &fileFingerprint, 1) ||
+     !ReadBlock(inFile, &numMetrics, 1) || (numMetrics > 16)) {
+    cout << Timestamp() << "WARNING: Could not read the header of "
+            << filename << endl;
+    return false;
+  }
+  vector<string> fileMetrics(numMetrics);
+  for(unsigned int i = 0; i < fileMetrics.size(); ++i) {
+    if(!ReadString(inFile, fileMetrics[i])) {
+      cout << Timestamp() << "WARNING: Could not read the metrics of "
+              << filename << endl;
+      return false;
+    }
+  }
+
+  // check the saved data against the current data before reading blocks
+  if(fileMetrics != metrics) {
+    cout << Timestamp() << "Nearest neighbors in " << filename
+            << " were selected with other metrics" << endl;
+    return false;
+  }
+  if((fileNumMask != maskIndices.size()) ||
+     (fileFingerprint != fingerprint)) {
+    cout << Timestamp() << "Nearest neighbors in " << filename
+            << " are for other data, instances or attributes" << endl;
+    return false;
+  }
+  if(fileK < minK) {
+    cout << Timestamp() << "Nearest neighbors in " << filename << " are "
+            << fileK << " per class, fewer than " << minK << endl;
+    return false;
+  }
+
+  uint64_t numClassLevels = 0;
+  if(!ReadBlock(inFile, &numClassLevels, 1) ||
+     (numClassLevels ? (numClassLevels != fileNumSlots) :
+      (fileNumSlots != 1))) {
+    cout << Timestamp() << "WARNING: Could not read the classes of "
+            << filename << endl;
+    return false;
+  }
+  vector<ClassLevel> fileClassLevels(numClassLevels);
+  vector<unsigned int> fileMaskIndices(fileNumMask);
+  size_t numCounts = (size_t) fileNumRows * fileNumSlots;
+  vector<unsigned int> fileCounts(numCounts);
+  if(!ReadBlock(inFile, fileClassLevels.empty() ? (ClassLevel*) 0 :
+                &fileClassLevels[0], fileClassLevels.size()) ||
+     !ReadBlock(inFile, fileMaskIndices.empty() ? (unsigned int*) 0 :
+                &fileMaskIndices[0], fileMaskIndices.size()) ||
+     !ReadBlock(inFile, fileCounts.empty() ? (unsigned int*) 0 :
+                &fileCounts[0], fileCounts.size())) {
+    cout << Timestamp() << "WARNING: " << filename << " is truncated" << endl;
+    return false;
+  }
+  if(fileMaskIndices != maskIndices) {
+    cout << Timestamp() << "Nearest neighbors in " << filename
+            << " are for other instances" << endl;
+    return false;
+  }
+  // a table of k = 0 stores each slot's neighbors back to back
+  vector<size_t> fileStarts(numCounts + 1, 0);
+  for(size_t i = 0; i < numCounts; ++i) {
+    if(fileK && (fileCounts[i] > fileK)) {
+      cout << Timestamp() << "WARNING: " << filename
+              << " has invalid neighbor counts" << endl;
+      return false;
+    }
+    fileStarts[i + 1] = fileStarts[i] + (fileK ? fileK : fileCounts[i]);
+  }
+  vector<unsigned int> fileIndices(fileStarts[numCounts]);
+  vector<double> fileDistances(fileStarts[numCounts]);
+  if(!ReadBlock(inFile, fileIndices.empty() ? (unsigned int*) 0 :
+                &fileIndices[0], fileIndices.size()) ||
+     !ReadBlock(inFile, fileDistances.empty() ? (double*) 0 :
+                &fileDistances[0], fileDistances.size())) {
+    cout << Timestamp() << "WARNING: " << filename << " is truncated" << endl;
+    return false;
+  }
+  // every neighbor must be a masked instance
+  vector<bool> inMask(fileNumRows, false);
+  for(unsigned int i = 0; i < fileMaskIndices.size(); ++i) {
+    if(fileMaskIndices[i] >= fileNumRows) {
+      cout << Timestamp() << "WARNING: " << filename
+              << " has invalid instances" << endl;
+      return false;
+    }
+    inMask[fileMaskIndices[i]] = true;
+  }
+  for(size_t i = 0; i < numCounts; ++i) {
+    for(size_t n = fileStarts[i]; n < fileStarts[i] + fileCounts[i]; ++n) {
+      if((fileIndices[n] >= fileNumRows) || !inMask[fileIndices[n]]) {
+        cout << Timestamp() << "WARNING: " << filename
+                << " has invalid neighbor instances" << endl;
+        return false;
+      }
+    }
+  }
+
+  numRows = fileNumRows;
+  numSlots = fileNumSlots;
+  k = fileK;
+  classLevels.swap(fileClassLevels);
+  counts.swap(fileCounts);
+  starts.swap(fileStarts);
+  indices.swap(fileIndices);
+  distances.swap(fileDistances);
+
+  return true;
+}
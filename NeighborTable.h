@@ -0,0 +1,152 @@
+/**
+ * \class NeighborTable
+ *
+ * \brief Nearest neighbors of every instance, stored as instance indices.
+ *
+ * Neighbor selection fills one row per data set instance, indexed like
+ * Dataset::GetInstance, with a slot per class of the masked instances, or a
+ * single slot of all neighbors for continuous phenotypes. Each slot holds up
+ * to k neighbor instance indices in selection order, in one contiguous
+ * block, and their distances in a parallel block, so weight updates read a
+ * sampled instance's hits and misses through pointers without allocating
+ * or looking up instance IDs. Neighbors selected for a k sweep are nearest
+ * first with ties in instance ID order: the first n neighbors of a slot are
+ * the n nearest, so the table serves every smaller k. A table can instead
+ * hold a variable number of neighbors per slot, eg, all instances within a
+ * distance threshold, with k = 0.
+ *
+ * A table can be saved to a binary file and loaded by later runs on the
+ * same data, with any analysis, the same k or any k up to the saved k of a
+ * sweep, or weighting. The file holds a header, the instance mask, the
+ * nearest neighbor metrics, a fingerprint of the masked data and the count,
+ * index and distance blocks, each starting on an 8-byte boundary so the
+ * blocks could be mapped in place; it is read only by a build with the same
+ * byte order.
+ *
+ * \sa ReliefF::PreComputeDistances
+ */
+
+#ifndef NEIGHBORTABLE_H
+#define	NEIGHBORTABLE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+#include "Insilico.h"
+
+/// nearest neighbor candidate: distance, position in the instance mask
+typedef std::pair<double, unsigned int> NeighborCandidate;
+
+class NeighborTable
+{
+public:
+  NeighborTable();
+  ~NeighborTable();
+  /*************************************************************************//**
+   * Allocate an empty table, releasing any previous neighbors.
+   * \param [in] newNumRows number of rows, one per data set instance
+   * \param [in] newClassLevels class of each slot, sorted, or empty for a
+   *                            single slot of all neighbors
+   * \param [in] newK neighbors per slot
+   ****************************************************************************/
+  void Allocate(unsigned int newNumRows,
+                const std::vector<ClassLevel>& newClassLevels,
+                unsigned int newK);
+  /*************************************************************************//**
+   * Allocate an empty table of variable size slots, releasing any previous
+   * neighbors. K() is 0.
+   * \param [in] newNumRows number of rows, one per data set instance
+   * \param [in] newClassLevels class of each slot, sorted, or empty for a
+   *                            single slot of all neighbors
+   * \param [in] capacities [row][slot] most neighbors of each slot
+   ****************************************************************************/
+  void Allocate(unsigned int newNumRows,
+                const std::vector<ClassLevel>& newClassLevels,
+                const std::vector<unsigned int>& capacities);
+  /// Release the neighbors.
+  void Clear();
+  /// Return the number of neighbors per slot, 0 if not allocated or the
+  /// slots are of variable size.
+  unsigned int K() const;
+  /// Return the number of slots per row.
+  unsigned int NumSlots() const;
+  /// Return the class of a slot.
+  ClassLevel SlotClass(unsigned int slot) const;
+  /*************************************************************************//**
+   * Return the slot of the neighbors of a class.
+   * \param [in] classLevel class of the neighbors
+   * \return slot, 0 for a single slot of all neighbors, or NumSlots() if the
+   *         class has no slot
+   ****************************************************************************/
+  unsigned int ClassSlot(ClassLevel classLevel) const;
+  /*************************************************************************//**
+   * Store the neighbors of one row and slot.
+   * \param [in] row instance index of the row
+   * \param [in] slot class slot
+   * \param [in] neighbors up to k, or the slot's capacity, neighbors,
+   *                       in selection order, as candidates
+   *                       whose positions index instanceIndices
+   * \param [in] instanceIndices instance index of each candidate position
+   ****************************************************************************/
+  void SetNeighbors(unsigned int row, unsigned int slot,
+                    const std::vector<NeighborCandidate>& neighbors,
+                    const std::vector<unsigned int>& instanceIndices);
+  /*************************************************************************//**
+   * Save the table to a binary file.
+   * \param [in] filename neighbors filename
+   * \param [in] fingerprint fingerprint of the data the neighbors are of
+   * \param [in] maskIndices instance indices of the instance mask
+   * \param [in] metrics nearest neighbor SNP and numeric metric names
+   * \return success
+   ****************************************************************************/
+  bool Save(std::string filename, uint64_t fingerprint,
+            const std::vector<unsigned int>& maskIndices,
+            const std::vector<std::string>& metrics) const;
+  /*************************************************************************//**
+   * Load a table saved for the same data, replacing this table. The table is
+   * unchanged if the file cannot be read or was saved for other data.
+   * \param [in] filename neighbors filename
+   * \param [in] fingerprint fingerprint of the current data
+   * \param [in] maskIndices instance indices of the current instance mask
+   * \param [in] metrics current nearest neighbor SNP and numeric metric names
+   * \param [in] minK fewest neighbors per slot to accept
+   * \return success
+   ****************************************************************************/
+  bool Load(std::string filename, uint64_t fingerprint,
+            const std::vector<unsigned int>& maskIndices,
+            const std::vector<std::string>& metrics, unsigned int minK);
+  /// Return the number of neighbors stored in a row and slot.
+  unsigned int NumNeighbors(unsigned int row, unsigned int slot) const {
+    return (row < numRows) ? counts[row * numSlots + slot] : 0;
+  }
+  /// Return the instance indices of the neighbors in a row and slot.
+  const unsigned int* Neighbors(unsigned int row, unsigned int slot) const {
+    return &indices[starts[(std::size_t) row * numSlots + slot]];
+  }
+  /// Return the distances of the neighbors in a row and slot.
+  const double* Distances(unsigned int row, unsigned int slot) const {
+    return &distances[starts[(std::size_t) row * numSlots + slot]];
+  }
+private:
+  /// number of rows
+  unsigned int numRows;
+  /// number of slots per row
+  unsigned int numSlots;
+  /// neighbors per slot, 0 for variable size slots
+  unsigned int k;
+  /// class of each slot, empty for a single slot of all neighbors
+  std::vector<ClassLevel> classLevels;
+  /// [row][slot] number of neighbors stored
+  std::vector<unsigned int> counts;
+  /// [row][slot] + 1 start of each slot's neighbors in indices and distances
+  std::vector<std::size_t> starts;
+  /// [row][slot][neighbor] neighbor instance indices
+  std::vector<unsigned int> indices;
+  /// [row][slot][neighbor] neighbor distances
+  std::vector<double> distances;
+};
+
+#endif	/* NEIGHBORTABLE_H */
@@ -0,0 +1,156 @@
+/*
+ * PackedGenotypes.cpp
+ *
+ * Bit-packed genotypes and popcount distance kernels for the gm and am
+ * nearest neighbor metrics.
+ */
+
+#include <iostream>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "PackedGenotypes.h"
+#include "Dataset.h"
+#include "DatasetInstance.h"
+#include "StringUtils.h"
+#include "Insilico.h"
+
+using namespace std;
+using namespace insilico;
+
+PackedGenotypes::PackedGenotypes() {
+  packedMetric = PACKED_NO_METRIC;
+  numInstances = 0;
+  numAttributes = 0;
+  wordsPerInstance = 0;
+}
+
+PackedGenotypes::~PackedGenotypes() {
+}
+
+PackedGenotypeMetric PackedGenotypes::MetricFromName(string snpMetricName) {
+  if(to_upper(snpMetricName) == "GM") {
+    return PACKED_GM_METRIC;
+  }
+  if(to_upper(snpMetricName) == "AM") {
+    return PACKED_AM_METRIC;
+  }
+  return PACKED_NO_METRIC;
+}
+
+bool PackedGenotypes::Pack(Dataset* ds,
+                           const vector<unsigned int>& instanceIndices,
+                           const vector<unsigned int>& attributeIndices,
+                           PackedGenotypeMetric metric) {
+  Clear();
+  if(metric == PACKED_NO_METRIC) {
+    return false;
+  }
+
+  numInstances = instanceIndices.size();
+  numAttributes = attributeIndices.size();
+  wordsPerInstance = (numAttributes + 63) / 64;
+  words.resize((size_t) numInstances * wordsPerInstance * NUM_PLANES, 0);
+
+  bool allValid = true;
+#pragma omp parallel for reduction(&&:allValid)
+  for(int row = 0; row < (int) numInstances; ++row) {
+    DatasetInstance* dsi = ds->GetInstance(instanceIndices[row]);
+    uint64_t* rowWords = &words[(size_t) row * wordsPerInstance * NUM_PLANES];
+    for(unsigned int attrIdx = 0; attrIdx < numAttributes; ++attrIdx) {
+      AttributeLevel thisLevel = dsi->attributes[attributeIndices[attrIdx]];
+      unsigned int plane = 0;
+      if(thisLevel == MISSING_ATTRIBUTE_VALUE) {
+        plane = 3;
+      } else {
+        if((thisLevel < 0) || (thisLevel > 2)) {
+          allValid = false;
+          continue;
+        }
+        plane = (unsigned int) thisLevel;
+      }
+      rowWords[(attrIdx / 64) * NUM_PLANES + plane] |=
+              ((uint64_t) 1) << (attrIdx % 64);
+    }
+  }
+  if(!allValid) {
+    Clear();
+    return false;
+  }
+  packedMetric = metric;
+
+  return true;
+}
+
+void PackedGenotypes::Clear() {
+  packedMetric = PACKED_NO_METRIC;
+  numInstances = 0;
+  numAttributes = 0;
+  wordsPerInstance = 0;
+  words.clear();
+}
+
+bool PackedGenotypes::IsPacked() {
+  return packedMetric != PACKED_NO_METRIC;
+}
+
+unsigned int PackedGenotypes::NumInstances() {
+  return numInstances;
+}
+
+unsigned int PackedGenotypes::NumAttributes() {
+  return numAttributes;
+}
+
+double PackedGenotypes::Distance(unsigned int row1, unsigned int row2) {
+  return (double) IntegerDistance(row1, row2, 0, wordsPerInstance) /
+          IntegerDistanceScale();
+}
+
+unsigned int PackedGenotypes::NumWords() {
+  return wordsPerInstance;
+}
+
+uint64_t PackedGenotypes::IntegerDistance(unsigned int row1,
+                                          unsigned int row2,
+                                          unsigned int wordBegin,
+                                          unsigned int wordEnd) {
+  const uint64_t* r1 = Row(row1) + (size_t) wordBegin * NUM_PLANES;
+  const uint64_t* r2 = Row(row2) + (size_t) wordBegin * NUM_PLANES;
+  // a genotype is exactly one of the four planes, so two present genotypes
+  // differ if their hom-ref or het bits differ
+  uint64_t numMismatch = 0, numOpposite = 0, numMissing = 0;
+  if(packedMetric == PACKED_AM_METRIC) {
+    for(unsigned int w = wordBegin; w < wordEnd; ++w, r1 += NUM_PLANES,
+        r2 += NUM_PLANES) {
+      uint64_t missing = r1[3] | r2[3];
+      uint64_t mismatch = ((r1[0] ^ r2[0]) | (r1[1] ^ r2[1])) & ~missing;
+      // homozygous reference versus homozygous alternate differ by two alleles
+      uint64_t opposite = (r1[0] & r2[2]) | (r1[2] & r2[0]);
+      numMismatch += __builtin_popcountll(mismatch);
+      numOpposite += __builtin_popcountll(opposite);
+      numMissing += __builtin_popcountll(missing);
+    }
+    // sixths: 1/2 per differing allele, 2/3 per missing
+    return 3 * (numMismatch + numOpposite) + 4 * numMissing;
+  }
+
+  for(unsigned int w = wordBegin; w < wordEnd; ++w, r1 += NUM_PLANES,
+      r2 += NUM_PLANES) {
+    uint64_t missing = r1[3] | r2[3];
+    uint64_t mismatch = ((r1[0] ^ r2[0]) | (r1[1] ^ r2[1])) & ~missing;
+    numMismatch += __builtin_popcountll(mismatch);
+    numMissing += __builtin_popcountll(missing);
+  }
+
+  // thirds: 1 per mismatch, 2/3 per missing
+  return 3 * numMismatch + 2 * numMissing;
+}
+
+double PackedGenotypes::IntegerDistanceScale() {
+  if(packedMetric == PACKED_AM_METRIC) {
+    return 6.0;
+  }
+  return 3.0;
+}
@@ -0,0 +1,119 @@
+/**
+ * \class PackedGenotypes
+ *
+ * \brief Bit-packed genotypes for fast instance-to-instance distances.
+ *
+ * Genotypes of the currently masked instances and attributes are stored as
+ * four bitplanes: homozygous reference (0), heterozygous (1), homozygous
+ * alternate (2) and missing, 64 attributes per 64-bit word. The planes for
+ * each word are interleaved so one instance is a single contiguous stream.
+ * Genotype mismatch (gm) and allele mismatch (am) distances, including the
+ * RELIEF-D 2/3 missing value penalty of CheckMissing(), reduce to XOR, AND
+ * and popcount over the words.
+ *
+ * \sa DistanceMetrics.h
+ */
+
+#ifndef PACKEDGENOTYPES_H
+#define	PACKEDGENOTYPES_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class Dataset;
+
+/**
+ * \enum PackedGenotypeMetric.
+ * Distance metrics supported by packed genotypes.
+ */
+enum PackedGenotypeMetric
+{
+  PACKED_GM_METRIC, /**< genotype mismatch */
+  PACKED_AM_METRIC, /**< allele mismatch */
+  PACKED_NO_METRIC /**< metric cannot be computed on packed genotypes */
+};
+
+class PackedGenotypes
+{
+public:
+  PackedGenotypes();
+  ~PackedGenotypes();
+  /*************************************************************************//**
+   * Return the packed metric type for a SNP metric name.
+   * \param [in] snpMetricName SNP metric name, eg, gm or am
+   * \return packed metric or PACKED_NO_METRIC if it cannot be packed
+   ****************************************************************************/
+  static PackedGenotypeMetric MetricFromName(std::string snpMetricName);
+  /*************************************************************************//**
+   * Pack the genotypes of the instances and attributes passed.
+   * \param [in] ds pointer to a Dataset object
+   * \param [in] instanceIndices instance indices, one packed row each
+   * \param [in] attributeIndices attribute indices to pack, in order
+   * \param [in] metric distance metric to compute
+   * \return success, false if a genotype is not 0/1/2/missing
+   ****************************************************************************/
+  bool Pack(Dataset* ds, const std::vector<unsigned int>& instanceIndices,
+            const std::vector<unsigned int>& attributeIndices,
+            PackedGenotypeMetric metric);
+  /// Release the packed genotypes.
+  void Clear();
+  /// Are genotypes packed and ready for distance calculations?
+  bool IsPacked();
+  /// Return the number of packed instances (rows).
+  unsigned int NumInstances();
+  /// Return the number of packed attributes.
+  unsigned int NumAttributes();
+  /*************************************************************************//**
+   * Compute the distance between two packed instances using the metric
+   * selected when packing.
+   * \param [in] row1 packed row of instance 1
+   * \param [in] row2 packed row of instance 2
+   * \return distance, the sum of attribute diffs
+   ****************************************************************************/
+  double Distance(unsigned int row1, unsigned int row2);
+  /// Return the number of 64-attribute words in each packed row.
+  unsigned int NumWords();
+  /*************************************************************************//**
+   * Compute the distance between two packed instances over a range of words
+   * as an exact integer multiple of 1 / IntegerDistanceScale(). Partial
+   * distances of consecutive word ranges can be summed without rounding.
+   * \param [in] row1 packed row of instance 1
+   * \param [in] row2 packed row of instance 2
+   * \param [in] wordBegin first word
+   * \param [in] wordEnd one past the last word
+   * \return distance times IntegerDistanceScale()
+   ****************************************************************************/
+  uint64_t IntegerDistance(unsigned int row1, unsigned int row2,
+                           unsigned int wordBegin, unsigned int wordEnd);
+  /// Return the denominator of IntegerDistance: 3 for gm, 6 for am.
+  double IntegerDistanceScale();
+  /*************************************************************************//**
+   * Return the bitplanes of a packed row, NUM_PLANES words per 64-attribute
+   * word: hom-ref, het, hom-alt and missing.
+   * \param [in] row packed row
+   * \return pointer to the first plane of the first word of the row
+   ****************************************************************************/
+  const uint64_t* RowPlanes(unsigned int row) const {
+    return Row(row);
+  }
+  /// bitplanes per word: hom-ref, het, hom-alt, missing
+  static const unsigned int NUM_PLANES = 4;
+private:
+  /// return a pointer to the first word of a packed row
+  const uint64_t* Row(unsigned int row) const {
+    return &words[(size_t) row * wordsPerInstance * NUM_PLANES];
+  }
+  /// metric to compute
+  PackedGenotypeMetric packedMetric;
+  /// number of rows
+  unsigned int numInstances;
+  /// number of attributes in each row
+  unsigned int numAttributes;
+  /// 64-bit words needed for one plane of one row
+  unsigned int wordsPerInstance;
+  /// interleaved bitplanes: [row][word][plane]
+  std::vector<uint64_t> words;
+};
+
+#endif	/* PACKEDGENOTYPES_H */
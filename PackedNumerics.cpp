@@ -0,0 +1,424 @@
+/*
+ * PackedNumerics.cpp
+ *
+ * Contiguous numerics and SIMD distance kernels for the manhattan and
+ * euclidean nearest neighbor metrics, dispatched on the CPU at run time.
+ */
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKED_NUMERICS_X86
+#endif
+
+#include "PackedNumerics.h"
+#include "Dataset.h"
+#include "DatasetInstance.h"
+#include "DistanceMetrics.h"
+#include "Insilico.h"
+
+using namespace std;
+
+/// partial sums every kernel keeps, one per column modulo eight
+static const unsigned int NUMERIC_KERNEL_LANES = 8;
+/// all eight lanes of an AVX-512 double vector, for the zero-masked
+/// intrinsics: the plain ones merge into undefined vectors that GCC warns
+/// may be used uninitialized
+static const __mmask8 ALL_AVX512_LANES = 0xFF;
+
+/// add the partial sums of the kernels in one fixed order
+static inline double ReduceLanes(const double* lanes) {
+  return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) +
+          ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+}
+
+/// diff of a numeric with one or two missing values, see CheckMissingNumeric
+static inline double MissingNumericDiff(double value1, double value2,
+                                        double minimum, double range) {
+  if(isnan(value1) && isnan(value2)) {
+    return 1.0;
+  }
+  double present = isnan(value1) ? value2 : value1;
+  double normalized = (range == 0.0) ? 0.0 : (present - minimum) / range;
+  return (normalized < 0.5) ? 1.0 - normalized : normalized;
+}
+
+template<bool euclidean, class Value>
+static double NumericDistanceScalar(const NumericKernelArgs& args) {
+  const Value* values1 = (const Value*) args.values1;
+  const Value* values2 = (const Value*) args.values2;
+  double lanes[NUMERIC_KERNEL_LANES] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  for(unsigned int n = args.begin; n < args.end; n += NUMERIC_KERNEL_LANES) {
+    for(unsigned int lane = 0; lane < NUMERIC_KERNEL_LANES; ++lane) {
+      double value1 = values1[n + lane];
+      double value2 = values2[n + lane];
+      double diff = 0.0;
+      if(isnan(value1) || isnan(value2)) {
+        diff = MissingNumericDiff(value1, value2, args.minimums[n + lane],
+                                  args.ranges[n + lane]);
+      } else {
+        if(euclidean) {
+          diff = sqrt(value1 * value1 + value2 * value2);
+        } else {
+          diff = fabs(value1 - value2) * args.reciprocalRanges[n + lane];
+        }
+      }
+      lanes[lane] += diff;
+    }
+  }
+  return ReduceLanes(lanes);
+}
+
+#ifdef PACKED_NUMERICS_X86
+
+// loaders of two, four or eight packed values, widening floats to doubles
+
+__attribute__((target("sse4.2")))
+static inline __m128d LoadSSE42(const double* values) {
+  return _mm_loadu_pd(values);
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128d LoadSSE42(const float* values) {
+  return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*) values)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d LoadAVX2(const double* values) {
+  return _mm256_loadu_pd(values);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d LoadAVX2(const float* values) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(values));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d LoadAVX512(const double* values) {
+  return _mm512_loadu_pd(values);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d LoadAVX512(const float* values) {
+  return _mm512_maskz_cvtps_pd(ALL_AVX512_LANES, _mm256_loadu_ps(values));
+}
+
+template<bool euclidean, class Value>
+__attribute__((target("sse4.2")))
+static double NumericDistanceSSE42(const NumericKernelArgs& args) {
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d signBit = _mm_set1_pd(-0.0);
+  __m128d sums[4] = {zero, zero, zero, zero};
+  for(unsigned int n = args.begin; n < args.end; n += NUMERIC_KERNEL_LANES) {
+    for(unsigned int part = 0; part < 4; ++part) {
+      unsigned int idx = n + 2 * part;
+      __m128d value1 = LoadSSE42((const Value*) args.values1 + idx);
+      __m128d value2 = LoadSSE42((const Value*) args.values2 + idx);
+      __m128d diff;
+      if(euclidean) {
+        diff = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(value1, value1),
+                                      _mm_mul_pd(value2, value2)));
+      } else {
+        diff = _mm_mul_pd(_mm_andnot_pd(signBit, _mm_sub_pd(value1, value2)),
+                          _mm_loadu_pd(args.reciprocalRanges + idx));
+      }
+      __m128d missing1 = _mm_cmpunord_pd(value1, value1);
+      __m128d missing2 = _mm_cmpunord_pd(value2, value2);
+      __m128d anyMissing = _mm_or_pd(missing1, missing2);
+      if(_mm_movemask_pd(anyMissing)) {
+        __m128d range = _mm_loadu_pd(args.ranges + idx);
+        __m128d present = _mm_blendv_pd(value1, value2, missing1);
+        __m128d normalized = _mm_div_pd(
+                _mm_sub_pd(present, _mm_loadu_pd(args.minimums + idx)), range);
+        normalized = _mm_andnot_pd(_mm_cmpeq_pd(range, zero), normalized);
+        __m128d missingDiff = _mm_blendv_pd(normalized,
+                                            _mm_sub_pd(one, normalized),
+                                            _mm_cmplt_pd(normalized, half));
+        missingDiff = _mm_blendv_pd(missingDiff, one,
+                                    _mm_and_pd(missing1, missing2));
+        diff = _mm_blendv_pd(diff, missingDiff, anyMissing);
+      }
+      sums[part] = _mm_add_pd(sums[part], diff);
+    }
+  }
+  double lanes[NUMERIC_KERNEL_LANES];
+  for(unsigned int part = 0; part < 4; ++part) {
+    _mm_storeu_pd(lanes + 2 * part, sums[part]);
+  }
+  return ReduceLanes(lanes);
+}
+
+template<bool euclidean, class Value>
+__attribute__((target("avx2")))
+static double NumericDistanceAVX2(const NumericKernelArgs& args) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d signBit = _mm256_set1_pd(-0.0);
+  __m256d sums[2] = {zero, zero};
+  for(unsigned int n = args.begin; n < args.end; n += NUMERIC_KERNEL_LANES) {
+    for(unsigned int part = 0; part < 2; ++part) {
+      unsigned int idx = n + 4 * part;
+      __m256d value1 = LoadAVX2((const Value*) args.values1 + idx);
+      __m256d value2 = LoadAVX2((const Value*) args.values2 + idx);
+      __m256d diff;
+      if(euclidean) {
+        diff = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(value1, value1),
+                                            _mm256_mul_pd(value2, value2)));
+      } else {
+        diff = _mm256_mul_pd(
+                _mm256_andnot_pd(signBit, _mm256_sub_pd(value1, value2)),
+                _mm256_loadu_pd(args.reciprocalRanges + idx));
+      }
+      __m256d missing1 = _mm256_cmp_pd(value1, value1, _CMP_UNORD_Q);
+      __m256d missing2 = _mm256_cmp_pd(value2, value2, _CMP_UNORD_Q);
+      __m256d anyMissing = _mm256_or_pd(missing1, missing2);
+      if(_mm256_movemask_pd(anyMissing)) {
+        __m256d range = _mm256_loadu_pd(args.ranges + idx);
+        __m256d present = _mm256_blendv_pd(value1, value2, missing1);
+        __m256d normalized = _mm256_div_pd(
+                _mm256_sub_pd(present, _mm256_loadu_pd(args.minimums + idx)),
+                range);
+        normalized = _mm256_andnot_pd(_mm256_cmp_pd(range, zero, _CMP_EQ_OQ),
+                                      normalized);
+        __m256d missingDiff = _mm256_blendv_pd(
+                normalized, _mm256_sub_pd(one, normalized),
+                _mm256_cmp_pd(normalized, half, _CMP_LT_OQ));
+        missingDiff = _mm256_blendv_pd(missingDiff, one,
+                                       _mm256_and_pd(missing1, missing2));
+        diff = _mm256_blendv_pd(diff, missingDiff, anyMissing);
+      }
+      sums[part] = _mm256_add_pd(sums[part], diff);
+    }
+  }
+  double lanes[NUMERIC_KERNEL_LANES];
+  _mm256_storeu_pd(lanes, sums[0]);
+  _mm256_storeu_pd(lanes + 4, sums[1]);
+  return ReduceLanes(lanes);
+}
+
+// no fused multiply-adds, so the sums match the other kernels bit for bit
+template<bool euclidean, class Value>
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static double NumericDistanceAVX512(const NumericKernelArgs& args) {
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d half = _mm512_set1_pd(0.5);
+  const __m512d one = _mm512_set1_pd(1.0);
+  __m512d sum = zero;
+  for(unsigned int n = args.begin; n < args.end; n += NUMERIC_KERNEL_LANES) {
+    __m512d value1 = LoadAVX512((const Value*) args.values1 + n);
+    __m512d value2 = LoadAVX512((const Value*) args.values2 + n);
+    __m512d diff;
+    if(euclidean) {
+      diff = _mm512_maskz_sqrt_pd(ALL_AVX512_LANES,
+              _mm512_add_pd(_mm512_mul_pd(value1, value1),
+                            _mm512_mul_pd(value2, value2)));
+    } else {
+      diff = _mm512_mul_pd(_mm512_abs_pd(_mm512_sub_pd(value1, value2)),
+                           _mm512_loadu_pd(args.reciprocalRanges + n));
+    }
+    __mmask8 missing1 = _mm512_cmp_pd_mask(value1, value1, _CMP_UNORD_Q);
+    __mmask8 missing2 = _mm512_cmp_pd_mask(value2, value2, _CMP_UNORD_Q);
+    __mmask8 anyMissing = missing1 | missing2;
+    if(anyMissing) {
+      __m512d range = _mm512_loadu_pd(args.ranges + n);
+      __m512d present = _mm512_mask_blend_pd(missing1, value1, value2);
+      __m512d normalized = _mm512_div_pd(
+              _mm512_sub_pd(present, _mm512_loadu_pd(args.minimums + n)), range);
+      normalized = _mm512_mask_blend_pd(
+              _mm512_cmp_pd_mask(range, zero, _CMP_EQ_OQ), normalized, zero);
+      __m512d missingDiff = _mm512_mask_blend_pd(
+              _mm512_cmp_pd_mask(normalized, half, _CMP_LT_OQ), normalized,
+              _mm512_sub_pd(one, normalized));
+      missingDiff = _mm512_mask_blend_pd(missing1 & missing2, missingDiff, one);
+      diff = _mm512_mask_blend_pd(anyMissing, diff, missingDiff);
+    }
+    sum = _mm512_add_pd(sum, diff);
+  }
+  double lanes[NUMERIC_KERNEL_LANES];
+  _mm512_storeu_pd(lanes, sum);
+  return ReduceLanes(lanes);
+}
+
+#endif
+
+PackedNumerics::PackedNumerics() {
+  kernel = 0;
+  numInstances = 0;
+  numNumerics = 0;
+  rowStride = 0;
+  precision = DOUBLE_PRECISION;
+}
+
+PackedNumerics::~PackedNumerics() {
+}
+
+string PackedNumerics::KernelName() {
+#ifdef PACKED_NUMERICS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) {
+    return "avx512";
+  }
+  if(__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+  if(__builtin_cpu_supports("sse4.2")) {
+    return "sse4.2";
+  }
+#endif
+  return "scalar";
+}
+
+template<class Value>
+PackedNumerics::NumericKernel PackedNumerics::SelectKernel(
+        NumericMetricType metric) {
+  bool euclidean = (metric == EUCLIDEAN_NUMERIC_METRIC);
+#ifdef PACKED_NUMERICS_X86
+  string kernelName = KernelName();
+  if(kernelName == "avx512") {
+    return euclidean ? NumericDistanceAVX512<true, Value> :
+            NumericDistanceAVX512<false, Value>;
+  }
+  if(kernelName == "avx2") {
+    return euclidean ? NumericDistanceAVX2<true, Value> :
+            NumericDistanceAVX2<false, Value>;
+  }
+  if(kernelName == "sse4.2") {
+    return euclidean ? NumericDistanceSSE42<true, Value> :
+            NumericDistanceSSE42<false, Value>;
+  }
+#endif
+  return euclidean ? NumericDistanceScalar<true, Value> :
+          NumericDistanceScalar<false, Value>;
+}
+
+bool PackedNumerics::Pack(Dataset* ds,
+                          const vector<unsigned int>& instanceIndices,
+                          const vector<unsigned int>& numericIndices,
+                          NumericMetricType metric,
+                          DistancePrecision newPrecision) {
+  Clear();
+  if((metric != MANHATTAN_NUMERIC_METRIC) &&
+     (metric != EUCLIDEAN_NUMERIC_METRIC)) {
+    return false;
+  }
+
+  numInstances = instanceIndices.size();
+  numNumerics = numericIndices.size();
+  rowStride = ((numNumerics + NUMERIC_KERNEL_LANES - 1) /
+          NUMERIC_KERNEL_LANES) * NUMERIC_KERNEL_LANES;
+  // padding columns are present zeros with a zero range: a zero diff
+  minimums.resize(rowStride, 0.0);
+  ranges.resize(rowStride, 0.0);
+  reciprocalRanges.resize(rowStride, 0.0);
+  for(unsigned int numIdx = 0; numIdx < numNumerics; ++numIdx) {
+    pair<double, double> minMax =
+            ds->GetMinMaxForNumeric(numericIndices[numIdx]);
+    minimums[numIdx] = minMax.first;
+    ranges[numIdx] = minMax.second - minMax.first;
+    reciprocalRanges[numIdx] = 1.0 / ranges[numIdx];
+  }
+
+  precision = newPrecision;
+  if(precision == FLOAT_PRECISION) {
+    floatValues.resize((size_t) numInstances * rowStride, 0.0f);
+    PackValues(ds, instanceIndices, numericIndices, &floatValues[0]);
+    kernel = SelectKernel<float>(metric);
+  } else {
+    values.resize((size_t) numInstances * rowStride, 0.0);
+    PackValues(ds, instanceIndices, numericIndices, &values[0]);
+    kernel = SelectKernel<double>(metric);
+  }
+
+  return true;
+}
+
+template<class Value>
+void PackedNumerics::PackValues(Dataset* ds,
+                                const vector<unsigned int>& instanceIndices,
+                                const vector<unsigned int>& numericIndices,
+                                Value* packedValues) {
+  Value missingValue = numeric_limits<Value>::quiet_NaN();
+#pragma omp parallel for
+  for(int row = 0; row < (int) numInstances; ++row) {
+    DatasetInstance* dsi = ds->GetInstance(instanceIndices[row]);
+    Value* rowValues = &packedValues[(size_t) row * rowStride];
+    for(unsigned int numIdx = 0; numIdx < numNumerics; ++numIdx) {
+      NumericLevel thisValue = dsi->numerics[numericIndices[numIdx]];
+      rowValues[numIdx] = (thisValue == MISSING_NUMERIC_VALUE) ?
+              missingValue : (Value) thisValue;
+    }
+  }
+}
+
+void PackedNumerics::Clear() {
+  kernel = 0;
+  numInstances = 0;
+  numNumerics = 0;
+  rowStride = 0;
+  precision = DOUBLE_PRECISION;
+  values.clear();
+  floatValues.clear();
+  minimums.clear();
+  ranges.clear();
+  reciprocalRanges.clear();
+}
+
+bool PackedNumerics::IsPacked() {
+  return kernel != 0;
+}
+
+unsigned int PackedNumerics::NumInstances() {
+  return numInstances;
+}
+
+unsigned int PackedNumerics::NumNumerics() {
+  return numNumerics;
+}
+
+unsigned int PackedNumerics::RowStride() {
+  return rowStride;
+}
+
+DistancePrecision PackedNumerics::Precision() {
+  return precision;
+}
+
+double PackedNumerics::Distance(unsigned int row1, unsigned int row2) {
+  double distance = 0.0;
+  for(unsigned int begin = 0; begin < rowStride;
+      begin += PACKED_NUMERICS_BLOCK) {
+    unsigned int end = begin + PACKED_NUMERICS_BLOCK;
+    if(end > rowStride) {
+      end = rowStride;
+    }
+    distance += Distance(row1, row2, begin, end);
+  }
+
+  return distance;
+}
+
+double PackedNumerics::Distance(unsigned int row1, unsigned int row2,
+                                unsigned int begin, unsigned int end) {
+  NumericKernelArgs args;
+  if(precision == FLOAT_PRECISION) {
+    args.values1 = &floatValues[(size_t) row1 * rowStride];
+    args.values2 = &floatValues[(size_t) row2 * rowStride];
+  } else {
+    args.values1 = &values[(size_t) row1 * rowStride];
+    args.values2 = &values[(size_t) row2 * rowStride];
+  }
+  args.minimums = &minimums[0];
+  args.ranges = &ranges[0];
+  args.reciprocalRanges = &reciprocalRanges[0];
+  args.begin = begin;
+  args.end = end;
+
+  return kernel(args);
+}
@@ -0,0 +1,145 @@
+/**
+ * \class PackedNumerics
+ *
+ * \brief Contiguous numerics for vectorized instance-to-instance distances.
+ *
+ * Numerics of the currently masked instances and numeric attributes are
+ * copied into one row per instance, padded to a multiple of eight values,
+ * with missing values stored as NaN. Rows are stored as doubles, or as
+ * floats in FLOAT_PRECISION mode; floats are widened to doubles before any
+ * arithmetic. Manhattan and Euclidean distances are
+ * computed over the rows by SSE4.2, AVX2 or AVX-512 kernels chosen for the
+ * CPU at run time, or by a portable scalar kernel. Missing values get the
+ * Weka-style diffs of CheckMissingNumeric().
+ *
+ * All kernels add the diffs in the same eight partial sums and reduce them in
+ * the same order, so distances are identical whichever kernel runs.
+ *
+ * \sa DistanceMetrics.h
+ */
+
+#ifndef PACKEDNUMERICS_H
+#define	PACKEDNUMERICS_H
+
+#include <string>
+#include <vector>
+
+#include "DistanceMetrics.h"
+#include "Insilico.h"
+
+class Dataset;
+
+/// numerics per block summed by one kernel call, a multiple of eight
+const unsigned int PACKED_NUMERICS_BLOCK = 256;
+
+/**
+ * \struct NumericKernelArgs.
+ * Two packed rows and the column range a numeric distance kernel sums.
+ */
+struct NumericKernelArgs
+{
+  /// values of instance 1, doubles or floats, NaN if missing
+  const void* values1;
+  /// values of instance 2, doubles or floats, NaN if missing
+  const void* values2;
+  /// per numeric: minimum value
+  const double* minimums;
+  /// per numeric: maximum minus minimum value
+  const double* ranges;
+  /// per numeric: 1 / range
+  const double* reciprocalRanges;
+  /// first column, a multiple of eight
+  unsigned int begin;
+  /// one past the last column, a multiple of eight
+  unsigned int end;
+};
+
+class PackedNumerics
+{
+public:
+  PackedNumerics();
+  ~PackedNumerics();
+  /*************************************************************************//**
+   * Return the name of the instruction set of the kernels this CPU runs.
+   * \return avx512, avx2, sse4.2 or scalar
+   ****************************************************************************/
+  static std::string KernelName();
+  /*************************************************************************//**
+   * Pack the numerics of the instances and numeric attributes passed.
+   * \param [in] ds pointer to a Dataset object
+   * \param [in] instanceIndices instance indices, one packed row each
+   * \param [in] numericIndices numeric indices to pack, in order
+   * \param [in] metric distance metric to compute
+   * \param [in] newPrecision store the values as doubles or floats
+   * \return success, false if the metric is unknown
+   ****************************************************************************/
+  bool Pack(Dataset* ds, const std::vector<unsigned int>& instanceIndices,
+            const std::vector<unsigned int>& numericIndices,
+            NumericMetricType metric,
+            DistancePrecision newPrecision = DOUBLE_PRECISION);
+  /// Release the packed numerics.
+  void Clear();
+  /// Are numerics packed and ready for distance calculations?
+  bool IsPacked();
+  /// Return the number of packed instances (rows).
+  unsigned int NumInstances();
+  /// Return the number of packed numerics.
+  unsigned int NumNumerics();
+  /// Return the number of values in each packed row, including padding.
+  unsigned int RowStride();
+  /// Return the precision of the packed values.
+  DistancePrecision Precision();
+  /*************************************************************************//**
+   * Compute the distance between two packed instances over all numerics,
+   * adding the sums of the PACKED_NUMERICS_BLOCK blocks in order.
+   * \param [in] row1 packed row of instance 1
+   * \param [in] row2 packed row of instance 2
+   * \return distance, the sum of numeric diffs
+   ****************************************************************************/
+  double Distance(unsigned int row1, unsigned int row2);
+  /*************************************************************************//**
+   * Compute the distance between two packed instances over a range of
+   * numerics.
+   * \param [in] row1 packed row of instance 1
+   * \param [in] row2 packed row of instance 2
+   * \param [in] begin first numeric, a multiple of eight
+   * \param [in] end one past the last numeric, a multiple of eight, or the
+   *                 row stride
+   * \return sum of the numeric diffs in [begin, end)
+   ****************************************************************************/
+  double Distance(unsigned int row1, unsigned int row2, unsigned int begin,
+                  unsigned int end);
+private:
+  /// distance kernel for one metric and instruction set
+  typedef double (*NumericKernel)(const NumericKernelArgs& args);
+  /// return the fastest kernel for a metric and value type this CPU runs
+  template<class Value>
+  static NumericKernel SelectKernel(NumericMetricType metric);
+  /// copy the numerics into rows of doubles or floats
+  template<class Value>
+  void PackValues(Dataset* ds, const std::vector<unsigned int>& instanceIndices,
+                  const std::vector<unsigned int>& numericIndices,
+                  Value* packedValues);
+  /// kernel of the packed metric, or NULL if not packed
+  NumericKernel kernel;
+  /// number of rows
+  unsigned int numInstances;
+  /// number of numerics in each row
+  unsigned int numNumerics;
+  /// values per row, numNumerics rounded up to a multiple of eight
+  unsigned int rowStride;
+  /// values stored as doubles or floats
+  DistancePrecision precision;
+  /// [row][numeric] values, NaN if missing, 0 padding
+  std::vector<double> values;
+  /// [row][numeric] values in FLOAT_PRECISION mode
+  std::vector<float> floatValues;
+  /// per numeric: minimum value
+  std::vector<double> minimums;
+  /// per numeric: maximum minus minimum value
+  std::vector<double> ranges;
+  /// per numeric: 1 / range, 0 padding
+  std::vector<double> reciprocalRanges;
+};
+
+#endif	/* PACKEDNUMERICS_H */
@@ -0,0 +1,116 @@
+/*
+ * PhiloxRandom.cpp
+ *
+ * Counter-based Philox4x32-10 random number generator.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "PhiloxRandom.h"
+
+using namespace std;
+
+/// Philox4x32 round multipliers and Weyl sequence key increments
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+static const unsigned int PHILOX_ROUNDS = 10;
+static const uint64_t NO_BLOCK = ~(uint64_t) 0;
+
+PhiloxRandom::PhiloxRandom(uint64_t seedVal, uint64_t streamVal) {
+  Reset(seedVal, streamVal);
+}
+
+void PhiloxRandom::Reset(uint64_t seedVal, uint64_t streamVal) {
+  key[0] = (uint32_t) seedVal;
+  key[1] = (uint32_t) (seedVal >> 32);
+  stream = streamVal;
+  position = 0;
+  blockIndex = NO_BLOCK;
+}
+
+uint64_t PhiloxRandom::Seed() const {
+  return ((uint64_t) key[1] << 32) | key[0];
+}
+
+uint64_t PhiloxRandom::Stream() const {
+  return stream;
+}
+
+void PhiloxRandom::Seek(uint64_t newPosition) {
+  position = newPosition;
+}
+
+uint64_t PhiloxRandom::Position() const {
+  return position;
+}
+
+uint32_t PhiloxRandom::NextUInt32() {
+  uint64_t thisBlock = position >> 2;
+  if(thisBlock != blockIndex) {
+    uint32_t counter[4];
+    counter[0] = (uint32_t) thisBlock;
+    counter[1] = (uint32_t) (thisBlock >> 32);
+    counter[2] = (uint32_t) stream;
+    counter[3] = (uint32_t) (stream >> 32);
+    Block(key, counter, block);
+    blockIndex = thisBlock;
+  }
+  return block[position++ & 3];
+}
+
+double PhiloxRandom::NextUniform() {
+  uint32_t high = NextUInt32() >> 5;
+  uint32_t low = NextUInt32() >> 6;
+  return (high * 67108864.0 + low) * (1.0 / 9007199254740992.0);
+}
+
+unsigned int PhiloxRandom::NextIndex(unsigned int n) {
+  // reject the values below 2^32 mod n so every index has equal weight
+  uint32_t threshold = (uint32_t) (0u - (uint32_t) n) % (uint32_t) n;
+  uint32_t value = NextUInt32();
+  while(value < threshold) {
+    value = NextUInt32();
+  }
+  return value % n;
+}
+
+void PhiloxRandom::PartialShuffle(unsigned int numPicks,
+                                  vector<unsigned int>& values) {
+  unsigned int numValues = values.size();
+  for(unsigned int i = 0; (i < numPicks) && (i < numValues); ++i) {
+    unsigned int pick = i + NextIndex(numValues - i);
+    swap(values[i], values[pick]);
+  }
+}
+
+void PhiloxRandom::Block(const uint32_t key[2], const uint32_t counter[4],
+                         uint32_t output[4]) {
+  uint32_t k0 = key[0];
+  uint32_t k1 = key[1];
+  uint32_t c0 = counter[0];
+  uint32_t c1 = counter[1];
+  uint32_t c2 = counter[2];
+  uint32_t c3 = counter[3];
+  for(unsigned int round = 0; round < PHILOX_ROUNDS; ++round) {
+    uint64_t product0 = (uint64_t) PHILOX_M0 * c0;
+    uint64_t product1 = (uint64_t) PHILOX_M1 * c2;
+    uint32_t hi0 = (uint32_t) (product0 >> 32);
+    uint32_t lo0 = (uint32_t) product0;
+    uint32_t hi1 = (uint32_t) (product1 >> 32);
+    uint32_t lo1 = (uint32_t) product1;
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
@@ -0,0 +1,95 @@
+/**
+ * \class PhiloxRandom
+ *
+ * \brief Counter-based Philox4x32-10 random number generator.
+ *
+ * Random numbers are a pure function of (seed, stream, position): the seed
+ * is the cipher key and each 128-bit counter is the 64-bit stream number
+ * followed by the 64-bit block position, encrypted by ten Philox rounds
+ * into four 32-bit outputs. Streams of the same seed are independent, so
+ * every thread, permutation or bootstrap replicate can own one and draw
+ * the same numbers regardless of how work is scheduled, and any stream can
+ * seek to an arbitrary position without generating the numbers before it.
+ *
+ * Salmon, Moraes, Dror and Shaw, "Parallel Random Numbers: As Easy as 1, 2,
+ * 3", SC11.
+ */
+
+#ifndef PHILOXRANDOM_H
+#define	PHILOXRANDOM_H
+
+#include <vector>
+#include <stdint.h>
+
+class PhiloxRandom
+{
+public:
+  /*************************************************************************//**
+   * Construct a generator positioned at the start of a stream.
+   * \param [in] seedVal seed shared by all streams
+   * \param [in] streamVal stream number
+   ****************************************************************************/
+  PhiloxRandom(uint64_t seedVal = 0, uint64_t streamVal = 0);
+  /*************************************************************************//**
+   * Rekey the generator and rewind it to the start of a stream.
+   * \param [in] seedVal seed shared by all streams
+   * \param [in] streamVal stream number
+   ****************************************************************************/
+  void Reset(uint64_t seedVal, uint64_t streamVal);
+  /// Get the seed
+  uint64_t Seed() const;
+  /// Get the stream number
+  uint64_t Stream() const;
+  /*************************************************************************//**
+   * Move to a position in the stream in O(1).
+   * \param [in] newPosition number of 32-bit values drawn before the next one
+   ****************************************************************************/
+  void Seek(uint64_t newPosition);
+  /// Get the number of 32-bit values drawn so far
+  uint64_t Position() const;
+  /*************************************************************************//**
+   * Next uniformly distributed 32-bit value.
+   * \return random value
+   ****************************************************************************/
+  uint32_t NextUInt32();
+  /*************************************************************************//**
+   * Next uniformly distributed double in [0, 1) with 53 random bits; draws
+   * two 32-bit values.
+   * \return random value
+   ****************************************************************************/
+  double NextUniform();
+  /*************************************************************************//**
+   * Next uniformly distributed index in [0, n) without modulo bias.
+   * \param [in] n number of indices, greater than zero
+   * \return random index
+   ****************************************************************************/
+  unsigned int NextIndex(unsigned int n);
+  /*************************************************************************//**
+   * Choose numPicks of values without replacement by a partial Fisher-Yates
+   * shuffle; the picks are moved to the front of values in draw order.
+   * \param [in] numPicks number of values to choose, at most values.size()
+   * \param [in, out] values values to choose from
+   ****************************************************************************/
+  void PartialShuffle(unsigned int numPicks, std::vector<unsigned int>& values);
+  /*************************************************************************//**
+   * Encrypt one counter block with Philox4x32-10.
+   * \param [in] key 64-bit key
+   * \param [in] counter 128-bit counter
+   * \param [out] output four random 32-bit values
+   ****************************************************************************/
+  static void Block(const uint32_t key[2], const uint32_t counter[4],
+                    uint32_t output[4]);
+private:
+  /// key words from the seed
+  uint32_t key[2];
+  /// stream number, the high half of the counter
+  uint64_t stream;
+  /// number of 32-bit values drawn so far
+  uint64_t position;
+  /// encrypted block holding the value at position
+  uint32_t block[4];
+  /// block position encrypted into block; -1 if none yet
+  uint64_t blockIndex;
+};
+
+#endif	/* PHILOXRANDOM_H */
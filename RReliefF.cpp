@@ -7,15 +7,20 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include "ReliefF.h"
 #include "RReliefF.h"
 #include "Dataset.h"
+#include "NeighborTable.h"
 #include "DistanceMetrics.h"
 #include "Insilico.h"
 
 using namespace std;
 
+/// attributes per block of the parallel weight update
+static const unsigned int REGRESSION_SCORES_BLOCK = 64;
+
 RReliefF::RReliefF(Dataset* ds) :
 		ReliefF::ReliefF(ds, REGRESSION_ANALYSIS) {
 	cout << Timestamp() << "RReliefF initialization" << endl;
@@ -49,6 +54,11 @@ RReliefF::RReliefF(Dataset* ds, ConfigMap& configMap) :
 RReliefF::~RReliefF() {
 }
 
+bool RReliefF::ComputeScoresForKs(const vector<unsigned int>& ks,
+		vector<AttributeScores>& kScores) {
+	return AttributeRanker::ComputeScoresForKs(ks, kScores);
+}
+
 bool RReliefF::ComputeAttributeScores() {
 
 	// precompute all instance-to-instance distances and get nearest neighbors
@@ -57,6 +67,20 @@ bool RReliefF::ComputeAttributeScores() {
 	// results are stored in scores
 	W.resize(dataset->NumVariables(), 0.0);
 
+	// one weight update loop specialized for the SNP and numeric metrics
+	MetricContext context = dataset->GetMetricContext(snpMetric);
+	RegressionScoresKernels::Kernel kernel = SelectMetricKernel<
+			RegressionScoresKernels>(snpMetricType, numMetricType,
+			context.snpDiffTables != 0);
+
+	return (this->*kernel)(context);
+}
+
+template<class SnpMetric, class NumericMetric>
+bool RReliefF::ComputeRegressionScoresKernel(const MetricContext& context) {
+	SnpMetric snpDiff(context);
+	NumericMetric numDiff(context);
+
 	// using pseudocode notation from paper
 	/**
 	 * Used to hold the probability of a different class val given nearest
@@ -76,22 +100,75 @@ bool RReliefF::ComputeAttributeScores() {
 	vector<double> ndcda;
 	ndcda.resize(dataset->NumVariables(), 0.0);
 
-	// pointer to the instance being sampled
-	DatasetInstance* R_i = NULL;
+	// look up the sampled instances' neighbors and phenotype diffs once
 	cout << Timestamp() << "Running RRelief-F algorithm: ";
-	vector<string> instanceIds = dataset->GetInstanceIds();
-	for (int i = 0; i < (int) m; i++) {
-
-		if (randomlySelect) {
-			// randomly sample an instance (without replacement?)
-			R_i = dataset->GetRandomInstance();
-		} else {
-			// deterministic/indexed instance sampling, ie, every instance against
-			// every other instance
-			unsigned int instanceIndex;
-			dataset->GetInstanceIndexForID(instanceIds[i], instanceIndex);
-			R_i = dataset->GetInstance(instanceIndex);
+	RegressionNeighbors neighbors;
+	if (!LookUpRegressionNeighbors(neighbors)) {
+		return false;
+	}
+
+	// the class diffs are summed in sample and neighbor order
+	for (unsigned int i = 0; i < m; i++) {
+		for (unsigned int j = 0; j < k; ++j) {
+			ndc += (neighbors.phenotypeDiffs[i * k + j]
+					* neighbors.influenceFactors[j]);
 		}
+	}
+
+	unsigned int numVariables = dataset->NumVariables();
+	if (ParallelOverInstances()) {
+		// each chunk of sampled instances accumulates its own estimates
+		unsigned int numChunks = NumSampleChunks();
+		cout << "over " << numChunks << " chunks of sampled instances" << endl;
+		vector<vector<double> > chunkNda(numChunks,
+				vector<double>(numVariables, 0.0));
+		vector<vector<double> > chunkNdcda(chunkNda);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int chunk = 0; chunk < (int) numChunks; ++chunk) {
+			unsigned int begin = 0, end = 0;
+			SampleChunkRange(chunk, begin, end);
+			AccumulateRegressionDiffs(snpDiff, numDiff, neighbors, begin, end, 0,
+					numVariables, chunkNda[chunk], chunkNdcda[chunk]);
+		}
+		SumChunkScores(chunkNda);
+		SumChunkScores(chunkNdcda);
+		nda.swap(chunkNda[0]);
+		ndcda.swap(chunkNdcda[0]);
+	} else {
+		// each block of attributes accumulates its own estimates
+		unsigned int numBlocks = (numVariables + REGRESSION_SCORES_BLOCK - 1)
+				/ REGRESSION_SCORES_BLOCK;
+		cout << "over " << numBlocks << " blocks of " << REGRESSION_SCORES_BLOCK
+				<< " attributes" << endl;
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int block = 0; block < (int) numBlocks; ++block) {
+			unsigned int begin = block * REGRESSION_SCORES_BLOCK;
+			unsigned int end = min(begin + REGRESSION_SCORES_BLOCK, numVariables);
+			AccumulateRegressionDiffs(snpDiff, numDiff, neighbors, 0, m, begin,
+					end, nda, ndcda);
+		}
+	}
+	cout << Timestamp() << m << "/" << m << " done" << endl;
+
+	cout << Timestamp() << "Computing final scores" << endl;
+	for (unsigned int A = 0; A < numVariables; ++A) {
+		W[A] = (ndcda[A] / ndc) - ((nda[A] - ndcda[A]) / ((double) m - ndc));
+	}
+
+	return true;
+}
+
+bool RReliefF::LookUpRegressionNeighbors(RegressionNeighbors& neighbors) {
+	const NeighborTable& neighborTable = dataset->GetNeighborTable();
+	const vector<unsigned int>& sampleIndices = sampledInstanceIndices;
+	neighbors.sampleInstances.resize(m);
+	neighbors.neighborInstances.resize(m * k);
+	neighbors.phenotypeDiffs.resize(m * k);
+	for (unsigned int i = 0; i < m; i++) {
+
+		// sampled by SampleInstances
+		unsigned int instanceIndex = sampleIndices[i];
+		DatasetInstance* R_i = dataset->GetInstance(instanceIndex);
 		if (!R_i) {
 			cerr
 					<< "ERROR: Random or indexed instance count not be found for index: ["
@@ -100,77 +177,69 @@ bool RReliefF::ComputeAttributeScores() {
 		}
 
 		// K NEAREST NEIGHBORS
-		// find k nearest neighbors
-		vector<unsigned int> nNearestNeighbors;
-		bool canGetNeighbors = R_i->GetNNearestInstances(k, nNearestNeighbors);
-		if (!canGetNeighbors) {
-			cerr << "ERROR: relieff cannot get " << k << " nearest neighbors" << endl;
-			return false;
-		}
-		// check algorithm preconditions
-		if (nNearestNeighbors.size() < 1) {
+		unsigned int numNeighbors = neighborTable.NumNeighbors(instanceIndex, 0);
+		if (numNeighbors < 1) {
 			cerr << "ERROR: No nearest hits found" << endl;
 			return false;
 		}
-		if (nNearestNeighbors.size() < k) {
+		if (numNeighbors < k) {
 			cerr << "ERROR: Could not find enough neighbors" << endl;
 			return false;
 		}
 
-		// update: using pseudocode notation
+		neighbors.sampleInstances[i] = R_i;
+		const unsigned int* nNearestNeighbors = neighborTable.Neighbors(
+				instanceIndex, 0);
 		for (unsigned int j = 0; j < k; ++j) {
-			// get the jth nearest neighbor
 			DatasetInstance* I_j = dataset->GetInstance(nNearestNeighbors[j]);
-			double diffPredicted = diffPredictedValueTau(R_i, I_j);
-			double d_ij = R_i->GetInfluenceFactorD(j);
-			ndc += (diffPredicted * d_ij);
-			unsigned int scoresIndex = 0;
+			neighbors.neighborInstances[i * k + j] = I_j;
+			neighbors.phenotypeDiffs[i * k + j] = diffPredictedValueTau(R_i, I_j);
+		}
+	}
+	ComputeInfluenceFactors(neighbors.influenceFactors);
+	neighbors.attributeIndices = dataset->MaskGetAttributeIndices(
+			DISCRETE_TYPE);
+	neighbors.numericIndices = dataset->MaskGetAttributeIndices(NUMERIC_TYPE);
+
+	return true;
+}
+
+template<class SnpMetric, class NumericMetric>
+void RReliefF::AccumulateRegressionDiffs(const SnpMetric& snpDiff,
+		const NumericMetric& numDiff, const RegressionNeighbors& neighbors,
+		unsigned int sampleBegin, unsigned int sampleEnd,
+		unsigned int scoresBegin, unsigned int scoresEnd, vector<double>& nda,
+		vector<double>& ndcda) {
+	// scores are the attributes, then the numerics
+	const vector<unsigned int>& attributeIndicies = neighbors.attributeIndices;
+	const vector<unsigned int>& numericIndices = neighbors.numericIndices;
+	unsigned int numAttributes = neighbors.attributeIndices.size();
+	unsigned int attributesEnd = min(scoresEnd, numAttributes);
+	unsigned int numericsBegin = max(scoresBegin, numAttributes);
+	for (unsigned int i = sampleBegin; i < sampleEnd; i++) {
+		DatasetInstance* R_i = neighbors.sampleInstances[i];
+
+		// update: using pseudocode notation
+		for (unsigned int j = 0; j < k; ++j) {
+			DatasetInstance* I_j = neighbors.neighborInstances[i * k + j];
+			double diffPredicted = neighbors.phenotypeDiffs[i * k + j];
+			double d_ij = neighbors.influenceFactors[j];
 			// attributes
-			vector<unsigned int> attributeIndicies =
-					dataset->MaskGetAttributeIndices(DISCRETE_TYPE);
-			for (unsigned int attrIdx = 0; attrIdx < attributeIndicies.size();
-					++attrIdx) {
-				unsigned int A = attributeIndicies[attrIdx];
-				double attrScore = snpDiff(A, R_i, I_j) * d_ij;
+			for (unsigned int scoresIndex = scoresBegin;
+					scoresIndex < attributesEnd; ++scoresIndex) {
+				unsigned int A = attributeIndicies[scoresIndex];
+				double attrScore = snpDiff.Diff(A, R_i, I_j) * d_ij;
 				nda[scoresIndex] += attrScore;
 				ndcda[scoresIndex] += (diffPredicted * attrScore);
-//        cout << "(i, j) = (" << i << "," << j << ") =>"
-//                << " diff predicted: " << diffPredicted
-//                << ", d_ij: " << d_ij
-//                << ", ndc: " << ndc
-//                << ", A: " << A
-//                << ", snpDiff: " << snpDiff(A, R_i, I_j)
-//                << ", nda[A}: " << nda[scoresIndex]
-//                << " ndcda[A]: " << ndcda[scoresIndex]
-//                << endl;
-				++scoresIndex;
 			}
 			// numerics
-			vector<unsigned int> numericIndices = dataset->MaskGetAttributeIndices(
-					NUMERIC_TYPE);
-			for (unsigned int numIdx = 0; numIdx < numericIndices.size(); ++numIdx) {
-				unsigned int N = numericIndices[numIdx];
-				double numScore = numDiff(N, R_i, I_j) * d_ij;
+			for (unsigned int scoresIndex = numericsBegin; scoresIndex < scoresEnd;
+					++scoresIndex) {
+				unsigned int N = numericIndices[scoresIndex - numAttributes];
+				double numScore = numDiff.Diff(N, R_i, I_j) * d_ij;
 				nda[scoresIndex] += numScore;
 				ndcda[scoresIndex] += (diffPredicted * numScore);
-				++scoresIndex;
 			}
-//      cout << "******************************" << endl;
-		}
-
-//    cout << "--------------------------------------------------" << endl;
-
-		// happy lights
-		if (i && ((i % 100) == 0)) {
-			cout << Timestamp() << i << "/" << m << endl;
 		}
 	}
-	cout << Timestamp() << m << "/" << m << " done" << endl;
-
-	cout << Timestamp() << "Computing final scores" << endl;
-	for (unsigned int A = 0; A < dataset->NumVariables(); ++A) {
-		W[A] = (ndcda[A] / ndc) - ((nda[A] - ndcda[A]) / ((double) m - ndc));
-	}
-
-	return true;
 }
@@ -30,6 +30,28 @@
 
 namespace po = boost::program_options;
 
+/**
+ * \struct RegressionNeighbors.
+ * The k nearest neighbors of the m sampled instances, flattened for the
+ * RReliefF weight update: per (sample, neighbor) pair, sample * k + rank,
+ * the neighbor and the phenotype diff.
+ */
+struct RegressionNeighbors
+{
+  /// per sample: sampled instance
+  std::vector<DatasetInstance*> sampleInstances;
+  /// per pair: neighbor instance
+  std::vector<DatasetInstance*> neighborInstances;
+  /// per pair: diff of the sampled instance's and neighbor's phenotypes
+  std::vector<double> phenotypeDiffs;
+  /// per neighbor rank: influence factor, the same for all samples
+  std::vector<double> influenceFactors;
+  /// attribute indices, in scores order
+  std::vector<unsigned int> attributeIndices;
+  /// numeric indices, in scores order after the attributes
+  std::vector<unsigned int> numericIndices;
+};
+
 class RReliefF : public ReliefF
 {
 public:
@@ -51,7 +73,68 @@ public:
    ****************************************************************************/
   RReliefF(Dataset* ds, ConfigMap& configMap);
   bool ComputeAttributeScores();
+  /*************************************************************************//**
+   * Score one k at a time. RReliefF weights are ratios of neighbor sums,
+   * and the distance factors in those sums change with k.
+   * \param [in] ks values of k, ascending
+   * \param [out] kScores scores for each k
+   * \return success
+   ****************************************************************************/
+  bool ComputeScoresForKs(const std::vector<unsigned int>& ks,
+                          std::vector<AttributeScores>& kScores);
   virtual ~RReliefF();
+protected:
+  /*************************************************************************//**
+   * Accumulate the RReliefF probability estimates of the m sampled instances
+   * and compute the attribute scores W, specialized for the SNP and numeric
+   * metric policies. Runs in parallel over blocks of attributes or, see
+   * ParallelOverInstances, chunks of sampled instances.
+   * \param [in] context data set state read by the metric policies
+   * \return success
+   ****************************************************************************/
+  template<class SnpMetric, class NumericMetric>
+  bool ComputeRegressionScoresKernel(const MetricContext& context);
+  /// ComputeRegressionScoresKernel instantiations for SelectMetricKernel
+  struct RegressionScoresKernels
+  {
+    typedef bool (RReliefF::*Kernel)(const MetricContext&);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &RReliefF::ComputeRegressionScoresKernel<SnpMetric, NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Look up the k nearest neighbors of the m sampled instances, their
+   * phenotype diffs and the influence factors.
+   * \param [out] neighbors sampled instances' neighbors
+   * \return success
+   ****************************************************************************/
+  bool LookUpRegressionNeighbors(RegressionNeighbors& neighbors);
+  /*************************************************************************//**
+   * Accumulate the attribute RReliefF probability estimates of a range of
+   * the sampled instances and their k nearest neighbors, for a range of the
+   * scores, attributes then numerics.
+   * \param [in] snpDiff SNP metric policy
+   * \param [in] numDiff numeric metric policy
+   * \param [in] neighbors sampled instances' neighbors
+   * \param [in] sampleBegin first sampled instance number
+   * \param [in] sampleEnd one past the last sampled instance number
+   * \param [in] scoresBegin first scores index
+   * \param [in] scoresEnd one past the last scores index
+   * \param [in,out] nda per attribute: probability of a different value
+   * \param [in,out] ndcda per attribute: probability of a different class
+   * value and a different attribute value
+   ****************************************************************************/
+  template<class SnpMetric, class NumericMetric>
+  void AccumulateRegressionDiffs(const SnpMetric& snpDiff,
+                                 const NumericMetric& numDiff,
+                                 const RegressionNeighbors& neighbors,
+                                 unsigned int sampleBegin,
+                                 unsigned int sampleEnd,
+                                 unsigned int scoresBegin,
+                                 unsigned int scoresEnd,
+                                 std::vector<double>& nda,
+                                 std::vector<double>& ndcda);
 private:  
 };
 
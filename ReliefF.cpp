@@ -14,6 +14,8 @@
 #include <iterator>
 #include <cmath>
 #include <sstream>
+#include <limits>
+#include <algorithm>
 
 #include <omp.h>
 
@@ -21,9 +23,16 @@
 
 #include "ReliefF.h"
 #include "Dataset.h"
+#include "PhiloxRandom.h"
+#include "DistanceMatrix.h"
+#include "GenotypeLsh.h"
+#include "VpTree.h"
+#include "PackedGenotypes.h"
 #include "DatasetInstance.h"
+#include "NeighborTable.h"
 #include "StringUtils.h"
 #include "DistanceMetrics.h"
+#include "BestN.h"
 #include "Insilico.h"
 
 namespace po = boost::program_options;
@@ -64,6 +73,177 @@ public:
   }
 };
 
+/// default largest distance matrix to store, MB
+static const unsigned int DEFAULT_DISTANCE_MEMORY_LIMIT = 4096;
+/// rows of distances computed at a time when streaming nearest neighbors
+static const unsigned int STREAMING_ROW_BLOCK = 64;
+/// rows whose neighbors a thread selects at a time
+static const unsigned int NEIGHBOR_ROW_CHUNK = 16;
+/// default genotypes sampled per LSH key
+static const unsigned int DEFAULT_LSH_KEY_SIZE = 10;
+/// random number stream of the LSH key samples, apart from the streams
+/// numbered from 0 for the data set, threads and replicates
+static const uint64_t LSH_RANDOM_STREAM = (uint64_t) 1 << 32;
+/// attributes whose scores a thread updates at a time
+static const unsigned int ATTRIBUTE_SCORES_BLOCK = 64;
+/// sampled instances whose scores a thread accumulates at a time when the
+/// weight update is parallel over instances
+static const unsigned int SAMPLE_CHUNK = 32;
+/// most attributes for a weight update parallel over instances
+static const unsigned int INSTANCE_PARALLEL_MAX_VARIABLES = 1024;
+/// 64-attribute words of packed genotypes whose gm scores a thread updates
+/// at a time
+static const unsigned int POPCOUNT_SCORES_BLOCK = 4;
+
+/// functor for candidate comparison by distance only, as in best_n, or by
+/// distance then instance mask position for nested k-prefixes
+class candidate_less {
+public:
+
+  candidate_less(bool byPositionVal = false) : byPosition(byPositionVal) {
+  }
+
+  bool operator()(const NeighborCandidate& a,
+          const NeighborCandidate& b) const {
+    if(byPosition) {
+      return(a < b);
+    }
+    return(a.first < b.first);
+  }
+private:
+  bool byPosition;
+};
+
+/// best k candidates of one class, added in instance mask order
+typedef best_n_accumulator<NeighborCandidate, candidate_less>
+NeighborCandidates;
+
+/// nearest neighbor candidates of one instance
+struct InstanceNeighbors
+{
+  /// candidates by neighbor table slot
+  vector<NeighborCandidates> slots;
+  /// k + 1 smallest distances by neighbor table slot, max heaps
+  vector<vector<double> > slotDistances;
+};
+
+/// keep the size smallest distances seen in a max heap
+static void AddBoundaryDistance(vector<double>& heap, unsigned int size,
+        double distance) {
+  if(heap.size() < size) {
+    heap.push_back(distance);
+    push_heap(heap.begin(), heap.end());
+  } else {
+    if(distance < heap.front()) {
+      pop_heap(heap.begin(), heap.end());
+      heap.back() = distance;
+      push_heap(heap.begin(), heap.end());
+    }
+  }
+}
+
+/// add instance j as a nearest neighbor candidate of one instance
+static void AddNeighborCandidate(InstanceNeighbors& neighbors,
+        unsigned int k, unsigned int j, double distance, unsigned int slot) {
+  neighbors.slots[slot].add(make_pair(distance, j));
+  AddBoundaryDistance(neighbors.slotDistances[slot], k + 1, distance);
+}
+
+/// get the instance index and neighbor table slot of each masked instance
+static void GetNeighborTableRows(Dataset* ds,
+        const vector<string>& instanceIds,
+        vector<unsigned int>& instanceIndices, vector<unsigned int>& slots) {
+  const NeighborTable& neighborTable = ds->GetNeighborTable();
+  instanceIndices.resize(instanceIds.size());
+  slots.resize(instanceIds.size());
+  for(unsigned int i = 0; i < instanceIds.size(); ++i) {
+    ds->GetInstanceIndexForID(instanceIds[i], instanceIndices[i]);
+    slots[i] = neighborTable.ClassSlot(
+            ds->GetInstance(instanceIndices[i])->GetClass());
+  }
+}
+
+/// store the selected candidates of a row in the neighbor table, sorted by
+/// distance then instance ID for continuous phenotypes and nested k-prefixes
+static void StoreNeighbors(NeighborTable& neighborTable, unsigned int row,
+        const InstanceNeighbors& neighbors, bool sortByDistance,
+        const vector<unsigned int>& instanceIndices,
+        vector<NeighborCandidate>& sorted) {
+  for(unsigned int slot = 0; slot < neighbors.slots.size(); ++slot) {
+    const vector<NeighborCandidate>& best = neighbors.slots[slot].values();
+    if(!sortByDistance) {
+      neighborTable.SetNeighbors(row, slot, best, instanceIndices);
+      continue;
+    }
+    // candidate positions follow the sorted instance IDs of the mask
+    sorted.assign(best.begin(), best.end());
+    sort(sorted.begin(), sorted.end());
+    neighborTable.SetNeighbors(row, slot, sorted, instanceIndices);
+  }
+}
+
+/// neighborhood distance threshold of each row from its distance sums, as
+/// the distance matrix Mean, RowMean and RowStandardDeviation give them
+static void RadiusThresholds(const string& neighborhood,
+        const vector<double>& rowSums, const vector<double>& rowSquareSums,
+        vector<double>& thresholds) {
+  unsigned int numInstances = rowSums.size();
+  thresholds.assign(numInstances, 0.0);
+  if(numInstances < 2) {
+    return;
+  }
+  if(neighborhood == "multisurf") {
+    for(unsigned int i = 0; i < numInstances; ++i) {
+      double mean = rowSums[i] / (numInstances - 1);
+      double variance = rowSquareSums[i] / (numInstances - 1) - mean * mean;
+      thresholds[i] = mean - ((variance > 0.0) ? sqrt(variance) : 0.0) / 2.0;
+    }
+  } else {
+    // every distance is in two rows
+    double sum = 0.0;
+    for(unsigned int i = 0; i < numInstances; ++i) {
+      sum += rowSums[i];
+    }
+    thresholds.assign(numInstances,
+                      sum / ((double) numInstances * (numInstances - 1)));
+  }
+}
+
+/// add the diffs of one attribute between a sampled instance and its
+/// neighbors, nearest first, to the unaveraged score of each k once the k-th
+/// neighbor is reached
+template<class Metric>
+static void AddRankedDiffs(const Metric& metric, unsigned int A,
+        const SampledNeighbors& sample, const vector<unsigned int>& ks,
+        vector<double>& missSums, vector<vector<double> >& kW,
+        unsigned int scoresIdx) {
+  double hitSum = 0.0;
+  fill(missSums.begin(), missSums.begin() + sample.numMissClasses, 0.0);
+  unsigned int kIdx = 0;
+  for(unsigned int j = 0; kIdx < ks.size(); ++j) {
+    hitSum += metric.Diff(A, sample.instance, sample.hits[j]);
+    for(unsigned int c = 0; c < sample.numMissClasses; ++c) {
+      missSums[c] += metric.Diff(A, sample.instance, sample.misses[c][j]);
+    }
+    if(j + 1 == ks[kIdx]) {
+      double missSum = 0.0;
+      for(unsigned int c = 0; c < sample.numMissClasses; ++c) {
+        missSum += sample.missFactors[c] * missSums[c];
+      }
+      kW[kIdx][scoresIdx] += missSum - hitSum;
+      ++kIdx;
+    }
+  }
+}
+
+/// averaging factor of a neighbor set: 1/(m*size), 0 for an empty set
+static double AveragingFactor(unsigned int m, unsigned int setSize) {
+  if(!setSize) {
+    return 0.0;
+  }
+  return 1.0 / (((double) m) * ((double) setSize));
+}
+
 ReliefF::ReliefF(Dataset* ds, AnalysisType anaType) :
 AttributeRanker::AttributeRanker(ds) {
   cout << Timestamp() << "ReliefF default initialization without "
@@ -75,14 +255,24 @@ AttributeRanker::AttributeRanker(ds) {
     exit(-1);
   }
   analysisType = anaType;
+  neighborGapsK = 0;
+  neighborsNested = false;
+  distanceMemoryLimit = DEFAULT_DISTANCE_MEMORY_LIMIT;
+  neighborhood = "knn";
+  neighborSearch = "exact";
+  sampling = "random";
+  neighborsSaved = false;
+  lshTables = 0;
+  lshKeySize = DEFAULT_LSH_KEY_SIZE;
+  lshVerifyRecall = 0;
   m = dataset->NumInstances();
   SetK(10);
 
   weightByDistanceMethod = "equal";
   snpMetric = "gm";
-  snpDiff = diffGMM;
+  snpMetricType = GM_SNP_METRIC;
   numMetric = "manhattan";
-  numDiff = diffManhattan;
+  numMetricType = MANHATTAN_NUMERIC_METRIC;
   removePerIteration = 0;
 
   cout << Timestamp() << "Number of samples: m = " << m << endl;
@@ -94,7 +284,8 @@ AttributeRanker::AttributeRanker(ds) {
     randomlySelect = false;
     m = ds->NumInstances();
   } else {
-    cout << Timestamp() << "Sampling instances randomly" << endl;
+    cout << Timestamp() << "Sampling instances randomly: " << sampling
+            << endl;
     randomlySelect = true;
   }
 
@@ -127,6 +318,16 @@ AttributeRanker::AttributeRanker(ds) {
     exit(-1);
   }
   analysisType = anaType;
+  neighborGapsK = 0;
+  neighborsNested = false;
+  distanceMemoryLimit = DEFAULT_DISTANCE_MEMORY_LIMIT;
+  neighborhood = "knn";
+  neighborSearch = "exact";
+  sampling = "random";
+  neighborsSaved = false;
+  lshTables = 0;
+  lshKeySize = DEFAULT_LSH_KEY_SIZE;
+  lshVerifyRecall = 0;
 
   if(vm.count("number-random-samples")) {
     m = vm["number-random-samples"].as<unsigned int>();
@@ -190,6 +391,62 @@ AttributeRanker::AttributeRanker(ds) {
             << endl;
   }
 
+  if(vm.count("distance-memory-limit")) {
+    distanceMemoryLimit = vm["distance-memory-limit"].as<unsigned int>();
+  }
+
+  if(vm.count("neighborhood")) {
+    neighborhood = vm["neighborhood"].as<string>();
+    if((neighborhood != "knn") && (neighborhood != "surf") &&
+       (neighborhood != "multisurf")) {
+      cerr << "ERROR: unrecognized neighborhood: " << neighborhood << endl;
+      exit(-1);
+    }
+    cout << Timestamp() << "Neighborhood: " << neighborhood << endl;
+  }
+  if(vm.count("neighbor-search")) {
+    neighborSearch = vm["neighbor-search"].as<string>();
+    if((neighborSearch != "exact") && (neighborSearch != "vptree")) {
+      cerr << "ERROR: unrecognized nearest neighbor search: "
+              << neighborSearch << endl;
+      exit(-1);
+    }
+    cout << Timestamp() << "Nearest neighbor search: " << neighborSearch
+            << endl;
+  }
+  if(vm.count("sampling")) {
+    sampling = vm["sampling"].as<string>();
+    if((sampling != "random") && (sampling != "stratified")) {
+      cerr << "ERROR: unrecognized instance sampling: " << sampling << endl;
+      exit(-1);
+    }
+  }
+  if(vm.count("save-neighbors")) {
+    saveNeighborsFilename = vm["save-neighbors"].as<string>();
+  }
+  if(vm.count("load-neighbors")) {
+    loadNeighborsFilename = vm["load-neighbors"].as<string>();
+  }
+  if(vm.count("lsh-tables")) {
+    lshTables = vm["lsh-tables"].as<unsigned int>();
+  }
+  if(vm.count("lsh-key-snps")) {
+    lshKeySize = vm["lsh-key-snps"].as<unsigned int>();
+  }
+  if(vm.count("lsh-verify-recall")) {
+    lshVerifyRecall = vm["lsh-verify-recall"].as<unsigned int>();
+  }
+  if(lshTables && (!lshKeySize ||
+                   (lshKeySize > GENOTYPE_LSH_MAX_KEY_ATTRIBUTES))) {
+    cerr << "ERROR: LSH key SNPs [" << lshKeySize << "] not in valid range 1 to "
+            << GENOTYPE_LSH_MAX_KEY_ATTRIBUTES << endl;
+    exit(-1);
+  }
+  if(lshTables) {
+    cout << Timestamp() << "Approximate nearest neighbors from " << lshTables
+            << " LSH tables of " << lshKeySize << " SNPs" << endl;
+  }
+
   if(vm.count("normalize-scores")) {
     if(vm["normalize-scores"].as<unsigned int>()) {
       normalizeScores = true;
@@ -209,30 +466,31 @@ AttributeRanker::AttributeRanker(ds) {
     randomlySelect = false;
     m = ds->NumInstances();
   } else {
-    cout << Timestamp() << "Sampling instances randomly" << endl;
+    cout << Timestamp() << "Sampling instances randomly: " << sampling
+            << endl;
     randomlySelect = true;
   }
 
-  /// set the SNP metric function pointer
+  /// set the SNP metric type
   bool snpMetricFunctionUnset = true;
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "GM") {
-    snpDiff = diffGMM;
+    snpMetricType = GM_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "AM") {
-    snpDiff = diffAMM;
+    snpMetricType = AM_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "NCA") {
-    snpDiff = diffNCA;
+    snpMetricType = NCA_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "NCA6") {
-    snpDiff = diffNCA6;
+    snpMetricType = NCA6_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "KM") {
-    snpDiff = diffKM;
+    snpMetricType = KM_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset) {
@@ -241,10 +499,10 @@ AttributeRanker::AttributeRanker(ds) {
   }
 
   if(to_upper(numMetric) == "MANHATTAN") {
-    numDiff = diffManhattan;
+    numMetricType = MANHATTAN_NUMERIC_METRIC;
   } else {
     if(to_upper(numMetric) == "EUCLIDEAN") {
-      numDiff = diffEuclidean;
+      numMetricType = EUCLIDEAN_NUMERIC_METRIC;
     } else {
       cerr << "ERROR: [" << numMetric
               << "] is not a valid numeric metric type" << endl;
@@ -298,6 +556,16 @@ AttributeRanker::AttributeRanker(ds) {
     exit(-1);
   }
   analysisType = anaType;
+  neighborGapsK = 0;
+  neighborsNested = false;
+  distanceMemoryLimit = DEFAULT_DISTANCE_MEMORY_LIMIT;
+  neighborhood = "knn";
+  neighborSearch = "exact";
+  sampling = "random";
+  neighborsSaved = false;
+  lshTables = 0;
+  lshKeySize = DEFAULT_LSH_KEY_SIZE;
+  lshVerifyRecall = 0;
 
   string configValue;
 
@@ -338,6 +606,53 @@ AttributeRanker::AttributeRanker(ds) {
   } else {
     numMetric = "manhattan";
   }
+  if(GetConfigValue(configMap, "distance-memory-limit", configValue)) {
+    distanceMemoryLimit = lexical_cast<unsigned int>(configValue);
+  }
+  if(GetConfigValue(configMap, "neighborhood", configValue)) {
+    neighborhood = configValue;
+    if((neighborhood != "knn") && (neighborhood != "surf") &&
+       (neighborhood != "multisurf")) {
+      cerr << "ERROR: unrecognized neighborhood: " << neighborhood << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(GetConfigValue(configMap, "neighbor-search", configValue)) {
+    neighborSearch = configValue;
+    if((neighborSearch != "exact") && (neighborSearch != "vptree")) {
+      cerr << "ERROR: unrecognized nearest neighbor search: "
+              << neighborSearch << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(GetConfigValue(configMap, "sampling", configValue)) {
+    sampling = configValue;
+    if((sampling != "random") && (sampling != "stratified")) {
+      cerr << "ERROR: unrecognized instance sampling: " << sampling << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(GetConfigValue(configMap, "save-neighbors", configValue)) {
+    saveNeighborsFilename = configValue;
+  }
+  if(GetConfigValue(configMap, "load-neighbors", configValue)) {
+    loadNeighborsFilename = configValue;
+  }
+  if(GetConfigValue(configMap, "lsh-tables", configValue)) {
+    lshTables = lexical_cast<unsigned int>(configValue);
+  }
+  if(GetConfigValue(configMap, "lsh-key-snps", configValue)) {
+    lshKeySize = lexical_cast<unsigned int>(configValue);
+  }
+  if(GetConfigValue(configMap, "lsh-verify-recall", configValue)) {
+    lshVerifyRecall = lexical_cast<unsigned int>(configValue);
+  }
+  if(lshTables && (!lshKeySize ||
+                   (lshKeySize > GENOTYPE_LSH_MAX_KEY_ATTRIBUTES))) {
+    cerr << "ERROR: LSH key SNPs [" << lshKeySize << "] not in valid range 1 to "
+            << GENOTYPE_LSH_MAX_KEY_ATTRIBUTES << endl;
+    exit(EXIT_FAILURE);
+  }
 
   removePerIteration = 0;
   if(GetConfigValue(configMap, "iter-remove-n", configValue)) {
@@ -381,32 +696,33 @@ AttributeRanker::AttributeRanker(ds) {
     randomlySelect = false;
     m = ds->NumInstances();
   } else {
-    cout << Timestamp() << "Sampling instances randomly" << endl;
+    cout << Timestamp() << "Sampling instances randomly: " << sampling
+            << endl;
     randomlySelect = true;
   }
 
-  /// set the SNP metric function pointer
+  /// set the SNP metric type
   bool snpMetricFunctionUnset = true;
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "GM") {
-    snpDiff = diffGMM;
+    snpMetricType = GM_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "AM") {
-    snpDiff = diffAMM;
+    snpMetricType = AM_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "NCA") {
-    snpDiff = diffNCA;
+    snpMetricType = NCA_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "NCA6") {
-    snpDiff = diffNCA6;
+    snpMetricType = NCA6_SNP_METRIC;
     snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset && to_upper(snpMetric) == "KM") {
     cerr << "ERROR: KM is not supported as a ReliefF metric" << endl;
     exit(EXIT_FAILURE);
-    // snpDiff = diffKM;
+    // snpMetricType = KM_SNP_METRIC;
     // snpMetricFunctionUnset = false;
   }
   if(snpMetricFunctionUnset) {
@@ -414,10 +730,10 @@ AttributeRanker::AttributeRanker(ds) {
     exit(EXIT_FAILURE);
   }
   if(to_upper(numMetric) == "MANHATTAN") {
-    numDiff = diffManhattan;
+    numMetricType = MANHATTAN_NUMERIC_METRIC;
   } else {
     if(to_upper(numMetric) == "EUCLIDEAN") {
-      numDiff = diffEuclidean;
+      numMetricType = EUCLIDEAN_NUMERIC_METRIC;
     } else {
       cerr << "ERROR: [" << numMetric
               << "] is not a valid numeric metric type" << endl;
@@ -476,90 +792,60 @@ bool ReliefF::ComputeAttributeScores() {
 	W.clear();
   W.resize(dataset->NumVariables(), 0.0);
 
-  double one_over_m_times_k = 1.0 / (((double) m) * ((double) k));
-  cout << Timestamp() << "Averaging factor 1/(m*k): "  
-          << one_over_m_times_k << endl;
+  // one weight update loop specialized for the SNP and numeric metrics;
+  // with the genotype diffs in tables, parallel over blocks of attributes
+  MetricContext context = dataset->GetMetricContext(snpMetric);
+  if(!dataset->HasGenotypes() || context.snpDiffTables) {
+    AttributeBlockScoresKernels::Kernel kernel =
+            SelectNumericMetricKernel<AttributeBlockScoresKernels,
+            DiffTableMetric>(numMetricType);
+    return (this->*kernel)(context);
+  }
+  AttributeScoresKernels::Kernel kernel =
+          SelectMetricKernel<AttributeScoresKernels>(
+          snpMetricType, numMetricType, context.snpDiffTables != 0);
+
+  return (this->*kernel)(context);
+}
+
+template<class SnpMetric, class NumericMetric>
+bool ReliefF::ComputeAttributeScoresKernel(const MetricContext& context) {
+  SnpMetric snpDiff(context);
+  NumericMetric numDiff(context);
+
+  if(neighborhood == "knn") {
+    double one_over_m_times_k = 1.0 / (((double) m) * ((double) k));
+    cout << Timestamp() << "Averaging factor 1/(m*k): "  
+            << one_over_m_times_k << endl;
+  } else {
+    cout << Timestamp() << "Averaging each neighbor set by 1/(m*size)"
+            << endl;
+  }
 
   // pointer to the instance being sampled
   DatasetInstance* R_i = 0;
   cout << Timestamp() << "Running Relief-F algorithm" << endl;
-  vector<string> instanceIds = dataset->GetInstanceIds();
+  // neighbor instances of the sampled instance, reused for every instance
+  SampledNeighbors sample;
+  // per miss class: averaging factor of its neighbors, 1/(m*k) for knn
+  vector<double> missAveragingFactors;
   /// algorithm line 2
   for(int i = 0; i < (int) m; i++) {
-    // algorithm line 3
-    if(randomlySelect) {
-      // randomly sample an instance (without replacement?)
-      R_i = dataset->GetRandomInstance();
-    } else {
-      // deterministic/indexed instance sampling, ie, every instance against
-      // every other instance
-      unsigned int instanceIndex = 0;
-      dataset->GetInstanceIndexForID(instanceIds[i], instanceIndex);
-      R_i = dataset->GetInstance(instanceIndex);
-    }
-    if(!R_i) {
-      cerr
-              << "ERROR: Random or indexed instance count not be found for index: ["
-              << i << "]" << endl;
-      return false;
-    }
-    ClassLevel class_R_i = R_i->GetClass();
-
+    // algorithm line 3, sampled by SampleInstances
+    unsigned int instanceIndex = sampledInstanceIndices[i];
     /// algorithm lines 4, 5 and 6
-    // find k nearest hits and nearest misses
-    vector<unsigned int> hits;
-    map<ClassLevel, vector<unsigned int> > misses;
-    if(!R_i->GetNNearestInstances(k, hits, misses)) {
-      cerr << "ERROR: relieff cannot get " << k << " nearest neighbors"
-              << endl;
-      return false;
-    }
-
-    // !! DEBUG
-    // cout << "Instance class: " << R_i->GetClass() << ", hits: ";
-//    for(unsigned int ii = 0; ii < hits.size(); ++ii) {
-//      cout << hits[ii] << " ";
-//    }
-//    cout << endl << "Misses:" << endl;
-//    // !! DEBUG
-//    map<ClassLevel, vector<unsigned int> >::const_iterator iit;
-//    for(iit = misses.begin(); iit != misses.end(); ++iit) {
-//      cout << "Class: " << iit->first << ", misses: ";
-//      vector<unsigned int> ids = iit->second;
-//      for(unsigned int jj = 0; jj < ids.size(); ++jj) {
-//        // cout << ids[jj] << " ";
-//      }
-//      cout << endl;
-//    }
-
-    // check algorithm preconditions
-    if(hits.size() < 1) {
-      cerr << "ERROR: No nearest hits found" << endl;
+    if(!GetSampledNeighbors(instanceIndex, k, sample)) {
       return false;
     }
-    if(hits.size() < k) {
-      cerr << "ERROR: Could not find enough neighbors that are hits"
-              << endl;
-      exit(1);
-    }
-    map<ClassLevel, vector<unsigned int> >::const_iterator it;
-    for(it = misses.begin(); it != misses.end(); ++it) {
-      vector<unsigned int> missIds = it->second;
-      if(missIds.size() < 1) {
-        cerr << "ERROR: No nearest misses found" << endl;
-        return false;
-      }
-      if(missIds.size() < k) {
-        cerr << "ERROR: Could not find enough neighbors that are misses"
-                << endl;
-        return false;
-      }
-      if(missIds.size() != hits.size()) {
-        cerr
-                << "ERROR: Could not find equal number of neighbors for hits and misses:"
-                << hits.size() << " vs. " << misses.size() << endl;
-        return false;
-      }
+    R_i = sample.instance;
+    const vector<DatasetInstance*>& hitInstances = sample.hits;
+    const vector<vector<DatasetInstance*> >& missInstances = sample.misses;
+    const vector<double>& adjustmentFactors = sample.missFactors;
+    unsigned int numMissClasses = sample.numMissClasses;
+    double hitAveragingFactor = AveragingFactor(m, hitInstances.size());
+    missAveragingFactors.resize(numMissClasses);
+    for(unsigned int c = 0; c < numMissClasses; ++c) {
+      missAveragingFactors[c] = AveragingFactor(m, missInstances[c].size());
     }
 
     // UPDATE WEIGHTS FOR ATTRIBUTE 'A' BASED ON THIS AND NEIGHBORING INSTANCES
@@ -576,26 +862,18 @@ bool ReliefF::ComputeAttributeScores() {
         A = attributeIndicies[attrIdx];
         double hitSum = 0.0, missSum = 0.0;
         /// algorithm line 8
-        for(unsigned int j = 0; j < k; j++) {
-          DatasetInstance* H_j = dataset->GetInstance(hits[j]);
-          double rawDistance = snpDiff(A, R_i, H_j);
-          hitSum += (rawDistance * one_over_m_times_k);
+        for(unsigned int j = 0; j < hitInstances.size(); j++) {
+          double rawDistance = snpDiff.Diff(A, R_i, hitInstances[j]);
+          hitSum += (rawDistance * hitAveragingFactor);
         }
         /// algorithm line 9
-        map<ClassLevel, vector<unsigned int> >::const_iterator mit;
-        for(mit = misses.begin(); mit != misses.end(); ++mit) {
-          ClassLevel C = mit->first;
-          vector<unsigned int> missIds = mit->second;
-          double P_C = dataset->GetClassProbability(C);
-          double P_C_R = dataset->GetClassProbability(class_R_i);
-          double adjustmentFactor = P_C / (1.0 - P_C_R);
+        for(unsigned int c = 0; c < numMissClasses; ++c) {
           double tempSum = 0.0;
-          for(unsigned int j = 0; j < k; j++) {
-            DatasetInstance* M_j = dataset->GetInstance(missIds[j]);
-            double rawDistance = snpDiff(A, R_i, M_j);
-            tempSum += (rawDistance * one_over_m_times_k);
+          for(unsigned int j = 0; j < missInstances[c].size(); j++) {
+            double rawDistance = snpDiff.Diff(A, R_i, missInstances[c][j]);
+            tempSum += (rawDistance * missAveragingFactors[c]);
           } // nearest neighbors
-          missSum += (adjustmentFactor * tempSum);
+          missSum += (adjustmentFactors[c] * tempSum);
         }
 
         W[scoresIdx] = W[scoresIdx] - hitSum + missSum;
@@ -611,24 +889,18 @@ bool ReliefF::ComputeAttributeScores() {
               ++numIdx) {
         A = numericIndices[numIdx];
         double hitSum = 0.0, missSum = 0.0;
-        for(unsigned int j = 0; j < k; j++) {
-          DatasetInstance* H_j = dataset->GetInstance(hits[j]);
-          hitSum += (numDiff(A, R_i, H_j) * one_over_m_times_k);
+        for(unsigned int j = 0; j < hitInstances.size(); j++) {
+          hitSum += (numDiff.Diff(A, R_i, hitInstances[j]) *
+                  hitAveragingFactor);
         }
 
-        map<ClassLevel, vector<unsigned int> >::const_iterator mit;
-        for(mit = misses.begin(); mit != misses.end(); ++mit) {
-          ClassLevel C = mit->first;
-          vector<unsigned int> missIds = mit->second;
-          double P_C = dataset->GetClassProbability(C);
-          double P_C_R = dataset->GetClassProbability(class_R_i);
-          double adjustmentFactor = P_C / (1.0 - P_C_R);
+        for(unsigned int c = 0; c < numMissClasses; ++c) {
           double tempSum = 0.0;
-          for(unsigned int j = 0; j < k; j++) {
-            DatasetInstance* M_j = dataset->GetInstance(missIds[j]);
-            tempSum += (numDiff(A, R_i, M_j) * one_over_m_times_k);
+          for(unsigned int j = 0; j < missInstances[c].size(); j++) {
+            tempSum += (numDiff.Diff(A, R_i, missInstances[c][j]) *
+                    missAveragingFactors[c]);
           } // nearest neighbors
-          missSum += (adjustmentFactor * tempSum);
+          missSum += (adjustmentFactors[c] * tempSum);
         }
         W[scoresIdx] = W[scoresIdx] - hitSum + missSum;
         ++scoresIdx;
@@ -646,6 +918,518 @@ bool ReliefF::ComputeAttributeScores() {
   return true;
 }
 
+template<class NumericMetric>
+bool ReliefF::ComputeAttributeBlockScoresKernel(const MetricContext& context) {
+  DiffTableMetric snpDiff(context);
+  NumericMetric numDiff(context);
+
+  if(neighborhood == "knn") {
+    double one_over_m_times_k = 1.0 / (((double) m) * ((double) k));
+    cout << Timestamp() << "Averaging factor 1/(m*k): "
+            << one_over_m_times_k << endl;
+  } else {
+    cout << Timestamp() << "Averaging each neighbor set by 1/(m*size)"
+            << endl;
+  }
+
+  SampledNeighborSets sets;
+  if(!LookUpSampledNeighborSets(sets)) {
+    return false;
+  }
+  const vector<DatasetInstance*>& rowInstances = sets.rowInstances;
+  unsigned int numRows = rowInstances.size();
+
+  vector<unsigned int> attributeIndicies;
+  if(dataset->HasGenotypes()) {
+    attributeIndicies = dataset->MaskGetAttributeIndices(DISCRETE_TYPE);
+  }
+  vector<unsigned int> numericIndices;
+  if(dataset->HasNumerics()) {
+    numericIndices = dataset->MaskGetAttributeIndices(NUMERIC_TYPE);
+  }
+  unsigned int numAttributes = attributeIndicies.size();
+
+  if(ParallelOverInstances()) {
+    unsigned int numChunks = NumSampleChunks();
+    cout << Timestamp() << "Running Relief-F algorithm over " << numChunks
+            << " chunks of sampled instances" << endl;
+    vector<vector<double> > chunkW(numChunks, vector<double>(W.size(), 0.0));
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int chunk = 0; chunk < (int) numChunks; ++chunk) {
+      vector<double>& thisW = chunkW[chunk];
+      unsigned int begin = 0, end = 0;
+      SampleChunkRange(chunk, begin, end);
+      for(unsigned int i = begin; i < end; i++) {
+        for(unsigned int attrIdx = 0; attrIdx < numAttributes; ++attrIdx) {
+          thisW[attrIdx] = sets.UpdateScore(snpDiff,
+                                            attributeIndicies[attrIdx], i,
+                                            thisW[attrIdx]);
+        }
+        for(unsigned int numIdx = 0; numIdx < numericIndices.size();
+                ++numIdx) {
+          unsigned int scoresIdx = numAttributes + numIdx;
+          thisW[scoresIdx] = sets.UpdateScore(numDiff, numericIndices[numIdx],
+                                              i, thisW[scoresIdx]);
+        }
+      }
+    }
+    SumChunkScores(chunkW);
+    for(unsigned int scoresIdx = 0; scoresIdx < W.size(); ++scoresIdx) {
+      W[scoresIdx] += chunkW[0][scoresIdx];
+    }
+    cout << Timestamp() << m << "/" << m << " done" << endl;
+
+    return true;
+  }
+
+  unsigned int numGenotypeBlocks =
+          (numAttributes + ATTRIBUTE_SCORES_BLOCK - 1) / ATTRIBUTE_SCORES_BLOCK;
+  if(numAttributes && (snpMetricType == GM_SNP_METRIC) &&
+     (neighborhood == "knn") &&
+     ComputeGenotypeScoresPopcount(sets, attributeIndicies)) {
+    numGenotypeBlocks = 0;
+  }
+  unsigned int numBlocks = numGenotypeBlocks +
+          (numericIndices.size() + ATTRIBUTE_SCORES_BLOCK - 1) /
+          ATTRIBUTE_SCORES_BLOCK;
+  cout << Timestamp() << "Running Relief-F algorithm over " << numBlocks
+          << " blocks of " << ATTRIBUTE_SCORES_BLOCK << " attributes" << endl;
+
+  /// algorithm lines 7, 2, 8 and 9: each attribute's score is accumulated
+  /// over the m sampled instances by one thread, so needs no synchronization
+  const vector<unsigned int>& sampleRows = sets.sampleRows;
+  const vector<unsigned int>& sampleSets = sets.sampleSets;
+  const vector<unsigned int>& setStarts = sets.setStarts;
+  const vector<unsigned int>& setRows = sets.setRows;
+  const vector<double>& setAveragingFactors = sets.averagingFactors;
+  const vector<double>& setMissFactors = sets.missFactors;
+#pragma omp parallel
+  {
+    // this thread's block of genotypes, attribute-major: codes[a][row]
+    vector<unsigned char> codes(ATTRIBUTE_SCORES_BLOCK * numRows);
+#pragma omp for schedule(dynamic, 1)
+    for(int block = 0; block < (int) numBlocks; ++block) {
+      if((unsigned int) block < numGenotypeBlocks) {
+        unsigned int begin = block * ATTRIBUTE_SCORES_BLOCK;
+        unsigned int end = min(begin + ATTRIBUTE_SCORES_BLOCK, numAttributes);
+        for(unsigned int row = 0; row < numRows; ++row) {
+          const vector<AttributeLevel>& levels = rowInstances[row]->attributes;
+          for(unsigned int attrIdx = begin; attrIdx < end; ++attrIdx) {
+            AttributeLevel level = levels[attributeIndicies[attrIdx]];
+            codes[(attrIdx - begin) * numRows + row] = (unsigned char)
+                    ((level == MISSING_ATTRIBUTE_VALUE) ?
+                    DIFF_TABLE_LEVELS - 1 : level);
+          }
+        }
+        for(unsigned int attrIdx = begin; attrIdx < end; ++attrIdx) {
+          const unsigned char* column = &codes[(attrIdx - begin) * numRows];
+          const double* table = context.snpDiffTables +
+                  context.snpDiffTableOffsets[attributeIndicies[attrIdx]];
+          double score = W[attrIdx];
+          for(unsigned int i = 0; i < m; i++) {
+            const double* diffs = table +
+                    column[sampleRows[i]] * DIFF_TABLE_LEVELS;
+            unsigned int set = sampleSets[i];
+            double hitSum = 0.0, missSum = 0.0;
+            for(unsigned int j = setStarts[set]; j < setStarts[set + 1]; j++) {
+              hitSum += (diffs[column[setRows[j]]] * setAveragingFactors[set]);
+            }
+            for(++set; set < sampleSets[i + 1]; ++set) {
+              double tempSum = 0.0;
+              for(unsigned int j = setStarts[set]; j < setStarts[set + 1];
+                      j++) {
+                tempSum += (diffs[column[setRows[j]]] *
+                        setAveragingFactors[set]);
+              }
+              missSum += (setMissFactors[set] * tempSum);
+            }
+            score = score - hitSum + missSum;
+          }
+          W[attrIdx] = score;
+        }
+      } else {
+        unsigned int begin =
+                (block - numGenotypeBlocks) * ATTRIBUTE_SCORES_BLOCK;
+        unsigned int end = min(begin + ATTRIBUTE_SCORES_BLOCK,
+                               (unsigned int) numericIndices.size());
+        for(unsigned int numIdx = begin; numIdx < end; ++numIdx) {
+          unsigned int A = numericIndices[numIdx];
+          double score = W[numAttributes + numIdx];
+          for(unsigned int i = 0; i < m; i++) {
+            score = sets.UpdateScore(numDiff, A, i, score);
+          }
+          W[numAttributes + numIdx] = score;
+        }
+      }
+    } // attribute blocks
+  }
+  cout << Timestamp() << m << "/" << m << " done" << endl;
+
+  return true;
+}
+
+template<class SnpMetric, class NumericMetric>
+bool ReliefF::ComputeAttributeScoresForKsKernel(const MetricContext& context,
+        const vector<unsigned int>& ks, vector<vector<double> >& kW) {
+  SnpMetric snpDiff(context);
+  NumericMetric numDiff(context);
+
+  cout << Timestamp() << "Running Relief-F algorithm for " << ks.size()
+          << " values of k" << endl;
+  vector<unsigned int> attributeIndicies =
+          dataset->MaskGetAttributeIndices(DISCRETE_TYPE);
+  vector<unsigned int> numericIndices =
+          dataset->MaskGetAttributeIndices(NUMERIC_TYPE);
+  kW.assign(ks.size(), vector<double>(dataset->NumVariables(), 0.0));
+  SampledNeighbors sample;
+  vector<double> missSums(dataset->GetNeighborTable().NumSlots());
+  for(int i = 0; i < (int) m; i++) {
+    unsigned int instanceIndex = sampledInstanceIndices[i];
+    if(!GetSampledNeighbors(instanceIndex, ks.back(), sample)) {
+      return false;
+    }
+
+    unsigned int scoresIdx = 0;
+    if(dataset->HasGenotypes()) {
+      for(unsigned int attrIdx = 0; attrIdx < attributeIndicies.size();
+              ++attrIdx) {
+        AddRankedDiffs(snpDiff, attributeIndicies[attrIdx], sample, ks,
+                       missSums, kW, scoresIdx);
+        ++scoresIdx;
+      }
+    }
+    if(dataset->HasNumerics()) {
+      for(unsigned int numIdx = 0; numIdx < numericIndices.size(); ++numIdx) {
+        AddRankedDiffs(numDiff, numericIndices[numIdx], sample, ks,
+                       missSums, kW, scoresIdx);
+        ++scoresIdx;
+      }
+    }
+
+    // happy lights
+    if(i && ((i % 100) == 0)) {
+      cout << Timestamp() << i << "/" << m << endl;
+    }
+  }
+  cout << Timestamp() << m << "/" << m << " done" << endl;
+
+  // average over the m sampled instances and the k neighbors of each k
+  for(unsigned int kIdx = 0; kIdx < ks.size(); ++kIdx) {
+    double one_over_m_times_k = 1.0 / (((double) m) * ((double) ks[kIdx]));
+    vector<double>& thisW = kW[kIdx];
+    for(unsigned int scoresIdx = 0; scoresIdx < thisW.size(); ++scoresIdx) {
+      thisW[scoresIdx] *= one_over_m_times_k;
+    }
+  }
+
+  return true;
+}
+
+bool ReliefF::GetSampledNeighbors(unsigned int instanceIndex,
+                                  unsigned int numNeighbors,
+                                  SampledNeighbors& sample) {
+  const NeighborTable& neighborTable = dataset->GetNeighborTable();
+  DatasetInstance* R_i = dataset->GetInstance(instanceIndex);
+  if(!R_i) {
+    cerr
+            << "ERROR: Random or indexed instance count not be found for index: ["
+            << instanceIndex << "]" << endl;
+    return false;
+  }
+  ClassLevel class_R_i = R_i->GetClass();
+
+  // find k nearest hits and nearest misses
+  unsigned int hitSlot = neighborTable.ClassSlot(class_R_i);
+  if(hitSlot == neighborTable.NumSlots()) {
+    cerr << "ERROR: relieff cannot get " << numNeighbors
+            << " nearest neighbors" << endl;
+    return false;
+  }
+
+  sample.misses.resize(neighborTable.NumSlots());
+  sample.missIndices.resize(neighborTable.NumSlots());
+  sample.missFactors.resize(neighborTable.NumSlots());
+
+  // check algorithm preconditions; a distance threshold neighborhood has
+  // all its neighbors, possibly none, of each class
+  bool thresholdNeighbors = (neighborhood != "knn");
+  unsigned int numHits = neighborTable.NumNeighbors(instanceIndex, hitSlot);
+  if(thresholdNeighbors) {
+    numNeighbors = numHits;
+  } else {
+    if(numHits < 1) {
+      cerr << "ERROR: No nearest hits found" << endl;
+      return false;
+    }
+    if(numHits < numNeighbors) {
+      cerr << "ERROR: Could not find enough neighbors that are hits"
+              << endl;
+      exit(1);
+    }
+  }
+  sample.hits.resize(numNeighbors);
+  const unsigned int* hits = neighborTable.Neighbors(instanceIndex, hitSlot);
+  sample.hitIndices.assign(hits, hits + numNeighbors);
+  for(unsigned int j = 0; j < numNeighbors; j++) {
+    sample.hits[j] = dataset->GetInstance(hits[j]);
+  }
+
+  unsigned int numMissClasses = 0;
+  double P_C_R = dataset->GetClassProbability(class_R_i);
+  for(unsigned int slot = 0; slot < neighborTable.NumSlots(); ++slot) {
+    if(slot == hitSlot) {
+      continue;
+    }
+    unsigned int numMisses = neighborTable.NumNeighbors(instanceIndex, slot);
+    unsigned int numSlotNeighbors = numNeighbors;
+    if(thresholdNeighbors) {
+      numSlotNeighbors = numMisses;
+    } else {
+      if(numMisses < 1) {
+        cerr << "ERROR: No nearest misses found" << endl;
+        return false;
+      }
+      if(numMisses < numNeighbors) {
+        cerr << "ERROR: Could not find enough neighbors that are misses"
+                << endl;
+        return false;
+      }
+    }
+    double P_C = dataset->GetClassProbability(neighborTable.SlotClass(slot));
+    sample.missFactors[numMissClasses] = P_C / (1.0 - P_C_R);
+    const unsigned int* misses = neighborTable.Neighbors(instanceIndex, slot);
+    vector<DatasetInstance*>& classMisses = sample.misses[numMissClasses];
+    classMisses.resize(numSlotNeighbors);
+    sample.missIndices[numMissClasses].assign(misses,
+                                              misses + numSlotNeighbors);
+    for(unsigned int j = 0; j < numSlotNeighbors; j++) {
+      classMisses[j] = dataset->GetInstance(misses[j]);
+    }
+    ++numMissClasses;
+  }
+  sample.instance = R_i;
+  sample.instanceIndex = instanceIndex;
+  sample.numMissClasses = numMissClasses;
+
+  return true;
+}
+
+bool ReliefF::ComputeGenotypeScoresPopcount(
+        const SampledNeighborSets& sets,
+        const vector<unsigned int>& attributeIndicies) {
+  PackedGenotypes packed;
+  if(!packed.Pack(dataset, sets.rowInstanceIndices, attributeIndicies,
+                  PACKED_GM_METRIC)) {
+    return false;
+  }
+  const unsigned int NUM_PLANES = PackedGenotypes::NUM_PLANES;
+  unsigned int numWords = packed.NumWords();
+  unsigned int numAttributes = attributeIndicies.size();
+
+  // counter group of each set: 0 for hits, then one per distinct miss factor
+  vector<double> groupFactors(1, 0.0);
+  vector<unsigned int> setGroups(sets.missFactors.size(), 0);
+  for(unsigned int i = 0; i < m; i++) {
+    for(unsigned int set = sets.sampleSets[i] + 1;
+            set < sets.sampleSets[i + 1]; ++set) {
+      vector<double>::const_iterator found = find(groupFactors.begin() + 1,
+                                                  groupFactors.end(),
+                                                  sets.missFactors[set]);
+      setGroups[set] = found - groupFactors.begin();
+      if(found == groupFactors.end()) {
+        groupFactors.push_back(sets.missFactors[set]);
+      }
+    }
+  }
+  unsigned int numGroups = groupFactors.size();
+  // bit-sliced counter planes to count every neighbor of a group
+  unsigned int numCounterBits = 1;
+  while((((uint64_t) 1) << numCounterBits) <= sets.setRows.size()) {
+    ++numCounterBits;
+  }
+  double averagingFactor = AveragingFactor(m, k);
+  cout << Timestamp() << "Counting gm mismatches of " << numAttributes
+          << " packed genotypes in " << numGroups << " neighbor groups"
+          << endl;
+
+  unsigned int numBlocks =
+          (numWords + POPCOUNT_SCORES_BLOCK - 1) / POPCOUNT_SCORES_BLOCK;
+#pragma omp parallel
+  {
+    // this thread's counters: [group][word][mismatch, missing][bit]
+    unsigned int groupSize = POPCOUNT_SCORES_BLOCK * 2 * numCounterBits;
+    vector<uint64_t> counters(numGroups * groupSize);
+#pragma omp for schedule(dynamic, 1)
+    for(int block = 0; block < (int) numBlocks; ++block) {
+      unsigned int wordBegin = block * POPCOUNT_SCORES_BLOCK;
+      unsigned int numBlockWords =
+              min(POPCOUNT_SCORES_BLOCK, numWords - wordBegin);
+      fill(counters.begin(), counters.end(), 0);
+      for(unsigned int i = 0; i < m; i++) {
+        const uint64_t* R_i = packed.RowPlanes(sets.sampleRows[i]) +
+                wordBegin * NUM_PLANES;
+        for(unsigned int set = sets.sampleSets[i];
+                set < sets.sampleSets[i + 1]; ++set) {
+          uint64_t* groupCounters = &counters[setGroups[set] * groupSize];
+          for(unsigned int j = sets.setStarts[set];
+                  j < sets.setStarts[set + 1]; j++) {
+            const uint64_t* I_j = packed.RowPlanes(sets.setRows[j]) +
+                    wordBegin * NUM_PLANES;
+            for(unsigned int word = 0; word < numBlockWords; ++word) {
+              const uint64_t* r = R_i + word * NUM_PLANES;
+              const uint64_t* n = I_j + word * NUM_PLANES;
+              uint64_t missing = r[3] | n[3];
+              uint64_t mismatch = ((r[0] ^ n[0]) | (r[1] ^ n[1]) |
+                      (r[2] ^ n[2])) & ~missing;
+              // ripple carry add of one bit per attribute
+              uint64_t* counter = groupCounters + word * 2 * numCounterBits;
+              for(unsigned int bit = 0; mismatch; ++bit) {
+                uint64_t carry = counter[bit] & mismatch;
+                counter[bit] ^= mismatch;
+                mismatch = carry;
+              }
+              counter += numCounterBits;
+              for(unsigned int bit = 0; missing; ++bit) {
+                uint64_t carry = counter[bit] & missing;
+                counter[bit] ^= missing;
+                missing = carry;
+              }
+            }
+          }
+        }
+      }
+
+      // diffs of each attribute: 1 per mismatch, 2/3 per missing genotype
+      for(unsigned int word = 0; word < numBlockWords; ++word) {
+        for(unsigned int attrBit = 0; attrBit < 64; ++attrBit) {
+          unsigned int attrIdx = (wordBegin + word) * 64 + attrBit;
+          if(attrIdx >= numAttributes) {
+            break;
+          }
+          double hitSum = 0.0, missSum = 0.0;
+          for(unsigned int group = 0; group < numGroups; ++group) {
+            const uint64_t* counter = &counters[group * groupSize +
+                    word * 2 * numCounterBits];
+            uint64_t numMismatches = 0, numMissing = 0;
+            for(unsigned int bit = 0; bit < numCounterBits; ++bit) {
+              numMismatches |= ((counter[bit] >> attrBit) & 1) << bit;
+              numMissing |=
+                      ((counter[numCounterBits + bit] >> attrBit) & 1) << bit;
+            }
+            double diffs = (3.0 * numMismatches + 2.0 * numMissing) / 3.0;
+            if(group) {
+              missSum += (groupFactors[group] * (diffs * averagingFactor));
+            } else {
+              hitSum = diffs * averagingFactor;
+            }
+          }
+          W[attrIdx] = W[attrIdx] - hitSum + missSum;
+        }
+      }
+    } // word blocks
+  }
+
+  return true;
+}
+
+bool ReliefF::LookUpSampledNeighborSets(SampledNeighborSets& sets) {
+  cout << Timestamp() << "Looking up the neighbors of " << m
+          << " sampled instances" << endl;
+  // instance indices until every row is known
+  vector<unsigned int>& sampleRows = sets.sampleRows;
+  vector<unsigned int>& setRows = sets.setRows;
+  sampleRows.resize(m);
+  sets.sampleSets.assign(m + 1, 0);
+  sets.setStarts.assign(1, 0);
+  setRows.clear();
+  sets.averagingFactors.clear();
+  sets.missFactors.clear();
+  SampledNeighbors sample;
+  for(unsigned int i = 0; i < m; i++) {
+    unsigned int instanceIndex = sampledInstanceIndices[i];
+    if(!GetSampledNeighbors(instanceIndex, k, sample)) {
+      return false;
+    }
+    sampleRows[i] = instanceIndex;
+    setRows.insert(setRows.end(), sample.hitIndices.begin(),
+                   sample.hitIndices.end());
+    sets.setStarts.push_back(setRows.size());
+    sets.averagingFactors.push_back(AveragingFactor(m, sample.hits.size()));
+    sets.missFactors.push_back(0.0);
+    for(unsigned int c = 0; c < sample.numMissClasses; ++c) {
+      setRows.insert(setRows.end(), sample.missIndices[c].begin(),
+                     sample.missIndices[c].end());
+      sets.setStarts.push_back(setRows.size());
+      sets.averagingFactors.push_back(AveragingFactor(m,
+                                                      sample.misses[c].size()));
+      sets.missFactors.push_back(sample.missFactors[c]);
+    }
+    sets.sampleSets[i + 1] = sets.averagingFactors.size();
+  }
+
+  // rows: the instances sampled or neighbors, in instance index order
+  vector<unsigned int> rowInstanceIndices(sampleRows);
+  rowInstanceIndices.insert(rowInstanceIndices.end(), setRows.begin(),
+                            setRows.end());
+  sort(rowInstanceIndices.begin(), rowInstanceIndices.end());
+  rowInstanceIndices.erase(unique(rowInstanceIndices.begin(),
+                                  rowInstanceIndices.end()),
+                           rowInstanceIndices.end());
+  unsigned int numRows = rowInstanceIndices.size();
+  sets.rowInstanceIndices = rowInstanceIndices;
+  sets.rowInstances.resize(numRows);
+  vector<unsigned int> instanceRows(numRows ?
+                                    rowInstanceIndices.back() + 1 : 0);
+  for(unsigned int row = 0; row < numRows; ++row) {
+    sets.rowInstances[row] = dataset->GetInstance(rowInstanceIndices[row]);
+    instanceRows[rowInstanceIndices[row]] = row;
+  }
+  for(unsigned int i = 0; i < m; i++) {
+    sampleRows[i] = instanceRows[sampleRows[i]];
+  }
+  for(unsigned int j = 0; j < setRows.size(); j++) {
+    setRows[j] = instanceRows[setRows[j]];
+  }
+
+  return true;
+}
+
+bool ReliefF::ParallelOverInstances() {
+  unsigned int numVariables = dataset->NumVariables();
+  unsigned int numBlocks =
+          (numVariables + ATTRIBUTE_SCORES_BLOCK - 1) / ATTRIBUTE_SCORES_BLOCK;
+  return (numVariables <= INSTANCE_PARALLEL_MAX_VARIABLES) &&
+          (NumSampleChunks() > numBlocks);
+}
+
+unsigned int ReliefF::NumSampleChunks() {
+  return (m + SAMPLE_CHUNK - 1) / SAMPLE_CHUNK;
+}
+
+void ReliefF::SampleChunkRange(unsigned int chunk, unsigned int& begin,
+                               unsigned int& end) {
+  begin = chunk * SAMPLE_CHUNK;
+  end = min(begin + SAMPLE_CHUNK, m);
+}
+
+void ReliefF::SumChunkScores(vector<vector<double> >& chunkScores) {
+  unsigned int numChunks = chunkScores.size();
+  for(unsigned int stride = 1; stride < numChunks; stride *= 2) {
+    int numPairs = (numChunks + 2 * stride - 1) / (2 * stride);
+#pragma omp parallel for
+    for(int pair = 0; pair < numPairs; ++pair) {
+      unsigned int chunk = pair * 2 * stride;
+      if(chunk + stride < numChunks) {
+        vector<double>& sum = chunkScores[chunk];
+        const vector<double>& other = chunkScores[chunk + stride];
+        for(unsigned int scoresIdx = 0; scoresIdx < sum.size(); ++scoresIdx) {
+          sum[scoresIdx] += other[scoresIdx];
+        }
+      }
+    }
+  }
+}
+
 bool ReliefF::ComputeAttributeScoresIteratively() {
   // final scores after all iterations
   std::map<std::string, double> finalScores;
@@ -760,59 +1544,133 @@ void ReliefF::WriteAttributeScores(string baseFilename) {
 }
 
 bool ReliefF::PreComputeDistances() {
+  // the sampled instances are drawn first: with fewer samples than instances
+  // only their neighbors are needed
+  SampleInstances();
+
+  // nested neighbors selected for the largest k of a sweep begin with the
+  // neighbors of every smaller k
+  unsigned int selectK = max(k, neighborsMaxK);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  if(neighborsMaxK && neighborsNested && (neighborTable.K() == selectK) &&
+     (neighborGapsK == selectK)) {
+    cout << Timestamp() << "Using the nearest neighbors selected for k = "
+            << selectK << endl;
+    cout << Timestamp() << "3) Calculating weight by distance factors for "
+            << "nearest neighbors... " << endl;
+    ComputeWeightByDistanceFactors();
+    return true;
+  }
+
+  if((loadNeighborsFilename != "") && LoadNeighbors()) {
+    cout << Timestamp() << "3) Calculating weight by distance factors for "
+            << "nearest neighbors... " << endl;
+    ComputeWeightByDistanceFactors();
+    return true;
+  }
+  if(!SelectNearestNeighbors()) {
+    return false;
+  }
+  // only the first neighbors are of the full data; later iterations remove
+  // attributes
+  if((saveNeighborsFilename != "") && !neighborsSaved) {
+    if(!SaveNeighbors()) {
+      exit(1);
+    }
+    neighborsSaved = true;
+  }
+
+  return true;
+}
+
+bool ReliefF::SelectNearestNeighbors() {
+  unsigned int selectK = max(k, neighborsMaxK);
+  bool nested = NestedNeighbors();
+  bool sortByDistance = nested || dataset->HasContinuousPhenotypes();
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  if(neighborhood != "knn") {
+    return PreComputeNeighborsRadius();
+  }
+  if(lshTables) {
+    if(dataset->HasGenotypes() && !dataset->HasNumerics() &&
+       (PackedGenotypes::MetricFromName(dataset->GetDistanceMetrics()[1]) !=
+        PACKED_NO_METRIC)) {
+      return PreComputeNeighborsLsh();
+    }
+    cout << Timestamp() << "WARNING: LSH nearest neighbors need genotype "
+            << "data without numerics and the gm or am metric; "
+            << "searching exactly" << endl;
+  }
+  if(neighborSearch == "vptree") {
+    vector<string> metrics = dataset->GetDistanceMetrics();
+    if((!dataset->HasGenotypes() ||
+        (PackedGenotypes::MetricFromName(metrics[1]) != PACKED_NO_METRIC)) &&
+       (!dataset->HasNumerics() || (to_upper(metrics[2]) == "MANHATTAN"))) {
+      return PreComputeNeighborsVpTree();
+    }
+    cout << Timestamp() << "WARNING: VP-tree nearest neighbors need the gm "
+            << "or am SNP and manhattan numeric metrics; searching all "
+            << "instances" << endl;
+  }
+  if(SelectSampledNeighborsOnly()) {
+    return PreComputeNeighborsSampled();
+  }
+
   cout << Timestamp() << "Precomputing instance distances" << endl;
-  map<string, unsigned int> instanceMask = dataset->MaskGetInstanceMask();
   vector<string> instanceIds = dataset->MaskGetInstanceIds();
   int numInstances = instanceIds.size();
 
-  // create a distance matrix
-  cout << Timestamp() << "Allocating distance matrix";
-  double** distanceMatrix;
-  distanceMatrix = new double*[numInstances];
-  for(int i = 0; i < numInstances; ++i) {
-    distanceMatrix[i] = new double[numInstances];
-    for(int j = 0; j < numInstances; ++j) {
-      distanceMatrix[i][j] = 0.0;
-    }
+  double matrixBytes = (double) numInstances * numInstances * sizeof(double);
+  if(dataset->GetDistancePrecision() == FLOAT_PRECISION) {
+    matrixBytes = (double) numInstances * numInstances * sizeof(float);
+  }
+  if(distanceMemoryLimit &&
+     (matrixBytes > (double) distanceMemoryLimit * 1024.0 * 1024.0)) {
+    cout << Timestamp() << "Distance matrix of "
+            << (unsigned int) (matrixBytes / (1024.0 * 1024.0))
+            << " MB exceeds the " << distanceMemoryLimit
+            << " MB distance memory limit" << endl;
+    return PreComputeNeighborsStreaming();
   }
-  cout << " done" << endl;
 
   // populate the matrix - upper triangular
   // NOTE: make complete symmetric matrix for neighbor-to-neighbor sums
+  // the matrix is kept between calls and only the distances of attributes
+  // removed since the last call are subtracted when possible
   cout << Timestamp() << "1) Computing instance-to-instance distances with ... " << endl;
-  //  omp_set_nested(1);
-#pragma omp parallel for schedule(dynamic, 1)
-  for(int i = 0; i < numInstances; ++i) {
-    // cout << "Computing instance to instance distances. Row: " << i << endl;
-    // #pragma omp parallel for
-    for(int j = i + 1; j < numInstances; ++j) {
-      unsigned int dsi1Index;
-      dataset->GetInstanceIndexForID(instanceIds[i], dsi1Index);
-      unsigned int dsi2Index;
-      dataset->GetInstanceIndexForID(instanceIds[j], dsi2Index);
-      /// be sure to call Dataset::ComputeInstanceToInstanceDistance
-      distanceMatrix[i][j] = distanceMatrix[j][i] =
-              dataset->ComputeInstanceToInstanceDistance(
-              dataset->GetInstance(dsi1Index),
-              dataset->GetInstance(dsi2Index));
-      //cout << i << ", " << j << " => " << distanceMatrix[i][j] << endl;
-    }
-    if(i && (i % 100 == 0)) {
-      cout << Timestamp() << i << "/" << numInstances << endl;
-    }
+  vector<double> rowChanges;
+  if(!dataset->UpdateDistanceMatrix(distanceMatrix, rowChanges)) {
+    cerr << "ERROR: Could not compute the distance matrix" << endl;
+    return false;
   }
   cout << Timestamp() << numInstances << "/" << numInstances << " done"
           << endl;
 
+  // a row whose distances did not change keeps its neighbors; with equal
+  // neighbor weights and exactly k neighbors, so does a row whose distances
+  // moved less than half the gap between its k-th and (k+1)-th neighbors
+  bool canKeepNeighbors = (rowChanges.size() == (unsigned int) numInstances)
+          && (neighborGaps.size() == (unsigned int) numInstances)
+          && (neighborGapsK == selectK) && (neighborTable.K() == selectK)
+          && (neighborsNested == nested);
+  bool canKeepNearNeighbors = canKeepNeighbors && (selectK == k)
+          && (weightByDistanceMethod == "equal");
+  if(!canKeepNeighbors) {
+    neighborGaps.assign(numInstances, 0.0);
+    neighborGapsK = selectK;
+    neighborsNested = nested;
+    dataset->AllocateNeighborTable(selectK);
+  }
+
   //  DEBUG
   //  ofstream outFile;
   //  outFile.open("distanceMatrix.csv");
   //  for(unsigned int i=0; i < dataset->NumInstances(); ++i) {
   //    for(unsigned int j=0; j < dataset->NumInstances(); ++j) {
   //      if(j)
-  //        outFile << "," << distanceMatrix[i][j];
+  //        outFile << "," << distanceMatrix.Get(i, j);
   //      else
-  //        outFile << distanceMatrix[i][j];
+  //        outFile << distanceMatrix.Get(i, j);
   //    }
   //    outFile << endl;
   //  }
@@ -837,65 +1695,64 @@ bool ReliefF::PreComputeDistances() {
   }
   cout << endl;
 
-  DistancePair nnInfo;
-  for(int i = 0; i < numInstances; ++i) {
-    unsigned int thisInstanceIndex = instanceMask[instanceIds[i]];
-    DatasetInstance* thisInstance = dataset->GetInstance(thisInstanceIndex);
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+  unsigned int numSlots = neighborTable.NumSlots();
+
+  // rows are independent: each thread selects the neighbors of its rows
+  // with its own candidates and distance row
+  int numKept = 0;
+#pragma omp parallel
+  {
+    vector<double> distanceRow;
+    InstanceNeighbors neighbors;
+    neighbors.slots.assign(
+            numSlots, NeighborCandidates(selectK, candidate_less(nested)));
+    neighbors.slotDistances.resize(numSlots);
+    vector<NeighborCandidate> sorted;
+#pragma omp for schedule(dynamic, NEIGHBOR_ROW_CHUNK) reduction(+:numKept)
+    for(int i = 0; i < numInstances; ++i) {
+      if(canKeepNeighbors && ((rowChanges[i] == 0.0) ||
+         (canKeepNearNeighbors && (2.0 * rowChanges[i] < neighborGaps[i])))) {
+        neighborGaps[i] -= 2.0 * rowChanges[i];
+        ++numKept;
+        continue;
+      }
+      distanceMatrix.GetRow(i, distanceRow);
 
-    if(dataset->HasContinuousPhenotypes()) {
-      DistancePairs instanceDistances;
-      for(int j = 0; j < numInstances; ++j) {
-        if(i == j)
-          continue;
-        double instanceToInstanceDistance = distanceMatrix[i][j];
-        DistancePair nearestNeighborInfo;
-        nearestNeighborInfo = make_pair(instanceToInstanceDistance,
-                instanceIds[j]);
-        instanceDistances.push_back(nearestNeighborInfo);
+      // same class candidates, or all candidates for continuous phenotypes,
+      // and different class candidates, by slot in instance mask order
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        neighbors.slots[slot].clear();
+        neighbors.slotDistances[slot].clear();
       }
-      thisInstance->SetDistanceSums(k, instanceDistances);
-    } else {
-      ClassLevel thisClass = thisInstance->GetClass();
-      DistancePairs sameSums;
-      // changed to an array for multiclass - 12/1/11
-      map<ClassLevel, DistancePairs> diffSums;
       for(int j = 0; j < numInstances; ++j) {
         if(i == j)
           continue;
-        double instanceToInstanceDistance = distanceMatrix[i][j];
-        unsigned int otherInstanceIndex = instanceMask[instanceIds[j]];
-        DatasetInstance* otherInstance = dataset->GetInstance(
-                otherInstanceIndex);
-        nnInfo = make_pair(instanceToInstanceDistance, instanceIds[j]);
-        if(otherInstance->GetClass() == thisClass) {
-          sameSums.push_back(nnInfo);
-        } else {
-          ClassLevel otherClass = otherInstance->GetClass();
-          diffSums[otherClass].push_back(nnInfo);
-        }
+        AddNeighborCandidate(neighbors, selectK, j, distanceRow[j], slots[j]);
+      }
+      StoreNeighbors(neighborTable, instanceIndices[i], neighbors,
+                     sortByDistance, instanceIndices, sorted);
+      neighborGaps[i] = numeric_limits<double>::max();
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        neighborGaps[i] = min(neighborGaps[i],
+                              NeighborBoundaryGap(neighbors.slotDistances[slot],
+                                                  selectK));
       }
-      thisInstance->SetDistanceSums(k, sameSums, diffSums);
-    }
-
-    if(i && (i % 100 == 0)) {
-      cout << Timestamp() << i << "/" << numInstances << endl;
     }
   }
   cout << Timestamp() << numInstances << "/" << numInstances << " done"
           << endl;
+  if(numKept) {
+    cout << Timestamp() << "Nearest neighbors unchanged for " << numKept
+            << "/" << numInstances << " instances" << endl;
+  }
 
   cout << Timestamp() << "3) Calculating weight by distance factors for "
           << "nearest neighbors... " << endl;
   ComputeWeightByDistanceFactors();
 
-  // release the dynamically-allocated distance matrix
-  cout << Timestamp() << "Freeing distance matrix memory";
-  for(int i = 0; i < numInstances; ++i) {
-    delete[] distanceMatrix[i];
-  }
-  delete[] distanceMatrix;
-  cout << " done" << endl;
-
   return true;
 }
 
@@ -917,49 +1774,774 @@ AttributeScores ReliefF::ComputeScores() {
   return GetScores();
 }
 
+bool ReliefF::ComputeScoresForKs(const vector<unsigned int>& ks,
+                                 vector<AttributeScores>& kScores) {
+  kScores.clear();
+  if(ks.empty()) {
+    return true;
+  }
+  // SetK may lower a k to the class sizes: sum the scores of each distinct
+  // k actually used
+  vector<unsigned int> sumKs;
+  vector<unsigned int> sumKIndices;
+  for(unsigned int kIdx = 0; kIdx < ks.size(); ++kIdx) {
+    if(!SetK(ks[kIdx])) {
+      cerr << "ERROR: k = " << ks[kIdx] << " is out of range" << endl;
+      return false;
+    }
+    if(sumKs.empty() || (k > sumKs.back())) {
+      sumKs.push_back(k);
+    }
+    sumKIndices.push_back(sumKs.size() - 1);
+  }
+
+  // the neighbors of each k begin with the neighbors of every smaller k, so
+  // one pass over the neighbors of the largest k scores all of them
+  cout << Timestamp() << "--------------------------" << endl;
+  cout << Timestamp() << "Running ReliefSeq for k=" << sumKs.front()
+          << " to " << sumKs.back() << " in one pass" << endl;
+  dataset->ResetNearestNeighbors();
+  SetNeighborsMaxK(sumKs.back());
+  PreComputeDistances();
+  SetNeighborsMaxK(0);
+
+  MetricContext context = dataset->GetMetricContext(snpMetric);
+  AttributeScoresForKsKernels::Kernel kernel =
+          SelectMetricKernel<AttributeScoresForKsKernels>(
+          snpMetricType, numMetricType, context.snpDiffTables != 0);
+  vector<vector<double> > kW;
+  if(!(this->*kernel)(context, sumKs, kW)) {
+    return false;
+  }
+  for(unsigned int kIdx = 0; kIdx < ks.size(); ++kIdx) {
+    W = kW[sumKIndices[kIdx]];
+    kScores.push_back(GetScores());
+  }
+
+  return true;
+}
+
+bool ReliefF::LoadNeighbors() {
+  unsigned int selectK = max(k, neighborsMaxK);
+  vector<string> neighborMetrics = NeighborSelectionKey();
+  cout << Timestamp() << "Loading nearest neighbors from "
+          << loadNeighborsFilename << endl;
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  if(!neighborTable.Load(loadNeighborsFilename,
+                         dataset->MaskNeighborFingerprint(),
+                         dataset->MaskGetInstanceIndices(), neighborMetrics,
+                         (neighborhood == "knn") ? selectK : 0)) {
+    cout << Timestamp() << "Selecting the nearest neighbors instead" << endl;
+    return false;
+  }
+  if(neighborTable.K()) {
+    cout << Timestamp() << "Loaded " << neighborTable.K()
+            << " nearest neighbors per class" << endl;
+  } else {
+    cout << Timestamp() << "Loaded the " << neighborhood
+            << " neighborhoods" << endl;
+  }
+
+  // no distances or boundary gaps: nested neighbors serve every k up to
+  // theirs
+  distanceMatrix.Clear();
+  neighborGaps.clear();
+  neighborGapsK = neighborTable.K();
+  neighborsNested = NestedNeighbors();
+
+  return true;
+}
+
+bool ReliefF::SaveNeighbors() {
+  vector<string> neighborMetrics = NeighborSelectionKey();
+  cout << Timestamp() << "Saving nearest neighbors to "
+          << saveNeighborsFilename << endl;
+  return dataset->GetNeighborTable().Save(saveNeighborsFilename,
+                                          dataset->MaskNeighborFingerprint(),
+                                          dataset->MaskGetInstanceIndices(),
+                                          neighborMetrics);
+}
+
+vector<string> ReliefF::NeighborSelectionKey() {
+  // the SNP weight metric is kept: KM and JC also change instance distances
+  vector<string> neighborMetrics = dataset->GetDistanceMetrics();
+  neighborMetrics.push_back(neighborhood);
+  // without nested k-prefixes, ties at the k-th distance depend on k
+  if(neighborhood == "knn") {
+    neighborMetrics.push_back(NestedNeighbors() ? "nested" :
+                              "k " + lexical_cast<string>(k));
+  }
+  // approximate LSH neighbors must not be loaded as exact ones, nor as those
+  // of LSH keys drawn with another seed
+  if(lshTables) {
+    neighborMetrics.push_back("lsh " + lexical_cast<string>(lshTables) +
+                              " " + lexical_cast<string>(lshKeySize) + " " +
+                              lexical_cast<string>(dataset->GetRandomSeed()));
+  } else {
+    neighborMetrics.push_back(neighborSearch);
+  }
+
+  return neighborMetrics;
+}
+
+bool ReliefF::NestedNeighbors() {
+  return neighborsMaxK > 0;
+}
+
 bool ReliefF::ComputeWeightByDistanceFactors() {
-  vector<string> instanceIds = dataset->GetInstanceIds();
-  for(unsigned int i = 0; i < dataset->NumInstances(); ++i) {
-
-    // this instance
-    unsigned int instanceIndex;
-    dataset->GetInstanceIndexForID(instanceIds[i], instanceIndex);
-    DatasetInstance* dsi = dataset->GetInstance(instanceIndex);
-
-    vector<double> d1_ij;
-    double d1_ij_sum = 0.0;
-    for(unsigned int rank_j = 1; rank_j <= k; ++rank_j) {
-      double d1_ij_value = 0.0;
-      if(weightByDistanceMethod == "exponential") {
-        double exponentArg = (double) rank_j / weightByDistanceSigma;
-        d1_ij_value = exp(-(exponentArg * exponentArg));
+  vector<double> influenceFactors;
+  ComputeInfluenceFactors(influenceFactors);
+
+  // only the sampled instances' factors are read
+  vector<unsigned int> instanceIndices(sampledInstanceIndices);
+  sort(instanceIndices.begin(), instanceIndices.end());
+  instanceIndices.erase(unique(instanceIndices.begin(), instanceIndices.end()),
+                        instanceIndices.end());
+  for(unsigned int i = 0; i < instanceIndices.size(); ++i) {
+    DatasetInstance* dsi = dataset->GetInstance(instanceIndices[i]);
+    dsi->ClearInfluenceFactors();
+    for(unsigned int neighborIdx = 0; neighborIdx < k; ++neighborIdx) {
+      dsi->AddInfluenceFactorD(influenceFactors[neighborIdx]);
+    }
+  } // end all instances
+
+  return true;
+}
+
+void ReliefF::ComputeInfluenceFactors(vector<double>& influenceFactors) {
+  vector<double> d1_ij;
+  double d1_ij_sum = 0.0;
+  for(unsigned int rank_j = 1; rank_j <= k; ++rank_j) {
+    double d1_ij_value = 0.0;
+    if(weightByDistanceMethod == "exponential") {
+      double exponentArg = (double) rank_j / weightByDistanceSigma;
+      d1_ij_value = exp(-(exponentArg * exponentArg));
+    } else {
+      if(weightByDistanceMethod == "one_over_k") {
+        d1_ij_value = 1.0 / (double) rank_j;
       } else {
-        if(weightByDistanceMethod == "one_over_k") {
-          d1_ij_value = 1.0 / (double) rank_j;
-        } else {
-          // equal
-          d1_ij_value = 1.0 / (double) k;
+        // equal
+        d1_ij_value = 1.0 / (double) k;
+      }
+    }
+    d1_ij.push_back(d1_ij_value);
+    d1_ij_sum += d1_ij_value;
+  }
+
+  // "normalize" the factors - divide through by the total/sum
+  influenceFactors.resize(k);
+  for(unsigned int neighborIdx = 0; neighborIdx < k; ++neighborIdx) {
+    influenceFactors[neighborIdx] = d1_ij[neighborIdx] / d1_ij_sum;
+  }
+}
+
+void ReliefF::SampleInstances() {
+  if(randomlySelect) {
+    // randomly sample instances without replacement, reproducible from the
+    // data set's random seed
+    bool sampled = false;
+    if(sampling == "stratified") {
+      sampled = dataset->SampleInstanceIndicesStratified(
+              m, sampledInstanceIndices);
+    } else {
+      sampled = dataset->SampleInstanceIndices(m, sampledInstanceIndices);
+    }
+    if(!sampled) {
+      cerr << "ERROR: could not sample " << m << " instances" << endl;
+      exit(EXIT_FAILURE);
+    }
+    return;
+  }
+  // deterministic/indexed instance sampling, ie, every instance against
+  // every other instance
+  sampledInstanceIndices.resize(m);
+  vector<string> instanceIds = dataset->GetInstanceIds();
+  for(unsigned int i = 0; i < m; i++) {
+    dataset->GetInstanceIndexForID(instanceIds[i], sampledInstanceIndices[i]);
+  }
+}
+
+bool ReliefF::NeedsOnlySampledNeighbors() {
+  return true;
+}
+
+bool ReliefF::SelectSampledNeighborsOnly() {
+  return randomlySelect && (m < dataset->NumInstances()) &&
+          NeedsOnlySampledNeighbors() && (neighborhood == "knn") &&
+          !neighborsMaxK && (saveNeighborsFilename == "");
+}
+
+bool ReliefF::PreComputeNeighborsSampled() {
+  vector<string> instanceIds = dataset->MaskGetInstanceIds();
+  int numInstances = instanceIds.size();
+  distanceMatrix.Clear();
+  unsigned int selectK = max(k, neighborsMaxK);
+  bool nested = NestedNeighbors();
+  bool sortByDistance = nested || dataset->HasContinuousPhenotypes();
+  dataset->AllocateNeighborTable(selectK);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  unsigned int numSlots = neighborTable.NumSlots();
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+
+  // instance mask positions of the distinct sampled instances
+  vector<int> maskPositions(*max_element(instanceIndices.begin(),
+                                         instanceIndices.end()) + 1, -1);
+  for(int i = 0; i < numInstances; ++i) {
+    maskPositions[instanceIndices[i]] = i;
+  }
+  vector<unsigned int> sampledRows;
+  for(unsigned int i = 0; i < m; i++) {
+    unsigned int instanceIndex = sampledInstanceIndices[i];
+    if((instanceIndex >= maskPositions.size()) ||
+       (maskPositions[instanceIndex] < 0)) {
+      cerr << "ERROR: sampled instance index " << instanceIndex
+              << " is not in the instance mask" << endl;
+      return false;
+    }
+    sampledRows.push_back(maskPositions[instanceIndex]);
+  }
+  sort(sampledRows.begin(), sampledRows.end());
+  sampledRows.erase(unique(sampledRows.begin(), sampledRows.end()),
+                    sampledRows.end());
+  int numSampledRows = sampledRows.size();
+
+  cout << Timestamp() << "1) Computing distances from " << numSampledRows
+          << " sampled instances to " << numInstances << " instances" << endl;
+  dataset->PrepareInstanceDistances();
+  bool floatPrecision =
+          (dataset->GetDistancePrecision() == FLOAT_PRECISION);
+#pragma omp parallel
+  {
+    InstanceNeighbors neighbors;
+    neighbors.slots.assign(
+            numSlots, NeighborCandidates(selectK, candidate_less(nested)));
+    neighbors.slotDistances.resize(numSlots);
+    vector<NeighborCandidate> sorted;
+#pragma omp for schedule(dynamic, NEIGHBOR_ROW_CHUNK)
+    for(int s = 0; s < numSampledRows; ++s) {
+      int i = sampledRows[s];
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        neighbors.slots[slot].clear();
+        neighbors.slotDistances[slot].clear();
+      }
+      for(int j = 0; j < numInstances; ++j) {
+        if(i == j)
+          continue;
+        double distance = dataset->ComputeMaskedInstanceDistance(i, j);
+        if(floatPrecision) {
+          // as stored in a float distance matrix
+          distance = (float) distance;
         }
+        AddNeighborCandidate(neighbors, selectK, j, distance, slots[j]);
       }
-      d1_ij.push_back(d1_ij_value);
-      d1_ij_sum += d1_ij_value;
+      StoreNeighbors(neighborTable, instanceIndices[i], neighbors,
+                     sortByDistance, instanceIndices, sorted);
     }
+  }
+  cout << Timestamp() << numSampledRows << "/" << numSampledRows << " done"
+          << endl;
 
-    // "normalize" the factors - divide through by the total/sum
-    dsi->ClearInfluenceFactors();
-    for(unsigned int neighborIdx = 0; neighborIdx < k; ++neighborIdx) {
-      double influenceFactorD = d1_ij[neighborIdx] / d1_ij_sum;
-      //      cout << "d_ij: " << d1_ij[neighborIdx]
-      //              << ", cummulative sum: " << d1_ij_sum
-      //              << ", normalized value: " << influenceFactorD << endl;
-      dsi->AddInfluenceFactorD(influenceFactorD);
+  // no boundary gaps: the neighbors of other instances are not selected
+  neighborGaps.clear();
+  neighborGapsK = selectK;
+  neighborsNested = nested;
+
+  cout << Timestamp() << "3) Calculating weight by distance factors for "
+          << "nearest neighbors... " << endl;
+  ComputeWeightByDistanceFactors();
+
+  return true;
+}
+
+bool ReliefF::PreComputeNeighborsStreaming() {
+  vector<string> instanceIds = dataset->MaskGetInstanceIds();
+  int numInstances = instanceIds.size();
+  cout << Timestamp() << "Streaming nearest neighbors " << STREAMING_ROW_BLOCK
+          << " instances at a time" << endl;
+  distanceMatrix.Clear();
+  unsigned int selectK = max(k, neighborsMaxK);
+  bool nested = NestedNeighbors();
+  bool sortByDistance = nested || dataset->HasContinuousPhenotypes();
+  dataset->AllocateNeighborTable(selectK);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  unsigned int numSlots = neighborTable.NumSlots();
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+
+  // candidates are added to each instance in instance mask order, j = 0, 1,
+  // ..., as the distance matrix rows are scanned, so the best_n selection
+  // picks the same neighbors from them as from whole rows
+  InstanceNeighbors emptyNeighbors;
+  emptyNeighbors.slots.assign(
+          numSlots, NeighborCandidates(selectK, candidate_less(nested)));
+  emptyNeighbors.slotDistances.resize(numSlots);
+  vector<InstanceNeighbors> neighbors(numInstances, emptyNeighbors);
+  dataset->PrepareInstanceDistances();
+  vector<double> distances;
+  for(int rowBegin = 0; rowBegin < numInstances;
+      rowBegin += STREAMING_ROW_BLOCK) {
+    int rowEnd = min(rowBegin + (int) STREAMING_ROW_BLOCK, numInstances);
+    if(!dataset->ComputeDistanceRowBlock(rowBegin, rowEnd, distances)) {
+      cerr << "ERROR: Could not compute the distances of instances "
+              << rowBegin << " to " << rowEnd << endl;
+      return false;
     }
-    //    cout << "---------------------------------------------------------" << endl;
-  } // end all instances
+    size_t numCols = numInstances - rowBegin;
+#pragma omp parallel for schedule(dynamic, STREAMING_ROW_BLOCK)
+    for(int t = rowBegin; t < numInstances; ++t) {
+      // the block rows before t, then the rest of row t if in the block
+      for(int j = rowBegin; j < min(t, rowEnd); ++j) {
+        AddNeighborCandidate(neighbors[t], selectK, j,
+                distances[(j - rowBegin) * numCols + (t - rowBegin)],
+                slots[j]);
+      }
+      if(t < rowEnd) {
+        for(int j = t + 1; j < numInstances; ++j) {
+          AddNeighborCandidate(neighbors[t], selectK, j,
+                  distances[(t - rowBegin) * numCols + (j - rowBegin)],
+                  slots[j]);
+        }
+      }
+    }
+    cout << Timestamp() << rowEnd << "/" << numInstances << endl;
+  }
+
+  // store the neighbors selected from the candidates
+  neighborGaps.assign(numInstances, numeric_limits<double>::max());
+  neighborGapsK = selectK;
+  neighborsNested = nested;
+  vector<NeighborCandidate> sorted;
+  for(int i = 0; i < numInstances; ++i) {
+    InstanceNeighbors& thisNeighbors = neighbors[i];
+    StoreNeighbors(neighborTable, instanceIndices[i], thisNeighbors,
+                   sortByDistance, instanceIndices, sorted);
+    for(unsigned int slot = 0; slot < numSlots; ++slot) {
+      neighborGaps[i] = min(neighborGaps[i],
+                            NeighborBoundaryGap(thisNeighbors.slotDistances[slot],
+                                                selectK));
+    }
+  }
+  cout << Timestamp() << numInstances << "/" << numInstances << " done"
+          << endl;
+
+  cout << Timestamp() << "3) Calculating weight by distance factors for "
+          << "nearest neighbors... " << endl;
+  ComputeWeightByDistanceFactors();
 
   return true;
 }
 
+bool ReliefF::PreComputeNeighborsVpTree() {
+  vector<string> instanceIds = dataset->MaskGetInstanceIds();
+  int numInstances = instanceIds.size();
+  distanceMatrix.Clear();
+  unsigned int selectK = max(k, neighborsMaxK);
+  dataset->AllocateNeighborTable(selectK);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  unsigned int numSlots = neighborTable.NumSlots();
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+  dataset->PrepareInstanceDistances();
+  DistancePrecision precision = dataset->GetDistancePrecision();
+
+  // one tree per slot: hits and misses are separate class queries
+  cout << Timestamp() << "1) Building VP-trees over " << numInstances
+          << " instances" << endl;
+  vector<vector<unsigned int> > slotRows(numSlots);
+  for(int j = 0; j < numInstances; ++j) {
+    slotRows[slots[j]].push_back(j);
+  }
+  vector<VpTree> trees(numSlots);
+  double numBuildDistances = 0.0;
+#pragma omp parallel for schedule(dynamic) reduction(+:numBuildDistances)
+  for(int slot = 0; slot < (int) numSlots; ++slot) {
+    numBuildDistances += trees[slot].Build(dataset, slotRows[slot]);
+  }
+
+  cout << Timestamp() << "2) Searching the VP-trees for nearest neighbors..."
+          << endl;
+  double numSearchDistances = 0.0;
+#pragma omp parallel
+  {
+    vector<NeighborCandidate> nearest;
+#pragma omp for schedule(dynamic, NEIGHBOR_ROW_CHUNK) \
+    reduction(+:numSearchDistances)
+    for(int i = 0; i < numInstances; ++i) {
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        numSearchDistances += trees[slot].Search(i, selectK, precision,
+                                                 nearest);
+        neighborTable.SetNeighbors(instanceIndices[i], slot, nearest,
+                                   instanceIndices);
+      }
+    }
+  }
+  cout << Timestamp() << numInstances << "/" << numInstances << " done, "
+          << (numInstances ?
+              (numBuildDistances + numSearchDistances) / numInstances : 0.0)
+          << " distances per instance" << endl;
+
+  // no boundary gaps: neighbors are only reused for smaller k
+  neighborGaps.clear();
+  neighborGapsK = selectK;
+  // the k smallest by distance then position serve every smaller k
+  neighborsNested = true;
+
+  cout << Timestamp() << "3) Calculating weight by distance factors for "
+          << "nearest neighbors... " << endl;
+  ComputeWeightByDistanceFactors();
+
+  return true;
+}
+
+bool ReliefF::PreComputeNeighborsRadius() {
+  if(lshTables || (neighborSearch != "exact")) {
+    cout << Timestamp() << "WARNING: " << neighborhood << " neighborhoods "
+            << "are found from the distance matrix; ignoring the nearest "
+            << "neighbor search" << endl;
+  }
+  vector<string> instanceIds = dataset->MaskGetInstanceIds();
+  int numInstances = instanceIds.size();
+  double matrixBytes = (double) numInstances * numInstances * sizeof(double);
+  if(dataset->GetDistancePrecision() == FLOAT_PRECISION) {
+    matrixBytes = (double) numInstances * numInstances * sizeof(float);
+  }
+  // too large a matrix: two passes over streamed distances instead
+  bool streaming = distanceMemoryLimit &&
+          (matrixBytes > (double) distanceMemoryLimit * 1024.0 * 1024.0);
+
+  vector<double> thresholds;
+  if(streaming) {
+    cout << Timestamp() << "1) Streaming instance-to-instance distances "
+            << "for their means: the distance matrix exceeds the "
+            << distanceMemoryLimit << " MB distance memory limit" << endl;
+    distanceMatrix.Clear();
+    dataset->PrepareInstanceDistances();
+    vector<double> rowSums;
+    vector<double> rowSquareSums;
+    if(!dataset->ComputeDistanceRowSums(rowSums, rowSquareSums)) {
+      cerr << "ERROR: Could not compute the distance means" << endl;
+      return false;
+    }
+    RadiusThresholds(neighborhood, rowSums, rowSquareSums, thresholds);
+  } else {
+    // the distance statistics are summed as the distances are stored
+    cout << Timestamp() << "1) Computing instance-to-instance distances and "
+            << "their means..." << endl;
+    vector<double> rowChanges;
+    if(!dataset->UpdateDistanceMatrix(distanceMatrix, rowChanges, true)) {
+      cerr << "ERROR: Could not compute the distance matrix" << endl;
+      return false;
+    }
+    thresholds.assign(numInstances, distanceMatrix.Mean());
+    if(neighborhood == "multisurf") {
+      for(int i = 0; i < numInstances; ++i) {
+        thresholds[i] = distanceMatrix.RowMean(i) -
+                distanceMatrix.RowStandardDeviation(i) / 2.0;
+      }
+    }
+  }
+  cout << Timestamp() << numInstances << "/" << numInstances << " done"
+          << endl;
+  if(neighborhood == "multisurf") {
+    double thresholdSum = 0.0;
+    for(int i = 0; i < numInstances; ++i) {
+      thresholdSum += thresholds[i];
+    }
+    cout << Timestamp() << "Mean neighborhood distance threshold: "
+            << (numInstances ? thresholdSum / numInstances : 0.0) << endl;
+  } else {
+    cout << Timestamp() << "Neighborhood distance threshold: "
+            << (numInstances ? thresholds[0] : 0.0) << endl;
+  }
+
+  cout << Timestamp() << "2) Finding the neighbors within the distance "
+          << "thresholds..." << endl;
+  dataset->AllocateNeighborTable(0);
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+  unsigned int numSlots = dataset->GetNeighborTable().NumSlots();
+  vector<vector<NeighborCandidate> > rowNeighbors(
+          (size_t) numInstances * numSlots);
+  if(streaming) {
+    vector<double> distances;
+    for(int rowBegin = 0; rowBegin < numInstances;
+        rowBegin += STREAMING_ROW_BLOCK) {
+      int rowEnd = min(rowBegin + (int) STREAMING_ROW_BLOCK, numInstances);
+      if(!dataset->ComputeDistanceRowBlock(rowBegin, rowEnd, distances)) {
+        cerr << "ERROR: Could not compute the distances of instances "
+                << rowBegin << " to " << rowEnd << endl;
+        return false;
+      }
+      size_t numCols = numInstances - rowBegin;
+#pragma omp parallel for schedule(dynamic, STREAMING_ROW_BLOCK)
+      for(int t = rowBegin; t < numInstances; ++t) {
+        // the block rows before t, then the rest of row t if in the block
+        vector<NeighborCandidate>* neighbors =
+                &rowNeighbors[(size_t) t * numSlots];
+        for(int j = rowBegin; j < min(t, rowEnd); ++j) {
+          double distance = distances[(j - rowBegin) * numCols +
+                  (t - rowBegin)];
+          if(distance < thresholds[t]) {
+            neighbors[slots[j]].push_back(make_pair(distance, j));
+          }
+        }
+        if(t < rowEnd) {
+          for(int j = t + 1; j < numInstances; ++j) {
+            double distance = distances[(t - rowBegin) * numCols +
+                    (j - rowBegin)];
+            if(distance < thresholds[t]) {
+              neighbors[slots[j]].push_back(make_pair(distance, j));
+            }
+          }
+        }
+      }
+      cout << Timestamp() << rowEnd << "/" << numInstances << endl;
+    }
+#pragma omp parallel for schedule(dynamic, NEIGHBOR_ROW_CHUNK)
+    for(int i = 0; i < numInstances; ++i) {
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        vector<NeighborCandidate>& neighbors =
+                rowNeighbors[(size_t) i * numSlots + slot];
+        sort(neighbors.begin(), neighbors.end());
+      }
+    }
+  } else {
+#pragma omp parallel
+    {
+      vector<double> distanceRow;
+#pragma omp for schedule(dynamic, NEIGHBOR_ROW_CHUNK)
+      for(int i = 0; i < numInstances; ++i) {
+        distanceMatrix.GetRow(i, distanceRow);
+        vector<NeighborCandidate>* neighbors =
+                &rowNeighbors[(size_t) i * numSlots];
+        for(int j = 0; j < numInstances; ++j) {
+          if((j != i) && (distanceRow[j] < thresholds[i])) {
+            neighbors[slots[j]].push_back(make_pair(distanceRow[j], j));
+          }
+        }
+        for(unsigned int slot = 0; slot < numSlots; ++slot) {
+          sort(neighbors[slot].begin(), neighbors[slot].end());
+        }
+      }
+    }
+  }
+
+  // slots sized to their neighbors
+  vector<unsigned int> capacities((size_t) dataset->NumInstances() * numSlots,
+                                  0);
+  double numNeighbors = 0.0;
+  for(int i = 0; i < numInstances; ++i) {
+    for(unsigned int slot = 0; slot < numSlots; ++slot) {
+      unsigned int slotNeighbors = rowNeighbors[(size_t) i * numSlots +
+              slot].size();
+      capacities[(size_t) instanceIndices[i] * numSlots + slot] =
+              slotNeighbors;
+      numNeighbors += slotNeighbors;
+    }
+  }
+  dataset->AllocateNeighborTable(capacities);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  for(int i = 0; i < numInstances; ++i) {
+    for(unsigned int slot = 0; slot < numSlots; ++slot) {
+      vector<NeighborCandidate>& neighbors =
+              rowNeighbors[(size_t) i * numSlots + slot];
+      neighborTable.SetNeighbors(instanceIndices[i], slot, neighbors,
+                                 instanceIndices);
+      vector<NeighborCandidate>().swap(neighbors);
+    }
+  }
+  cout << Timestamp() << (numInstances ? numNeighbors / numInstances : 0.0)
+          << " neighbors per instance" << endl;
+
+  // neighbors are reselected whenever the distances change
+  neighborGaps.clear();
+  neighborGapsK = 0;
+  neighborsNested = false;
+
+  cout << Timestamp() << "3) Calculating weight by distance factors for "
+          << "nearest neighbors... " << endl;
+  ComputeWeightByDistanceFactors();
+
+  return true;
+}
+
+bool ReliefF::PreComputeNeighborsLsh() {
+  vector<string> instanceIds = dataset->MaskGetInstanceIds();
+  int numInstances = instanceIds.size();
+  distanceMatrix.Clear();
+  unsigned int selectK = max(k, neighborsMaxK);
+  bool nested = NestedNeighbors();
+  bool sortByDistance = nested || dataset->HasContinuousPhenotypes();
+  dataset->AllocateNeighborTable(selectK);
+  NeighborTable& neighborTable = dataset->GetNeighborTable();
+  unsigned int numSlots = neighborTable.NumSlots();
+  vector<unsigned int> instanceIndices;
+  vector<unsigned int> slots;
+  GetNeighborTableRows(dataset, instanceIds, instanceIndices, slots);
+  dataset->PrepareInstanceDistances();
+
+  cout << Timestamp() << "1) Hashing genotypes into " << lshTables
+          << " LSH tables of " << lshKeySize << " SNPs" << endl;
+  GenotypeLsh lsh;
+  PhiloxRandom lshRandom = dataset->GetRandomStream(LSH_RANDOM_STREAM);
+  if(!lsh.Build(dataset, instanceIndices,
+                dataset->MaskGetAttributeIndices(DISCRETE_TYPE), lshTables,
+                lshKeySize, lshRandom)) {
+    cerr << "ERROR: Could not build the LSH tables" << endl;
+    return false;
+  }
+
+  // instances of each slot, to tell when a row has too few candidates
+  vector<unsigned int> slotSizes(numSlots, 0);
+  for(int j = 0; j < numInstances; ++j) {
+    ++slotSizes[slots[j]];
+  }
+
+  cout << Timestamp() << "2) Re-ranking LSH candidates by exact distance..."
+          << endl;
+  double numCandidates = 0.0;
+  unsigned int numExact = 0;
+#pragma omp parallel
+  {
+    vector<unsigned int> candidates;
+    vector<unsigned int> slotCandidates(numSlots);
+    InstanceNeighbors neighbors;
+    neighbors.slots.assign(
+            numSlots, NeighborCandidates(selectK, candidate_less(nested)));
+    vector<NeighborCandidate> sorted;
+#pragma omp for schedule(dynamic, NEIGHBOR_ROW_CHUNK) \
+    reduction(+:numCandidates, numExact)
+    for(int i = 0; i < numInstances; ++i) {
+      lsh.Candidates(i, candidates);
+      fill(slotCandidates.begin(), slotCandidates.end(), 0);
+      for(unsigned int c = 0; c < candidates.size(); ++c) {
+        ++slotCandidates[slots[candidates[c]]];
+      }
+      // too few candidates of some class: search every instance
+      bool enoughCandidates = true;
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        unsigned int slotSize = slotSizes[slot];
+        if(slot == slots[i]) {
+          --slotSize;
+        }
+        if(slotCandidates[slot] < min(selectK, slotSize)) {
+          enoughCandidates = false;
+        }
+      }
+      if(!enoughCandidates) {
+        candidates.clear();
+        for(int j = 0; j < numInstances; ++j) {
+          if(j != i) {
+            candidates.push_back(j);
+          }
+        }
+        ++numExact;
+      }
+      numCandidates += candidates.size();
+
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        neighbors.slots[slot].clear();
+      }
+      for(unsigned int c = 0; c < candidates.size(); ++c) {
+        unsigned int j = candidates[c];
+        neighbors.slots[slots[j]].add(
+                make_pair(dataset->ComputeMaskedInstanceDistance(i, j), j));
+      }
+      StoreNeighbors(neighborTable, instanceIndices[i], neighbors,
+                     sortByDistance, instanceIndices, sorted);
+    }
+  }
+  cout << Timestamp() << numInstances << "/" << numInstances << " done, "
+          << (numInstances ? numCandidates / numInstances : 0.0)
+          << " candidates per instance, " << numExact
+          << " instances searched exactly" << endl;
+
+  // no boundary gaps: neighbors are only reused for smaller k
+  neighborGaps.clear();
+  neighborGapsK = selectK;
+  neighborsNested = nested;
+
+  if(lshVerifyRecall) {
+    ReportNeighborRecall(instanceIndices, slots, lshVerifyRecall);
+  }
+
+  cout << Timestamp() << "3) Calculating weight by distance factors for "
+          << "nearest neighbors... " << endl;
+  ComputeWeightByDistanceFactors();
+
+  return true;
+}
+
+void ReliefF::ReportNeighborRecall(const vector<unsigned int>& instanceIndices,
+                                   const vector<unsigned int>& slots,
+                                   unsigned int numSamples) {
+  const NeighborTable& neighborTable = dataset->GetNeighborTable();
+  unsigned int numSlots = neighborTable.NumSlots();
+  int numInstances = instanceIndices.size();
+  if(numSamples > (unsigned int) numInstances) {
+    numSamples = numInstances;
+  }
+  cout << Timestamp() << "Measuring nearest neighbor recall against exact "
+          << "search on " << numSamples << " instances" << endl;
+  double numFound = 0.0;
+  double numNeighbors = 0.0;
+#pragma omp parallel
+  {
+    vector<vector<double> > slotDistances(numSlots);
+#pragma omp for schedule(dynamic) reduction(+:numFound, numNeighbors)
+    for(int sample = 0; sample < (int) numSamples; ++sample) {
+      int i = (int) (((double) sample * numInstances) / numSamples);
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        slotDistances[slot].clear();
+      }
+      for(int j = 0; j < numInstances; ++j) {
+        if(j != i) {
+          slotDistances[slots[j]].push_back(
+                  dataset->ComputeMaskedInstanceDistance(i, j));
+        }
+      }
+      unsigned int row = instanceIndices[i];
+      for(unsigned int slot = 0; slot < numSlots; ++slot) {
+        unsigned int slotK = neighborTable.NumNeighbors(row, slot);
+        if(!slotK) {
+          continue;
+        }
+        vector<double>& exact = slotDistances[slot];
+        nth_element(exact.begin(), exact.begin() + (slotK - 1), exact.end());
+        double kthDistance = exact[slotK - 1];
+        const double* distances = neighborTable.Distances(row, slot);
+        for(unsigned int j = 0; j < slotK; ++j) {
+          if(distances[j] <= kthDistance) {
+            ++numFound;
+          }
+        }
+        numNeighbors += slotK;
+      }
+    }
+  }
+  cout << Timestamp() << "Nearest neighbor recall: "
+          << (numNeighbors ? numFound / numNeighbors : 1.0) << endl;
+}
+
+double ReliefF::NeighborBoundaryGap(vector<double>& distances,
+                                    unsigned int numNeighbors) {
+  if(distances.size() <= numNeighbors) {
+    return numeric_limits<double>::max();
+  }
+  nth_element(distances.begin(), distances.begin() + numNeighbors,
+              distances.end());
+  double nextDistance = distances[numNeighbors];
+  double kthDistance = *max_element(distances.begin(),
+                                    distances.begin() + numNeighbors);
+
+  return nextDistance - kthDistance;
+}
+
 void librelieff_is_present(void) {
   ;
 }
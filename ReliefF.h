@@ -26,10 +26,95 @@
 
 #include "AttributeRanker.h"
 #include "Dataset.h"
+#include "DistanceMatrix.h"
+#include "MetricKernels.h"
 #include "Insilico.h"
 
 namespace po = boost::program_options;
 
+/**
+ * \struct SampledNeighbors.
+ * A sampled instance and its nearest hits and misses, in neighbor table
+ * order. Each
+ * set has k neighbors, or in distance threshold neighborhoods as many as
+ * are within the threshold.
+ */
+struct SampledNeighbors
+{
+  /// sampled instance
+  DatasetInstance* instance;
+  /// nearest hits
+  std::vector<DatasetInstance*> hits;
+  /// nearest misses of each miss class
+  std::vector<std::vector<DatasetInstance*> > misses;
+  /// instance index of the sampled instance
+  unsigned int instanceIndex;
+  /// instance indices of the nearest hits
+  std::vector<unsigned int> hitIndices;
+  /// instance indices of the nearest misses of each miss class
+  std::vector<std::vector<unsigned int> > missIndices;
+  /// per miss class: P(C) / (1 - P(class of the sampled instance))
+  std::vector<double> missFactors;
+  /// number of miss classes
+  unsigned int numMissClasses;
+};
+
+/**
+ * \struct SampledNeighborSets.
+ * The neighbor sets of all m sampled instances, flattened for the weight
+ * update: per sample its hit set, then one set per miss class, each a range
+ * of setRows. Rows are the instances sampled or neighbors, in instance
+ * index order.
+ */
+struct SampledNeighborSets
+{
+  /// per row: instance index
+  std::vector<unsigned int> rowInstanceIndices;
+  /// per row: instance
+  std::vector<DatasetInstance*> rowInstances;
+  /// per sample: row of the sampled instance
+  std::vector<unsigned int> sampleRows;
+  /// per sample, and one past the last: first set of the sample, its hits
+  std::vector<unsigned int> sampleSets;
+  /// per set, and one past the last: start of the set in setRows
+  std::vector<unsigned int> setStarts;
+  /// rows of the neighbors of every set
+  std::vector<unsigned int> setRows;
+  /// per set: averaging factor of its neighbors
+  std::vector<double> averagingFactors;
+  /// per set: P(C) / (1 - P(class of the sampled instance)), 0 for hits
+  std::vector<double> missFactors;
+  /*************************************************************************//**
+   * Update an attribute's score with the diffs of a sampled instance from
+   * its hits and misses.
+   * \param [in] diff diff metric policy of the attribute
+   * \param [in] A attribute or numeric index
+   * \param [in] sample sampled instance number
+   * \param [in] score attribute score
+   * \return updated score
+   ****************************************************************************/
+  template<class Metric>
+  double UpdateScore(const Metric& diff, unsigned int A, unsigned int sample,
+                     double score) const {
+    DatasetInstance* R_i = rowInstances[sampleRows[sample]];
+    unsigned int set = sampleSets[sample];
+    double hitSum = 0.0, missSum = 0.0;
+    for(unsigned int j = setStarts[set]; j < setStarts[set + 1]; j++) {
+      hitSum += (diff.Diff(A, R_i, rowInstances[setRows[j]]) *
+              averagingFactors[set]);
+    }
+    for(++set; set < sampleSets[sample + 1]; ++set) {
+      double tempSum = 0.0;
+      for(unsigned int j = setStarts[set]; j < setStarts[set + 1]; j++) {
+        tempSum += (diff.Diff(A, R_i, rowInstances[setRows[j]]) *
+                averagingFactors[set]);
+      }
+      missSum += (missFactors[set] * tempSum);
+    }
+    return score - hitSum + missSum;
+  }
+};
+
 class ReliefF : public AttributeRanker
 {
 public:
@@ -76,46 +161,296 @@ public:
    * \param [in] baseFIlename filename to write score-attribute name pairs
    ****************************************************************************/
   void WriteAttributeScores(std::string baseFilename);
-  /// Precompute all pairwise instance-to-instance distances.
+  /*************************************************************************//**
+   * Precompute all pairwise instance-to-instance distances and the nearest
+   * neighbors of every instance. Streams the distances instead of storing
+   * the distance matrix if the matrix would exceed the distance memory limit.
+   * With a neighbors max k set, selects that many neighbors once and reuses
+   * them for every k up to it. Loads the neighbors from a neighbors file
+   * saved for the same data, or saves the first neighbors selected.
+   * \return success
+   ****************************************************************************/
   bool PreComputeDistances();
   /// Overrides base class method.
   AttributeScores GetScores();
   /// Implements AttributeRanker interface.
   AttributeScores ComputeScores();
+  /*************************************************************************//**
+   * Compute the ReliefF scores for each k of a k optimization sweep in one
+   * pass over the nearest neighbors of the largest k, adding the diffs of
+   * each neighbor rank to the scores of every k that includes it. Rankers
+   * whose scores are not sums of per-neighbor diffs override it to score one
+   * k at a time with AttributeRanker::ComputeScoresForKs.
+   * \param [in] ks values of k, ascending
+   * \param [out] kScores scores for each k
+   * \return success
+   ****************************************************************************/
+  virtual bool ComputeScoresForKs(const std::vector<unsigned int>& ks,
+                                  std::vector<AttributeScores>& kScores);
+  /*************************************************************************//**
+   * Are the nearest neighbors of the m sampled instances all the scores
+   * read? If so, and fewer instances are sampled than there are, only the
+   * distances from the sampled instances are computed.
+   * \return are only the sampled instances' neighbors read?
+   ****************************************************************************/
+  virtual bool NeedsOnlySampledNeighbors();
 private:
   /// no default constructor
   ReliefF();
 protected:
   /// Compute theconst AttributeScores& ComputeScores(); weight by distance factors for nearest neighbors.
   bool ComputeWeightByDistanceFactors();
+  /*************************************************************************//**
+   * Compute the influence factor of each of the k nearest neighbor ranks,
+   * normalized to sum to one; the same for every instance.
+   * \param [out] influenceFactors influence factor per neighbor rank
+   ****************************************************************************/
+  void ComputeInfluenceFactors(std::vector<double>& influenceFactors);
+  /*************************************************************************//**
+   * Update the attribute scores W from the m sampled instances and their
+   * nearest neighbors, specialized for the SNP and numeric metric policies.
+   * \param [in] context data set state read by the metric policies
+   * \return success
+   ****************************************************************************/
+  template<class SnpMetric, class NumericMetric>
+  bool ComputeAttributeScoresKernel(const MetricContext& context);
+  /// ComputeAttributeScoresKernel instantiations for SelectMetricKernel
+  struct AttributeScoresKernels
+  {
+    typedef bool (ReliefF::*Kernel)(const MetricContext&);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &ReliefF::ComputeAttributeScoresKernel<SnpMetric, NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Update the attribute scores W in parallel over blocks of attributes or,
+   * see ParallelOverInstances, chunks of sampled instances. Looks up the
+   * neighbor sets of all m sampled instances first. Over attributes, each
+   * thread transposes the genotypes of its block to attribute-major diff
+   * table codes and accumulates the scores of its own attributes, in the
+   * same order as ComputeAttributeScoresKernel. Over instances, each chunk
+   * accumulates its own scores, summed by SumChunkScores. Requires compiled
+   * SNP diff tables if the data set has genotypes.
+   * \param [in] context data set state read by the metric policies
+   * \return success
+   ****************************************************************************/
+  template<class NumericMetric>
+  bool ComputeAttributeBlockScoresKernel(const MetricContext& context);
+  /// ComputeAttributeBlockScoresKernel instantiations for
+  /// SelectNumericMetricKernel
+  struct AttributeBlockScoresKernels
+  {
+    typedef bool (ReliefF::*Kernel)(const MetricContext&);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &ReliefF::ComputeAttributeBlockScoresKernel<NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Update the scores of several k's from the m sampled instances and the
+   * prefixes of their nearest neighbors, specialized for the SNP and numeric
+   * metric policies.
+   * \param [in] context data set state read by the metric policies
+   * \param [in] ks values of k, strictly ascending
+   * \param [out] kW attribute scores for each k
+   * \return success
+   ****************************************************************************/
+  template<class SnpMetric, class NumericMetric>
+  bool ComputeAttributeScoresForKsKernel(const MetricContext& context,
+                                         const std::vector<unsigned int>& ks,
+                                         std::vector<std::vector<double> >& kW);
+  /// ComputeAttributeScoresForKsKernel instantiations for SelectMetricKernel
+  struct AttributeScoresForKsKernels
+  {
+    typedef bool (ReliefF::*Kernel)(const MetricContext&,
+                                    const std::vector<unsigned int>&,
+                                    std::vector<std::vector<double> >&);
+    template<class SnpMetric, class NumericMetric>
+    static Kernel Get() {
+      return &ReliefF::ComputeAttributeScoresForKsKernel<SnpMetric,
+              NumericMetric>;
+    }
+  };
+  /*************************************************************************//**
+   * Update the genotype attribute scores W with the gm metric from packed
+   * bitplanes, 64 attributes per word: XOR the sampled instance's planes
+   * with each neighbor's and add the mismatch and missing bits to bit-sliced
+   * counters of the hits and of each distinct miss factor, across all m
+   * sampled instances. Each miss factor, P(C) / (1 - P(class of the sampled
+   * instance)), is applied once per attribute to the counts of its misses.
+   * Requires k nearest neighbors, all averaged by 1/(m*k).
+   * \param [in] sets neighbor sets of the sampled instances
+   * \param [in] attributeIndicies genotype attribute indices, in score order
+   * \return success, false if the genotypes cannot be packed
+   ****************************************************************************/
+  bool ComputeGenotypeScoresPopcount(
+          const SampledNeighborSets& sets,
+          const std::vector<unsigned int>& attributeIndicies);
+  /*************************************************************************//**
+   * Sample m instances and look up the neighbor sets of each.
+   * \param [out] sets neighbor sets of the sampled instances
+   * \return success
+   ****************************************************************************/
+  bool LookUpSampledNeighborSets(SampledNeighborSets& sets);
+  /*************************************************************************//**
+   * Should the weight update run in parallel over chunks of the sampled
+   * instances rather than over attributes? True for few attributes and
+   * more chunks than attribute blocks. Chosen from m and the number of
+   * attributes only, so the scores do not depend on the thread count.
+   * \return parallel over sampled instances?
+   ****************************************************************************/
+  bool ParallelOverInstances();
+  /// number of chunks of sampled instances when parallel over instances
+  unsigned int NumSampleChunks();
+  /*************************************************************************//**
+   * Range of the sampled instances of a chunk.
+   * \param [in] chunk chunk number
+   * \param [out] begin first sampled instance number
+   * \param [out] end one past the last sampled instance number
+   ****************************************************************************/
+  void SampleChunkRange(unsigned int chunk, unsigned int& begin,
+                        unsigned int& end);
+  /*************************************************************************//**
+   * Sum the scores accumulated per chunk of sampled instances into the first
+   * chunk's, pairwise in a fixed tree order, so the sums are the same for
+   * any number of threads.
+   * \param [in,out] chunkScores scores of each chunk, summed into the first
+   ****************************************************************************/
+  static void SumChunkScores(std::vector<std::vector<double> >& chunkScores);
+  /*************************************************************************//**
+   * Look up a sampled instance and its nearest hits and misses in the
+   * neighbor table.
+   * \param [in] instanceIndex instance index of the sampled instance
+   * \param [in] numNeighbors nearest neighbors to look up per class
+   * \param [out] sample sampled instance and neighbors
+   * \return success
+   ****************************************************************************/
+  bool GetSampledNeighbors(unsigned int instanceIndex,
+                           unsigned int numNeighbors,
+                           SampledNeighbors& sample);
+  /*************************************************************************//**
+   * Return the gap between the k-th and (k+1)-th smallest distances, the
+   * distance change that could alter the set of k nearest neighbors.
+   * \param [in,out] distances distances to candidate neighbors, reordered
+   * \param [in] numNeighbors k, number of nearest neighbors
+   * \return gap, or the largest double if there are no more than k distances
+   ****************************************************************************/
+  double NeighborBoundaryGap(std::vector<double>& distances,
+                             unsigned int numNeighbors);
+  /*************************************************************************//**
+   * Find the nearest neighbors of every instance from distances computed a
+   * block of rows at a time, keeping only the best k candidates per class
+   * of each instance, in O(m k) memory. Selects the same neighbors, and
+   * neighbor gaps, as the distance matrix.
+   * \return success
+   ****************************************************************************/
+  bool PreComputeNeighborsStreaming();
+  /*************************************************************************//**
+   * Select the nearest neighbors of every instance with the configured
+   * search: LSH, VP-tree, streaming or the distance matrix.
+   * \return success
+   ****************************************************************************/
+  bool SelectNearestNeighbors();
+  /*************************************************************************//**
+   * Load the nearest neighbors from the neighbors file if it was saved for
+   * the current data, metrics and k, or for a k sweep up to at least the
+   * neighbors max k.
+   * \return success, false to select the neighbors
+   ****************************************************************************/
+  bool LoadNeighbors();
+  /*************************************************************************//**
+   * Save the nearest neighbors to the neighbors file.
+   * \return success
+   ****************************************************************************/
+  bool SaveNeighbors();
+  /*************************************************************************//**
+   * Describe how the nearest neighbors are selected, for the neighbors file:
+   * the distance metrics, the neighborhood and the neighbor search.
+   * \return neighbor selection key, compared on load
+   ****************************************************************************/
+  std::vector<std::string> NeighborSelectionKey();
+  /*************************************************************************//**
+   * Are the neighbors selected for a k sweep? Then they are ranked by
+   * distance and ties at the k-th distance go to the earliest instances, so
+   * the first n neighbors of a slot are the n nearest for every n up to the
+   * neighbors max k. Otherwise ties are kept in best_n order.
+   * \return select nested k-prefixes?
+   ****************************************************************************/
+  bool NestedNeighbors();
+  /*************************************************************************//**
+   * Find approximate nearest neighbors of every instance: candidates that
+   * share a bucket in any of the LSH tables of genotypes are re-ranked by
+   * exact distance. Instances with too few candidates of some class are
+   * searched exactly. Applies to genotype-only data with the gm or am
+   * nearest neighbor metric.
+   * \return success
+   ****************************************************************************/
+  bool PreComputeNeighborsLsh();
+  /*************************************************************************//**
+   * Find the exact nearest neighbors of every instance with a vantage-point
+   * tree per neighbor table slot, over instances of that class or, for
+   * continuous phenotypes, all instances. Selects the same neighbors as the
+   * distance matrix does for a k sweep, ties by instance position, nearest
+   * first. Applies to numerics with the Manhattan metric and
+   * genotypes with the gm or am nearest neighbor metric.
+   * \return success
+   ****************************************************************************/
+  bool PreComputeNeighborsVpTree();
+  /*************************************************************************//**
+   * Find the neighbors of every instance within a distance threshold: the
+   * mean of all distances (SURF) or, per instance, the mean of its
+   * distances less half their standard deviation (MultiSURF). The distance
+   * statistics are summed while the matrix is filled. Above the distance
+   * memory limit no matrix is stored. The distances are streamed twice
+   * instead: once for the statistics, once for the neighbors. Both ways
+   * find the same neighbors. Every hit and miss class has as many neighbors
+   * as are within the threshold, possibly none.
+   * \return success
+   ****************************************************************************/
+  bool PreComputeNeighborsRadius();
+  /*************************************************************************//**
+   * Find the nearest neighbors of only the sampled instances from the m x n
+   * block of distances from them to every instance, without a distance
+   * matrix. Selects the same neighbors for them as the distance matrix.
+   * \return success
+   ****************************************************************************/
+  bool PreComputeNeighborsSampled();
+  /*************************************************************************//**
+   * Should only the sampled instances' nearest neighbors be selected? True
+   * for randomly sampling fewer instances than there are, k nearest
+   * neighbors searched exactly, without a neighbors max k or saving the
+   * neighbors, when NeedsOnlySampledNeighbors.
+   * \return select only the sampled instances' neighbors?
+   ****************************************************************************/
+  bool SelectSampledNeighborsOnly();
+  /// Draw the m sampled instances, before their neighbors are selected.
+  void SampleInstances();
+  /*************************************************************************//**
+   * Report the recall of the nearest neighbors in the neighbor table against
+   * exact search on evenly spaced instances. Neighbors tied with the exact
+   * k-th distance count as found.
+   * \param [in] instanceIndices instance index of each instance mask position
+   * \param [in] slots neighbor table slot of each instance mask position
+   * \param [in] numSamples number of instances to search exactly
+   ****************************************************************************/
+  void ReportNeighborRecall(const std::vector<unsigned int>& instanceIndices,
+                            const std::vector<unsigned int>& slots,
+                            unsigned int numSamples);
   /// type of analysis to perform
   AnalysisType analysisType;
-  /*************************************************************************//**
-   * Compute the discrete difference in an attribute between two instances.
-   * \param [in] attributeIndex index into vector of all attributes
-   * \param [in] dsi1 pointer to DatasetInstance 1
-   * \param [in] dsi2 pointer to DatasetInstance 2
-   * \return diff(erence)
-   ****************************************************************************/
-  double (*snpDiff)(unsigned int attributeIndex,
-                    DatasetInstance* dsi1,
-                    DatasetInstance* dsi2);
-  /*************************************************************************//**
-   * Compute the continuous difference in an attribute between two instances.
-   * \param [in] attributeIndex index into vector of all attributes
-   * \param [in] dsi1 pointer to DatasetInstance 1
-   * \param [in] dsi2 pointer to DatasetInstance 2
-   * \return diff(erence)
-   ****************************************************************************/
-  double (*numDiff)(unsigned int attributeIndex,
-                    DatasetInstance* dsi1,
-                    DatasetInstance* dsi2);
+  /// discrete diff(erence) metric, see MetricKernels.h
+  SnpMetricType snpMetricType;
+  /// continuous diff(erence) metric, see MetricKernels.h
+  NumericMetricType numMetricType;
   /// the name of discrete diff(erence) function
   std::string snpMetric;
   /// the name of continuous diff(erence) function
   std::string numMetric;
   /// number of instances to sample
   unsigned int m;
+  /// instance index of each of the m sampled instances
+  std::vector<unsigned int> sampledInstanceIndices;
   /// are instances being randomly selected?
   bool randomlySelect;
   /// number of attributes to remove each iteration if running iteratively
@@ -129,6 +464,38 @@ protected:
   /// sigma value used in exponential decay weight-by-distance
   double weightByDistanceSigma;
 
+  /// instance-to-instance distances, kept for updates between iterations
+  DistanceMatrix distanceMatrix;
+  /// largest distance matrix to store, MB; larger ones are streamed, 0=none
+  unsigned int distanceMemoryLimit;
+  /// per instance: smallest gap between k-th and (k+1)-th neighbor distances
+  std::vector<double> neighborGaps;
+  /// number of neighbors selected, k or the neighbors max k, and used to
+  /// compute the neighbor gaps
+  unsigned int neighborGapsK;
+  /// were the neighbors in the table selected with nested k-prefixes?
+  bool neighborsNested;
+  /// neighbors of an instance: k nearest (knn) or all within a distance
+  /// threshold (surf or multisurf)
+  std::string neighborhood;
+  /// nearest neighbor search: exact (scan all instances) or vptree
+  std::string neighborSearch;
+  /// random instance sampling: uniform (random) or class-stratified, both
+  /// without replacement
+  std::string sampling;
+  /// file to save the first nearest neighbors selected to, empty=none
+  std::string saveNeighborsFilename;
+  /// file to load saved nearest neighbors from, empty=none
+  std::string loadNeighborsFilename;
+  /// were the nearest neighbors saved?
+  bool neighborsSaved;
+  /// LSH tables for approximate nearest neighbors, 0=exact search
+  unsigned int lshTables;
+  /// genotypes sampled per LSH key
+  unsigned int lshKeySize;
+  /// instances to measure LSH neighbor recall on, 0=none
+  unsigned int lshVerifyRecall;
+
   /// attribute scores/weights
   std::vector<double> W;
   /// attribute names associated with scores
@@ -8,6 +8,8 @@
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 
 #include <boost/lexical_cast.hpp>
 #include <gsl/gsl_cdf.h>
@@ -16,6 +18,7 @@
 #include "ReliefFSeq.h"
 #include "Dataset.h"
 #include "DatasetInstance.h"
+#include "NeighborTable.h"
 #include "DistanceMetrics.h"
 #include "Insilico.h"
 #include "Statistics.h"
@@ -23,6 +26,9 @@
 using namespace std;
 using namespace boost;
 
+/// genes per block of the diff moments pass
+static const unsigned int DIFF_MOMENTS_BLOCK = 64;
+
 ReliefFSeq::ReliefFSeq(Dataset* ds) :
 		ReliefF::ReliefF(ds, RNASEQ_ANALYSIS) {
 	mode = "snr";
@@ -137,6 +143,15 @@ ReliefFSeq::ReliefFSeq(Dataset* ds, ConfigMap& configMap) :
 ReliefFSeq::~ReliefFSeq() {
 }
 
+bool ReliefFSeq::ComputeScoresForKs(const vector<unsigned int>& ks,
+		vector<AttributeScores>& kScores) {
+	return AttributeRanker::ComputeScoresForKs(ks, kScores);
+}
+
+bool ReliefFSeq::NeedsOnlySampledNeighbors() {
+	return false;
+}
+
 bool ReliefFSeq::ComputeAttributeScores() {
 	// preconditions:
 	// 1. case-control data
@@ -163,33 +178,34 @@ bool ReliefFSeq::ComputeAttributeScores() {
     outFile << "gene\tmuMiss\tmuHit\tsigmaMiss\tsigmaHit\tnum\tden\ttstat\tpval" << endl;
   }
 
+	// average and variance of the hit and miss diffs of every gene alpha
+	vector<double> muDeltaHits, muDeltaMisses;
+	vector<double> sigmaDeltaHits, sigmaDeltaMisses;
+	if (!ComputeDiffMoments(numericIndices, muDeltaHits, muDeltaMisses,
+			sigmaDeltaHits, sigmaDeltaMisses)) {
+		return false;
+	}
+
+	// per gene: the raw score statistics, written in gene order afterwards
+	unsigned int numGenes = numericIndices.size();
+	vector<double> rawNums(numGenes, 0.0), rawDens(numGenes, 0.0);
+	vector<double> rawStats(numGenes, 0.0);
+
 	/// run this loop on as many cores as possible through OpenMP
-  double alphaWeight = 0.0;
 #pragma omp parallel for
-	for (unsigned int numIdx = 0; numIdx < numericIndices.size();
-			++numIdx) {
-		unsigned int alpha = numericIndices[numIdx];
-		pair<double, double> muDeltaAlphas = MuDeltaAlphas(alpha);
-		double muDeltaHitAlpha = muDeltaAlphas.first;
-		double muDeltaMissAlpha = muDeltaAlphas.second;
-
-		pair<double, double> sigmaDeltaAlphas = SigmaDeltaAlphas(alpha,
-				muDeltaHitAlpha, muDeltaMissAlpha);
-		double sigmaDeltaHitAlpha = sigmaDeltaAlphas.first;
-		double sigmaDeltaMissAlpha = sigmaDeltaAlphas.second;
-		double snrNum = 0.0, snrDen = 0.0;
-		double tstatNum = 0.0, tstatDen = 0.0;
-#pragma omp critical
-{      
+	for (int numIdx = 0; numIdx < (int) numGenes; ++numIdx) {
+		double muDeltaHitAlpha = muDeltaHits[numIdx];
+		double muDeltaMissAlpha = muDeltaMisses[numIdx];
+		double sigmaDeltaHitAlpha = sigmaDeltaHits[numIdx];
+		double sigmaDeltaMissAlpha = sigmaDeltaMisses[numIdx];
+		double alphaWeight = 0.0;
 		if(mode == "snr") {
-      cout << "SNR MODE" << endl;
 			// mode: snr (signal to noise ratio)
-			snrNum = fabs(muDeltaMissAlpha - muDeltaHitAlpha);
-			snrDen = sigmaDeltaMissAlpha + sigmaDeltaHitAlpha;
-			outFile << numNames[numIdx]
-					<< "\t" << muDeltaMissAlpha << "\t" << muDeltaHitAlpha
-					<< "\t" << sigmaDeltaMissAlpha << "\t" << sigmaDeltaHitAlpha
-					<< "\t" << snrNum << "\t" << snrDen << "\t" << (snrDen + s0);
+			double snrNum = fabs(muDeltaMissAlpha - muDeltaHitAlpha);
+			double snrDen = sigmaDeltaMissAlpha + sigmaDeltaHitAlpha;
+			rawNums[numIdx] = snrNum;
+			rawDens[numIdx] = snrDen;
+			rawStats[numIdx] = snrDen + s0;
 			if(snrMode == "snr") {
 				alphaWeight = snrNum / (snrDen + s0);
 			}
@@ -204,36 +220,35 @@ bool ReliefFSeq::ComputeAttributeScores() {
 			// (xbar1 – xbar2)/(Sp*sqrt(1/n1 + 1/n2)), 
 			// where Sp = pooled standard deviation=
 			// sqrt(((n1-1)*variance1 + (n2-1)*variance2)/(n1+n2-2)).
- 			double n1, n2;
+			double n1, n2;
 			n1 = n2 = m * k;
 			double variance1 = sigmaDeltaHitAlpha;
 			double variance2 = sigmaDeltaMissAlpha;
 			double pooledVariance =
 					sqrt(((n1 - 1) * variance1 + (n2 - 1) * variance2) / (n1 + n2 - 2));
-			tstatNum = muDeltaMissAlpha - muDeltaHitAlpha;
-			tstatDen = pooledVariance * sqrt((1.0 / n1) + (1.0 / n2));
+			double tstatNum = muDeltaMissAlpha - muDeltaHitAlpha;
+			double tstatDen = pooledVariance * sqrt((1.0 / n1) + (1.0 / n2));
 			// make into a t-statistic and use for pvalue
 			double t = tstatNum / (tstatDen + s0);
-      outFile << numNames[numIdx]
-          << "\t" << muDeltaMissAlpha << "\t" << muDeltaHitAlpha
-          << "\t" << sigmaDeltaMissAlpha << "\t" << sigmaDeltaHitAlpha
-          << "\t" << tstatNum << "\t" << tstatDen << "\t" << t;
+			rawNums[numIdx] = tstatNum;
+			rawDens[numIdx] = tstatDen;
+			rawStats[numIdx] = t;
 
 			double df =  n1 + n2 - 2;
 			double gslPval = 1.0;
 			if(t < 0) {
 				//gslPval = gsl_cdf_tdist_P(-t, df);
-        gslPval = gsl_cdf_tdist_Q(-t, df);
+				gslPval = gsl_cdf_tdist_Q(-t, df);
 			}
 			else {
 				//gslPval = gsl_cdf_tdist_P(t, df);
-        gslPval = gsl_cdf_tdist_Q(t, df);
+				gslPval = gsl_cdf_tdist_Q(t, df);
 			}
 			// assign the variable a weight for ReliefF
 			if(tstatMode == "pval") {
 				// use 1-pvalue as the attribute score
 				//alphaWeight = 1.0 - (2.0 * (1.0 - gslPval));
-        alphaWeight = 2.0 * gslPval;
+				alphaWeight = 2.0 * gslPval;
 			}
 			else {
 				if(tstatMode == "abst") {
@@ -246,14 +261,20 @@ bool ReliefFSeq::ComputeAttributeScores() {
 				}
 			}
 		}
-	
+
 		/// assign a weight to this variable index
-      W[numIdx] = alphaWeight;
-      // DEBUG
-      outFile << "\t" << W[numIdx] << endl;
-} // end critical section
+		W[numIdx] = alphaWeight;
 	} // for all gene alpha
 
+	// DEBUG
+	for (unsigned int numIdx = 0; numIdx < numGenes; ++numIdx) {
+		outFile << numNames[numIdx]
+				<< "\t" << muDeltaMisses[numIdx] << "\t" << muDeltaHits[numIdx]
+				<< "\t" << sigmaDeltaMisses[numIdx] << "\t" << sigmaDeltaHits[numIdx]
+				<< "\t" << rawNums[numIdx] << "\t" << rawDens[numIdx]
+				<< "\t" << rawStats[numIdx] << "\t" << W[numIdx] << endl;
+	}
+
 	// DEBUG
 	outFile.close();
 
@@ -270,73 +291,142 @@ AttributeScores ReliefFSeq::GetScores() {
 	return returnScores;
 }
 
-pair<double, double> ReliefFSeq::MuDeltaAlphas(unsigned int alpha) {
-
-	// for all instances
-	double missSum = 0.0;
-	double hitSum = 0.0;
-	for(unsigned int i = 0; i < m; ++i) {
+bool ReliefFSeq::ComputeDiffMoments(const vector<unsigned int>& numericIndices,
+		vector<double>& muDeltaHits, vector<double>& muDeltaMisses,
+		vector<double>& sigmaDeltaHits, vector<double>& sigmaDeltaMisses) {
+	// resolve the hits and misses of the first m instances once, as rows of
+	// the distinct instances read; assume only one other miss class
+	const NeighborTable& neighborTable = dataset->GetNeighborTable();
+	if (neighborTable.NumSlots() != 2) {
+		cerr << "ERROR: ReliefFSeq requires case-control data" << endl;
+		return false;
+	}
+	if (!m) {
+		cerr << "ERROR: ReliefFSeq has no instances to score" << endl;
+		return false;
+	}
+	vector<unsigned int> hitInstances(m * k), missInstances(m * k);
+	vector<unsigned int> rowInstanceIndices;
+	for (unsigned int i = 0; i < m; ++i) {
 		DatasetInstance* S_i = dataset->GetInstance(i);
-
-		// get hits and misses for this instance
-		vector<unsigned int> hits(k);
-		vector<unsigned int> misses(k);
-		map<ClassLevel, vector<unsigned int> > allMisses;
-		S_i->GetNNearestInstances(k, hits, allMisses);
-		misses = allMisses.begin()->second;
-
-		// sum over all nearest hits and misses neighbors
-		for(unsigned int j = 0; j < k; ++j) {
-			hitSum += diffManhattan(alpha, S_i, dataset->GetInstance(hits[j]));
-			missSum += diffManhattan(alpha, S_i, dataset->GetInstance(misses[j]));
+		unsigned int hitSlot = neighborTable.ClassSlot(S_i->GetClass());
+		unsigned int missSlot = 1 - hitSlot;
+		if ((hitSlot == neighborTable.NumSlots())
+				|| (neighborTable.NumNeighbors(i, hitSlot) < k)
+				|| (neighborTable.NumNeighbors(i, missSlot) < k)) {
+			cerr << "ERROR: ReliefFSeq cannot get " << k << " nearest neighbors"
+					<< endl;
+			return false;
 		}
+		const unsigned int* hits = neighborTable.Neighbors(i, hitSlot);
+		const unsigned int* misses = neighborTable.Neighbors(i, missSlot);
+		copy(hits, hits + k, hitInstances.begin() + i * k);
+		copy(misses, misses + k, missInstances.begin() + i * k);
+		rowInstanceIndices.push_back(i);
+	}
+	rowInstanceIndices.insert(rowInstanceIndices.end(), hitInstances.begin(),
+			hitInstances.end());
+	rowInstanceIndices.insert(rowInstanceIndices.end(), missInstances.begin(),
+			missInstances.end());
+	sort(rowInstanceIndices.begin(), rowInstanceIndices.end());
+	rowInstanceIndices.erase(
+			unique(rowInstanceIndices.begin(), rowInstanceIndices.end()),
+			rowInstanceIndices.end());
+	unsigned int numRows = rowInstanceIndices.size();
+	vector<unsigned int> instanceRows(rowInstanceIndices.back() + 1, 0);
+	vector<DatasetInstance*> rowInstances(numRows);
+	for (unsigned int row = 0; row < numRows; ++row) {
+		instanceRows[rowInstanceIndices[row]] = row;
+		rowInstances[row] = dataset->GetInstance(rowInstanceIndices[row]);
+	}
+	vector<unsigned int> hitRows(m * k), missRows(m * k);
+	for (unsigned int ij = 0; ij < m * k; ++ij) {
+		hitRows[ij] = instanceRows[hitInstances[ij]];
+		missRows[ij] = instanceRows[missInstances[ij]];
 	}
 
-	// return the average of the hit and miss diffs
-	pair<double, double> returnValues;
+	unsigned int numGenes = numericIndices.size();
+	muDeltaHits.assign(numGenes, 0.0);
+	muDeltaMisses.assign(numGenes, 0.0);
+	sigmaDeltaHits.assign(numGenes, 0.0);
+	sigmaDeltaMisses.assign(numGenes, 0.0);
+	unsigned int numBlocks = (numGenes + DIFF_MOMENTS_BLOCK - 1)
+			/ DIFF_MOMENTS_BLOCK;
 	double avgFactor = 1.0 / ((double) m * (double) k);
-	returnValues.first = hitSum * avgFactor;
-	returnValues.second = missSum * avgFactor;
-
-	return returnValues;
-}
 
-pair<double, double> ReliefFSeq::SigmaDeltaAlphas(unsigned int alpha,
-		double muDeltaHit, double muDeltaMiss) {
-
-	double missSum = 0.0;
-	double hitSum = 0.0;
+#pragma omp parallel
+	{
+		// per thread: the block's values, one row of genes per instance
+		vector<double> values(numRows * DIFF_MOMENTS_BLOCK);
+		vector<double> reciprocalRanges(DIFF_MOMENTS_BLOCK);
+		vector<double> hitDiffs(DIFF_MOMENTS_BLOCK);
+		vector<double> missDiffs(DIFF_MOMENTS_BLOCK);
+		vector<double> hitMeans(DIFF_MOMENTS_BLOCK);
+		vector<double> missMeans(DIFF_MOMENTS_BLOCK);
+		vector<double> hitM2s(DIFF_MOMENTS_BLOCK);
+		vector<double> missM2s(DIFF_MOMENTS_BLOCK);
+#pragma omp for schedule(dynamic, 1)
+		for (int block = 0; block < (int) numBlocks; ++block) {
+			unsigned int begin = block * DIFF_MOMENTS_BLOCK;
+			unsigned int numBlockGenes = min(DIFF_MOMENTS_BLOCK,
+					numGenes - begin);
+			bool hasMissing = false;
+			for (unsigned int g = 0; g < numBlockGenes; ++g) {
+				unsigned int alpha = numericIndices[begin + g];
+				pair<double, double> minMax =
+						dataset->GetMinMaxForNumeric(alpha);
+				reciprocalRanges[g] = 1.0 / (minMax.second - minMax.first);
+				for (unsigned int row = 0; row < numRows; ++row) {
+					double value = rowInstances[row]->numerics[alpha];
+					values[row * DIFF_MOMENTS_BLOCK + g] = value;
+					hasMissing = hasMissing || (value == MISSING_NUMERIC_VALUE);
+				}
+			}
+			fill(hitMeans.begin(), hitMeans.end(), 0.0);
+			fill(missMeans.begin(), missMeans.end(), 0.0);
+			fill(hitM2s.begin(), hitM2s.end(), 0.0);
+			fill(missM2s.begin(), missM2s.end(), 0.0);
+
+			// one Welford update of the hit and miss moments of every gene
+			for (unsigned int ij = 0; ij < m * k; ++ij) {
+				unsigned int row = instanceRows[ij / k];
+				if (hasMissing) {
+					// missing value diffs from the general metric
+					for (unsigned int g = 0; g < numBlockGenes; ++g) {
+						unsigned int alpha = numericIndices[begin + g];
+						hitDiffs[g] = diffManhattan(alpha, rowInstances[row],
+								rowInstances[hitRows[ij]]);
+						missDiffs[g] = diffManhattan(alpha, rowInstances[row],
+								rowInstances[missRows[ij]]);
+					}
+				} else {
+					const double* S_i = &values[row * DIFF_MOMENTS_BLOCK];
+					const double* hit = &values[hitRows[ij] * DIFF_MOMENTS_BLOCK];
+					const double* miss = &values[missRows[ij] * DIFF_MOMENTS_BLOCK];
+					for (unsigned int g = 0; g < numBlockGenes; ++g) {
+						hitDiffs[g] = fabs(S_i[g] - hit[g]) * reciprocalRanges[g];
+						missDiffs[g] = fabs(S_i[g] - miss[g]) * reciprocalRanges[g];
+					}
+				}
+				double countFactor = 1.0 / (double) (ij + 1);
+				for (unsigned int g = 0; g < numBlockGenes; ++g) {
+					double hitDelta = hitDiffs[g] - hitMeans[g];
+					hitMeans[g] += hitDelta * countFactor;
+					hitM2s[g] += hitDelta * (hitDiffs[g] - hitMeans[g]);
+					double missDelta = missDiffs[g] - missMeans[g];
+					missMeans[g] += missDelta * countFactor;
+					missM2s[g] += missDelta * (missDiffs[g] - missMeans[g]);
+				}
+			}
 
-	// for all instances
-	for(unsigned int i = 0; i < m; ++i) {
-		DatasetInstance* S_i = dataset->GetInstance(i);
-		/// get hits and misses for this instance
-		vector<unsigned int> hits(k);
-		map<ClassLevel, vector<unsigned int> > allMisses;
-		S_i->GetNNearestInstances(k, hits, allMisses);
-		// for all nearest neighbor hits
-		for(unsigned int j = 0; j < k; ++j) {
-			hitSum +=
-					pow(
-							(diffManhattan(alpha, S_i, dataset->GetInstance(hits[j]))
-									- muDeltaHit), 2);
-		}
-		// for all nearest neighbor misses
-		// assume only one other miss class
-		vector<unsigned int> misses(k);
-		misses = allMisses.begin()->second;
-		for(unsigned int j = 0; j < k; ++j) {
-			missSum += pow(
-					(diffManhattan(alpha, S_i, dataset->GetInstance(misses[j]))
-							- muDeltaMiss), 2);
+			for (unsigned int g = 0; g < numBlockGenes; ++g) {
+				muDeltaHits[begin + g] = hitMeans[g];
+				muDeltaMisses[begin + g] = missMeans[g];
+				sigmaDeltaHits[begin + g] = hitM2s[g] * avgFactor;
+				sigmaDeltaMisses[begin + g] = missM2s[g] * avgFactor;
+			}
 		}
 	}
 
-	// return the standard deviation of the hit and miss diffs
-	pair<double, double> returnValues;
-	double avgFactor = 1.0 / ((double) m * (double) k);
-	returnValues.first = hitSum * avgFactor;
-	returnValues.second = missSum * avgFactor;
-
-	return returnValues;
+	return true;
 }
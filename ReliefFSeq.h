@@ -57,12 +57,35 @@ public:
    ****************************************************************************/
   ReliefFSeq(Dataset* ds, ConfigMap& configMap);
   bool ComputeAttributeScores();
+  /*************************************************************************//**
+   * Score one k at a time. The SNR and t-test statistics need the mean and
+   * variance of each k's hit and miss diffs.
+   * \param [in] ks values of k, ascending
+   * \param [out] kScores scores for each k
+   * \return success
+   ****************************************************************************/
+  bool ComputeScoresForKs(const std::vector<unsigned int>& ks,
+                          std::vector<AttributeScores>& kScores);
   AttributeScores GetScores();
-  // average hit and miss diffs for gene alpha
-  std::pair<double, double> MuDeltaAlphas(unsigned int alpha);
-  /// standard deviations of hit and miss diffs for gene alpha
-  std::pair<double, double> SigmaDeltaAlphas(unsigned int alpha,
-  		double muDeltaHit, double muDeltaMiss);
+  /*************************************************************************//**
+   * Compute the average and variance of the hit and miss diffs of every gene
+   * in one pass over the nearest neighbors of the first m instances. The
+   * neighbors are resolved once, then each block of genes is copied to rows
+   * of one instance's genes and Welford updates run across the genes.
+   * \param [in] numericIndices gene numeric indices
+   * \param [out] muDeltaHits per gene: average hit diff
+   * \param [out] muDeltaMisses per gene: average miss diff
+   * \param [out] sigmaDeltaHits per gene: variance of the hit diffs
+   * \param [out] sigmaDeltaMisses per gene: variance of the miss diffs
+   * \return success
+   ****************************************************************************/
+  bool ComputeDiffMoments(const std::vector<unsigned int>& numericIndices,
+                          std::vector<double>& muDeltaHits,
+                          std::vector<double>& muDeltaMisses,
+                          std::vector<double>& sigmaDeltaHits,
+                          std::vector<double>& sigmaDeltaMisses);
+  /// The neighbors of the first m instances are read, not the sampled ones.
+  bool NeedsOnlySampledNeighbors();
   virtual ~ReliefFSeq();
 private:
 	/// ReliefSeq mode: signal-to-noise ratio (snr) or t-statistic (tstat)
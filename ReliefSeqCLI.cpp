@@ -20,6 +20,7 @@
 
 #include "Insilico.h"
 #include "Dataset.h"
+#include "DistanceMatrix.h"
 #include "DgeData.h"
 #include "BirdseedData.h"
 #include "ReliefSeqController.h"
@@ -58,10 +59,22 @@ int main(int argc, char** argv) {
   unsigned int koptEnd = 1;
   unsigned int koptStep = 1;
 	unsigned int m = 0;
+	string sampling = "random";
+	uint64_t randomSeed = 0;
 	string snpMetric = "gm";
 	string snpMetricNN = "gm";
 	string snpMetricWeights = "gm";
 	string numMetric = "manhattan";
+	string distancePrecision = "double";
+	unsigned int verifyPrecisionTopN = 10;
+	unsigned int distanceMemoryLimit = 4096;
+	string neighborhood = "knn";
+	string neighborSearch = "exact";
+	string saveNeighborsFile = "";
+	string loadNeighborsFile = "";
+	unsigned int lshTables = 0;
+	unsigned int lshKeySnps = 10;
+	unsigned int lshVerifyRecall = 0;
 	string weightByDistanceMethod = "equal";
 	double weightByDistanceSigma = 2.0;
 	string reliefMode = "relieff";
@@ -186,6 +199,56 @@ int main(int argc, char** argv) {
 		"metric for determining the difference between numeric attributes (manhattan|euclidean)"
 		)
 		(
+		"precision",
+		po::value<string > (&distancePrecision)->default_value(distancePrecision),
+		"storage precision of distances and numerics for nearest neighbors (double|float)"
+		)
+		(
+		"verify-precision",
+		po::value<unsigned int>(&verifyPrecisionTopN),
+		"report k nearest neighbor and top N attribute ranking differences of float precision from double"
+		)
+		(
+		"distance-memory-limit",
+		po::value<unsigned int>(&distanceMemoryLimit)->default_value(distanceMemoryLimit),
+		"largest distance matrix in MB; stream nearest neighbors without a matrix above it (0=no limit)"
+		)
+		(
+		"neighborhood",
+		po::value<string>(&neighborhood)->default_value(neighborhood),
+		"neighbors of an instance: k nearest, or all within the mean distance (surf) or within each instance's mean distance less half its standard deviation (multisurf), with no k to choose (knn|surf|multisurf)"
+		)
+		(
+		"neighbor-search",
+		po::value<string>(&neighborSearch)->default_value(neighborSearch),
+		"nearest neighbor search: scan all instances or an exact vantage-point tree for gm/am and manhattan distances (exact|vptree)"
+		)
+		(
+		"save-neighbors",
+		po::value<string>(&saveNeighborsFile),
+		"save the nearest neighbors selected for the full data to this binary file"
+		)
+		(
+		"load-neighbors",
+		po::value<string>(&loadNeighborsFile),
+		"load nearest neighbors saved for the same data, metrics, neighbor search and k, or at least the largest k of a k optimization, from this file instead of selecting them"
+		)
+		(
+		"lsh-tables",
+		po::value<unsigned int>(&lshTables)->default_value(lshTables),
+		"approximate gm/am nearest neighbors from this many LSH tables of genotypes; more tables raise recall and run time (0=exact search)"
+		)
+		(
+		"lsh-key-snps",
+		po::value<unsigned int>(&lshKeySnps)->default_value(lshKeySnps),
+		"SNPs sampled per LSH key (1-32); more SNPs give fewer, closer candidates"
+		)
+		(
+		"lsh-verify-recall",
+		po::value<unsigned int>(&lshVerifyRecall),
+		"report the LSH nearest neighbor recall against exact search on this many instances"
+		)
+		(
 		"snp-exclusion-file,x",
 		po::value<string > (&snpExclusionFile),
 		"file of SNP names to be excluded"
@@ -216,6 +279,16 @@ int main(int argc, char** argv) {
 		"number of random samples (0=all|1 <= n <= number of samples)"
 		)
 		(
+		"sampling",
+		po::value<string>(&sampling)->default_value(sampling),
+		"random samples drawn without replacement uniformly or in proportion to each class (random|stratified)"
+		)
+		(
+		"seed",
+		po::value<uint64_t>(&randomSeed),
+		"random number seed; the same seed reproduces random sampling and LSH keys with any number of threads (default=time based)"
+		)
+		(
 		"weight-by-distance-method,b",
 		po::value<string > (&weightByDistanceMethod)->default_value(weightByDistanceMethod),
 		"weight-by-distance method (equal|one_over_k|exponential)"
@@ -632,6 +705,22 @@ int main(int argc, char** argv) {
 		exit(COMMAND_LINE_ERROR);
 	}
 
+	if(distancePrecision == "float") {
+		ds->SetDistancePrecision(FLOAT_PRECISION);
+	} else {
+		if(distancePrecision != "double") {
+			cerr << "ERROR: [" << distancePrecision
+					<< "] is not a valid precision (double|float)" << endl;
+			exit(COMMAND_LINE_ERROR);
+		}
+	}
+
+	if(vm.count("seed")) {
+		ds->SetRandomSeed(randomSeed);
+	}
+	cout << Timestamp() << "Random number seed: " << ds->GetRandomSeed()
+			<< endl;
+
 	/// happy lights
 	switch(analysisType) {
 		case SNP_ONLY_ANALYSIS:
@@ -669,24 +758,8 @@ int main(int argc, char** argv) {
 	/// distance matrix calculation(s) do their work, then exit main()
 	if(vm.count("distance-matrix") || vm.count("gain-matrix")) {
 		if(vm.count("distance-matrix")) {
-			double** distanceMatrix = 0;
-		  /// create a distance matrix
-		  vector<string> instanceIds = ds->MaskGetInstanceIds();
-		  int numInstances = instanceIds.size();
-		  distanceMatrix = new double*[numInstances];
-		  for(int i = 0; i < numInstances; ++i) {
-		    distanceMatrix[i] = new double[numInstances];
-		    for(int j = 0; j < numInstances; ++j) {
-		      distanceMatrix[i][j] = 0.0;
-		    }
-		  }
-			if(ds->CalculateDistanceMatrix(distanceMatrix, distanceMatrixFilename)) {
-				for(unsigned int i=0; i < ds->NumInstances(); ++i) {
-					delete [] distanceMatrix[i];
-				}
-				delete [] distanceMatrix;
-			}
-			else {
+			DistanceMatrix distanceMatrix;
+			if(!ds->CalculateDistanceMatrix(distanceMatrix, distanceMatrixFilename)) {
 				cerr << "ERROR: Could not calculate a distance matrix." << endl;
 				exit(EXIT_FAILURE);
 			}
@@ -753,7 +826,14 @@ int main(int argc, char** argv) {
 	// FINALLY! run the algorithm
 	cout << Timestamp() << "Running ReliefSeq" << endl;
 	ReliefSeqController rsc(ds, vm, analysisType);
-	if(k == 0) {
+	if(vm.count("verify-precision")) {
+		if(!rsc.VerifyDistancePrecision(verifyPrecisionTopN)) {
+			cerr << "ERROR: Failed to verify the distance precision" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	// distance threshold neighborhoods have no k to optimize
+	if((k == 0) && (neighborhood == "knn")) {
 		if(!rsc.ComputeScoresKopt()) {
 			cerr << "ERROR: Failed to calculate optimum k ReliefSeq scores" << endl;
 			exit(EXIT_FAILURE);
@@ -3,6 +3,8 @@
  */
 
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -80,6 +82,16 @@ ReliefSeqController::ReliefSeqController(Dataset* ds, po::variables_map& vm,
     }
   }
 
+  // only Relief-F scores neighbor sets of any size
+  if(paramsMap.count("neighborhood") &&
+     (paramsMap["neighborhood"].as<string>() != "knn") &&
+     ((algorithmMode != "relieff") || ds->HasContinuousPhenotypes())) {
+    cerr << "ERROR: " << paramsMap["neighborhood"].as<string>()
+            << " neighborhoods need the relieff algorithm and a case-control "
+            << "or multiclass phenotype" << endl;
+    exit(EXIT_FAILURE);
+  }
+
   outFilesPrefix = paramsMap["out-files-prefix"].as<string>();
 
   // set the number of attributes to remove per iteration
@@ -288,21 +300,23 @@ bool ReliefSeqController::ComputeScoresKopt() {
     return false;
   }
 
-  // iterate over all k's
+  // compute the scores of all k's
   //vector<map<string, double> > allScores;
   vector<unsigned int> koptValues;
+  for(unsigned int thisK = koptBegin; thisK <= koptEnd; thisK += koptStep) {
+    koptValues.push_back(thisK);
+  }
+  vector<AttributeScores> kScores;
+  if(!reliefseqAlgorithm->ComputeScoresForKs(koptValues, kScores)) {
+    cerr << "ERROR: Could not compute the scores for each k" << endl;
+    return false;
+  }
 	bool hasNames = false;
 	vector<vector<double> > allScores;
 	vector<string> scoreNames;
-  for(unsigned int thisK = koptBegin; thisK <= koptEnd; thisK += koptStep) {
-    // run ReliefF on this k
-    cout << Timestamp() << "--------------------------" << endl;
-    cout << Timestamp() << "Running ReliefSeq for k=" << thisK << endl;
-    reliefseqAlgorithm->SetK(thisK);
-    koptValues.push_back(thisK);
-    scores.clear();
-		dataset->ResetNearestNeighbors();
-    scores = reliefseqAlgorithm->ComputeScores();
+  for(unsigned int kIdx = 0; kIdx < koptValues.size(); ++kIdx) {
+    unsigned int thisK = koptValues[kIdx];
+    scores = kScores[kIdx];
 	  sort(scores.begin(), scores.end(), scoresSortAscByName);
 		vector<double> thisScores;
 		AttributeScoresCIt scoresIt = scores.begin();
@@ -361,6 +375,79 @@ bool ReliefSeqController::ComputeScoresKopt() {
   return true;
 }
 
+bool ReliefSeqController::VerifyDistancePrecision(unsigned int topN) {
+  unsigned int verifyK = paramsMap["k-nearest-neighbors"].as<unsigned int>();
+  if(!verifyK) {
+    verifyK = paramsMap["kopt-end"].as<unsigned int>();
+  }
+  cout << Timestamp() << "Verifying float against double precision distances "
+          << "with k = " << verifyK << ", top " << topN << " attributes"
+          << endl;
+  // a double and a float distance matrix are compared
+  unsigned int numInstances = dataset->NumInstances();
+  double matricesBytes = (double) numInstances * numInstances *
+          (sizeof(double) + sizeof(float));
+  unsigned int distanceMemoryLimit = 0;
+  if(paramsMap.count("distance-memory-limit")) {
+    distanceMemoryLimit = paramsMap["distance-memory-limit"].as<unsigned int>();
+  }
+  if(distanceMemoryLimit &&
+     (matricesBytes > (double) distanceMemoryLimit * 1024.0 * 1024.0)) {
+    cout << Timestamp() << "Skipping precision verification: distance "
+            << "matrices of "
+            << (unsigned int) ceil(matricesBytes / (1024.0 * 1024.0))
+            << " MB exceed the " << distanceMemoryLimit
+            << " MB distance memory limit" << endl;
+    return true;
+  }
+  DistancePrecision savedPrecision = dataset->GetDistancePrecision();
+  // both passes sample the same instances, and neither changes the ones
+  // sampled later
+  uint64_t savedRandomPosition = dataset->GetRandomPosition();
+
+  unsigned int numNeighborDiffs =
+          dataset->CountPrecisionNeighborDifferences(verifyK);
+
+  // one ReliefF pass in each precision, ranked by descending score
+  if(!reliefseqAlgorithm->SetK(verifyK)) {
+    return false;
+  }
+  DistancePrecision precisions[2] = {DOUBLE_PRECISION, FLOAT_PRECISION};
+  vector<string> topNames[2];
+  for(unsigned int p = 0; p < 2; ++p) {
+    dataset->SetDistancePrecision(precisions[p]);
+    dataset->SetRandomPosition(savedRandomPosition);
+    AttributeScores precisionScores = reliefseqAlgorithm->ComputeScores();
+    stable_sort(precisionScores.begin(), precisionScores.end(),
+                scoresSortDesc);
+    for(unsigned int i = 0; (i < topN) && (i < precisionScores.size()); ++i) {
+      topNames[p].push_back(precisionScores[i].second);
+    }
+  }
+  dataset->SetDistancePrecision(savedPrecision);
+  dataset->SetRandomPosition(savedRandomPosition);
+
+  unsigned int numRankDiffs = 0;
+  unsigned int numSetDiffs = 0;
+  for(unsigned int i = 0; i < topNames[1].size(); ++i) {
+    if(topNames[1][i] != topNames[0][i]) {
+      ++numRankDiffs;
+    }
+    if(find(topNames[0].begin(), topNames[0].end(), topNames[1][i]) ==
+       topNames[0].end()) {
+      ++numSetDiffs;
+    }
+  }
+  cout << Timestamp() << "Precision verification: k nearest neighbors differ "
+          << "for " << numNeighborDiffs << "/" << numInstances
+          << " instances" << endl;
+  cout << Timestamp() << "Precision verification: top " << topNames[1].size()
+          << " attribute ranks differ at " << numRankDiffs << " positions, "
+          << numSetDiffs << " attributes differ" << endl;
+
+  return true;
+}
+
 AttributeScores& ReliefSeqController::GetScores() {
   return scores;
 }
@@ -33,6 +33,14 @@ public:
   bool ComputeScores();
   /// Compute scores based on optimum k
   bool ComputeScoresKopt();
+  /*************************************************************************//**
+	 * Report how often float precision distances change the k nearest
+	 * neighbor sets and the top N attribute ranking of one ReliefF pass,
+	 * compared to double precision. Restores the data set's precision.
+	 * \param [in] topN number of top ranked attributes to compare
+	 * \return success
+	 ****************************************************************************/
+  bool VerifyDistancePrecision(unsigned int topN);
   /// Get the last computed scores.
   AttributeScores& GetScores();
   /// Return the algorithm mode.
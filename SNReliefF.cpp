@@ -11,6 +11,7 @@
 #include "ReliefF.h"
 #include "SNReliefF.h"
 #include "Dataset.h"
+#include "NeighborTable.h"
 #include "DistanceMetrics.h"
 #include "Insilico.h"
 #include "Statistics.h"
@@ -35,6 +36,15 @@ SNReliefF::SNReliefF(Dataset* ds, ConfigMap& configMap) :
 SNReliefF::~SNReliefF() {
 }
 
+bool SNReliefF::ComputeScoresForKs(const vector<unsigned int>& ks,
+		vector<AttributeScores>& kScores) {
+	return AttributeRanker::ComputeScoresForKs(ks, kScores);
+}
+
+bool SNReliefF::NeedsOnlySampledNeighbors() {
+	return false;
+}
+
 bool SNReliefF::ComputeAttributeScores() {
 	// preconditions:
 	// 1. case-control data
@@ -91,20 +101,26 @@ bool SNReliefF::ComputeAttributeScores() {
 bool SNReliefF::PreComputeNeighborGeneStats() {
 
 	cout << Timestamp() << "Precomputing nearest neighbor attribute stats" << endl;
+	const NeighborTable& neighborTable = dataset->GetNeighborTable();
+	if(neighborTable.NumSlots() != 2) {
+		cerr << "ERROR: SNReliefF requires case-control data" << endl;
+		return false;
+	}
 	for(unsigned int i=0; i < dataset->NumInstances(); ++i) {
 		DatasetInstance* M_i = dataset->GetInstance(i);
 		// find k nearest hits and nearest misses
-		vector<unsigned int> hits(k);
-		map<ClassLevel, vector<unsigned int> > allMisses;
-		bool canGetNeighbors = M_i->GetNNearestInstances(k, hits, allMisses);
-		if(canGetNeighbors && (allMisses.size() != 1)) {
-			cerr << "ERROR: SNReliefF requires case-control data" << endl;
+		unsigned int hitSlot = neighborTable.ClassSlot(M_i->GetClass());
+		unsigned int missSlot = 1 - hitSlot;
+		if((hitSlot == neighborTable.NumSlots()) ||
+				(neighborTable.NumNeighbors(i, hitSlot) < k) ||
+				(neighborTable.NumNeighbors(i, missSlot) < k)) {
+			cerr << "ERROR: SNReliefF cannot get " << k << " nearest neighbors"
+					<< endl;
 			return false;
 		}
-		vector<unsigned int> misses(k);
-		misses = allMisses.begin()->second;
 		InstanceHitMissStats instanceHitMissStats;
-		ComputeInstanceStats(M_i, hits, misses, instanceHitMissStats);
+		ComputeInstanceStats(M_i, neighborTable.Neighbors(i, hitSlot),
+				neighborTable.Neighbors(i, missSlot), instanceHitMissStats);
 		neighborStats.push_back(instanceHitMissStats);
 	}
 
@@ -112,7 +128,7 @@ bool SNReliefF::PreComputeNeighborGeneStats() {
 }
 
 bool SNReliefF::ComputeInstanceStats(DatasetInstance* dsi,
-		vector<unsigned int> hitIndicies, vector<unsigned int> missIndicies,
+		const unsigned int* hitIndicies, const unsigned int* missIndicies,
 		InstanceHitMissStats& hitMissStats) {
 	unsigned int numNumerics = dataset->NumNumerics();
 
@@ -121,10 +137,9 @@ bool SNReliefF::ComputeInstanceStats(DatasetInstance* dsi,
 	for(unsigned int numericIndex=0; numericIndex < numNumerics;
 			++numericIndex) {
 		vector<double> hitAttributeValues;
-		vector<unsigned int>::const_iterator hitIt = hitIndicies.begin();
-		for(; hitIt != hitIndicies.end(); ++hitIt) {
+		for(unsigned int j=0; j < k; ++j) {
 			NumericLevel thisValue =
-					dataset->GetInstance(*hitIt)->GetNumeric(numericIndex);
+					dataset->GetInstance(hitIndicies[j])->GetNumeric(numericIndex);
 			hitAttributeValues.push_back(thisValue);
 		}
 	  double average = 0.0;
@@ -138,10 +153,9 @@ bool SNReliefF::ComputeInstanceStats(DatasetInstance* dsi,
 	for(unsigned int numericIndex=0; numericIndex < numNumerics;
 			++numericIndex) {
 		vector<double> missAttributeValues;
-		vector<unsigned int>::const_iterator missIt = missIndicies.begin();
-		for(; missIt != missIndicies.end(); ++missIt) {
+		for(unsigned int j=0; j < k; ++j) {
 			NumericLevel thisValue =
-					dataset->GetInstance(*missIt)->GetNumeric(numericIndex);
+					dataset->GetInstance(missIndicies[j])->GetNumeric(numericIndex);
 			missAttributeValues.push_back(thisValue);
 		}
 	  double average = 0.0;
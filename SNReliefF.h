@@ -70,16 +70,28 @@ public:
    ****************************************************************************/
   SNReliefF(Dataset* ds, ConfigMap& configMap);
   bool ComputeAttributeScores();
+  /*************************************************************************//**
+   * Score one k at a time. The scores compare the averages and deviations
+   * of the gene values of the k nearest hits and misses.
+   * \param [in] ks values of k, ascending
+   * \param [out] kScores scores for each k
+   * \return success
+   ****************************************************************************/
+  bool ComputeScoresForKs(const std::vector<unsigned int>& ks,
+                          std::vector<AttributeScores>& kScores);
   /// Precompute nearest neighbor gene statistics for all instances.
   bool PreComputeNeighborGeneStats();
   /// Print the neighbor statistics data structure
   void PrintNeighborStats();
+  /// The neighbors of every instance are read, not only the sampled ones.
+  bool NeedsOnlySampledNeighbors();
   virtual ~SNReliefF();
 private:
-  /// Computes the nearest neighbor statistics for a particular instance.
+  /// Computes the nearest neighbor statistics for a particular instance
+  /// from the instance indices of its k nearest hits and misses.
   bool ComputeInstanceStats(DatasetInstance* dsi,
-  		std::vector<unsigned int> hitIndicies,
-  		std::vector<unsigned int> missIndicies,
+  		const unsigned int* hitIndicies,
+  		const unsigned int* missIndicies,
   		InstanceHitMissStats& hitMissStats);
   /// Prints all attribute stats to stdout.
   void PrintInstanceAttributeStats(InstanceAttributeStats stats);
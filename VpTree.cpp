@@ -0,0 +1,162 @@
+/*
+ * VpTree.cpp
+ *
+ * Vantage-point tree for exact nearest neighbor search over metric
+ * instance-to-instance distances.
+ */
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "VpTree.h"
+#include "Dataset.h"
+#include "Insilico.h"
+
+using namespace std;
+
+/// most instances in a leaf, searched by computing all their distances
+static const unsigned int VP_TREE_LEAF_SIZE = 16;
+/// relative tolerance for rounding of the distances bounding a subtree
+static const double VP_TREE_TOLERANCE = 1e-6;
+
+VpTree::VpTree() {
+  dataset = 0;
+}
+
+VpTree::~VpTree() {
+}
+
+double VpTree::Build(Dataset* ds, const vector<unsigned int>& newRows) {
+  Clear();
+  dataset = ds;
+  rows = newRows;
+  double numDistances = 0.0;
+  if(!rows.empty()) {
+    BuildNode(0, rows.size(), numDistances);
+  }
+
+  return numDistances;
+}
+
+void VpTree::Clear() {
+  rows.clear();
+  nodes.clear();
+}
+
+unsigned int VpTree::NumRows() {
+  return rows.size();
+}
+
+double VpTree::Search(unsigned int row, unsigned int k,
+                      DistancePrecision precision,
+                      vector<NeighborCandidate>& nearest) {
+  double numDistances = 0.0;
+  Nearest found(k);
+  if(!nodes.empty() && k) {
+    SearchNode(0, row, precision, found, numDistances);
+  }
+  nearest.assign(found.values().begin(), found.values().end());
+  sort(nearest.begin(), nearest.end());
+
+  return numDistances;
+}
+
+int VpTree::BuildNode(unsigned int begin, unsigned int end,
+                      double& numDistances) {
+  int nodeIdx = nodes.size();
+  nodes.push_back(VpNode());
+  VpNode node;
+  node.vantage = 0;
+  node.radius = 0.0;
+  node.begin = begin;
+  node.end = end;
+  node.inside = -1;
+  node.outside = -1;
+  if(end - begin <= VP_TREE_LEAF_SIZE) {
+    nodes[nodeIdx] = node;
+    return nodeIdx;
+  }
+
+  // the middle instance is the vantage point; split the rest at the median
+  // distance from it
+  swap(rows[begin], rows[begin + (end - begin) / 2]);
+  node.vantage = rows[begin];
+  vector<pair<double, unsigned int> > distances;
+  distances.reserve(end - begin - 1);
+  for(unsigned int i = begin + 1; i < end; ++i) {
+    distances.push_back(make_pair(
+            dataset->ComputeMaskedInstanceDistance(node.vantage, rows[i]),
+            rows[i]));
+  }
+  numDistances += distances.size();
+  unsigned int median = distances.size() / 2;
+  nth_element(distances.begin(), distances.begin() + median, distances.end());
+  node.radius = distances[median].first;
+  for(unsigned int i = 0; i < distances.size(); ++i) {
+    rows[begin + 1 + i] = distances[i].second;
+  }
+  unsigned int split = begin + 1 + median;
+  if(split > begin + 1) {
+    node.inside = BuildNode(begin + 1, split, numDistances);
+  }
+  node.outside = BuildNode(split, end, numDistances);
+  nodes[nodeIdx] = node;
+
+  return nodeIdx;
+}
+
+void VpTree::SearchNode(int nodeIdx, unsigned int row,
+                        DistancePrecision precision, Nearest& found,
+                        double& numDistances) {
+  const VpNode& node = nodes[nodeIdx];
+  if(node.inside < 0 && node.outside < 0) {
+    for(unsigned int i = node.begin; i < node.end; ++i) {
+      if(rows[i] != row) {
+        AddNeighbor(rows[i], dataset->ComputeMaskedInstanceDistance(row,
+                rows[i]), precision, found);
+        ++numDistances;
+      }
+    }
+    return;
+  }
+
+  // the query's own distance still bounds the subtrees: an instance with
+  // missing values is not at distance zero from itself
+  double distance = dataset->ComputeMaskedInstanceDistance(row, node.vantage);
+  ++numDistances;
+  if(node.vantage != row) {
+    AddNeighbor(node.vantage, distance, precision, found);
+  }
+
+  // instances inside are at least distance - radius away, those outside at
+  // least radius - distance; search the side of the query first
+  int subtrees[2] = {node.inside, node.outside};
+  double bounds[2] = {distance - node.radius, node.radius - distance};
+  if(distance >= node.radius) {
+    swap(subtrees[0], subtrees[1]);
+    swap(bounds[0], bounds[1]);
+  }
+  for(unsigned int side = 0; side < 2; ++side) {
+    if(subtrees[side] < 0) {
+      continue;
+    }
+    if(found.full()) {
+      double kthDistance = found.worst().first;
+      double tolerance = VP_TREE_TOLERANCE *
+              (kthDistance + distance + node.radius);
+      if(bounds[side] > kthDistance + tolerance) {
+        continue;
+      }
+    }
+    SearchNode(subtrees[side], row, precision, found, numDistances);
+  }
+}
+
+void VpTree::AddNeighbor(unsigned int neighborRow, double distance,
+                         DistancePrecision precision, Nearest& found) {
+  if(precision == FLOAT_PRECISION) {
+    distance = (float) distance;
+  }
+  found.add(make_pair(distance, neighborRow));
+}
@@ -0,0 +1,108 @@
+/**
+ * \class VpTree
+ *
+ * \brief Vantage-point tree for exact nearest neighbor search.
+ *
+ * Each node splits its instances at the median distance to a vantage point
+ * instance, so by the triangle inequality a whole subtree can be skipped
+ * when its distance bound from the query exceeds the k-th nearest distance
+ * found so far. Manhattan numeric distances, including the Weka-style
+ * missing value diffs, and gm and am genotype distances, including the
+ * RELIEF-D missing value penalty, are sums of per-attribute diffs that
+ * satisfy the triangle inequality, so the search is exact. On data of low
+ * intrinsic dimension, such as expression data, a query computes far fewer
+ * than n distances.
+ *
+ * Subtrees tied with the k-th distance, within a small rounding tolerance,
+ * are still searched, so the neighbors found are the k smallest by
+ * distance with ties broken by instance mask position, the same neighbors
+ * a scan of all instances selects for a k sweep.
+ *
+ * \sa ReliefF::PreComputeNeighborsVpTree
+ */
+
+#ifndef VPTREE_H
+#define	VPTREE_H
+
+#include <vector>
+#include <functional>
+
+#include "BestN.h"
+#include "NeighborTable.h"
+#include "Insilico.h"
+
+class Dataset;
+
+class VpTree
+{
+public:
+  VpTree();
+  ~VpTree();
+  /*************************************************************************//**
+   * Build a tree over instances of the current instance mask, with the
+   * distances of Dataset::ComputeMaskedInstanceDistance. Call
+   * Dataset::PrepareInstanceDistances first.
+   * \param [in] ds pointer to a Dataset object
+   * \param [in] newRows instance mask positions of the instances
+   * \return number of distances computed
+   ****************************************************************************/
+  double Build(Dataset* ds, const std::vector<unsigned int>& newRows);
+  /// Release the tree.
+  void Clear();
+  /// Return the number of instances in the tree.
+  unsigned int NumRows();
+  /*************************************************************************//**
+   * Find the k nearest instances of the tree to an instance.
+   * \param [in] row instance mask position of the query, never its own
+   *                 neighbor
+   * \param [in] k number of nearest neighbors
+   * \param [in] precision distances are rounded to floats in
+   *                       FLOAT_PRECISION, as a float distance matrix is
+   * \param [out] nearest up to k neighbors, nearest first, ties by instance
+   *                      mask position
+   * \return number of distances computed
+   ****************************************************************************/
+  double Search(unsigned int row, unsigned int k, DistancePrecision precision,
+                std::vector<NeighborCandidate>& nearest);
+private:
+  /// nearest neighbors found so far: smallest distances, ties by position
+  typedef insilico::best_n_accumulator<NeighborCandidate,
+  std::less<NeighborCandidate> > Nearest;
+  /**
+   * \struct VpNode.
+   * A leaf of instances, or a vantage point instance and the subtrees of the
+   * instances at most and at least the median distance from it.
+   */
+  struct VpNode
+  {
+    /// vantage point instance mask position, internal nodes only
+    unsigned int vantage;
+    /// median distance from the vantage point
+    double radius;
+    /// first position in rows of the instances of a leaf
+    unsigned int begin;
+    /// one past the last position in rows of the instances of a leaf
+    unsigned int end;
+    /// subtree of instances within radius, -1 for a leaf
+    int inside;
+    /// subtree of instances at radius or beyond, -1 for a leaf
+    int outside;
+  };
+  /// build the subtree of rows [begin, end) and return its node
+  int BuildNode(unsigned int begin, unsigned int end, double& numDistances);
+  /// search a subtree for the nearest neighbors of row
+  void SearchNode(int node, unsigned int row, DistancePrecision precision,
+                  Nearest& found, double& numDistances);
+  /// add an instance to the nearest neighbors found, at its distance
+  /// rounded as the precision
+  void AddNeighbor(unsigned int neighborRow, double distance,
+                   DistancePrecision precision, Nearest& found);
+  /// data set whose instance distances are searched
+  Dataset* dataset;
+  /// instance mask positions, reordered into the tree's subtrees
+  std::vector<unsigned int> rows;
+  /// tree nodes, the root first
+  std::vector<VpNode> nodes;
+};
+
+#endif	/* VPTREE_H */